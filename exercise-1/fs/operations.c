@@ -4,13 +4,6 @@
 #include <string.h>
 #include <pthread.h>
 
-int synchstrategy;
-
-pthread_mutex_t mutex_vetor;
-
-pthread_mutex_t mutex;
-pthread_rwlock_t rwlock;
-
 /* Given a path, fills pointers with strings for the parent path and child
  * file name
  * Input:
@@ -106,7 +99,7 @@ int lookup_sub_node(char *name, DirEntry *entries) {
 		return FAIL;
 	}
 	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (entries[i].inumber != FREE_INODE && strcmp(entries[i].name, name) == 0) {
+        if (entries[i].inumber != FREE_INODE && strncmp(entries[i].name, name, MAX_FILE_NAME) == 0) {
             return entries[i].inumber;
         }
     }
@@ -262,165 +255,22 @@ int lookup(char *name) {
 	/* get root inode data */
 	inode_get(current_inumber, &nType, &data);
 
-	char *path = strtok(full_path, delim);
+	/* lookups run in parallel, strtok would share its position */
+	char *saveptr;
+	char *path = strtok_r(full_path, delim, &saveptr);
 
 	/* search for all sub nodes */
 	while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
-		inode_get(current_inumber, &nType, &data);
-		path = strtok(NULL, delim);
+		/* only fails in a lookup without locks that raced with a delete,
+		which is then retried (see synch.c) */
+		if (inode_read(current_inumber, &nType, &data) == FAIL)
+			return FAIL;
+		path = strtok_r(NULL, delim, &saveptr);
 	}
 
 	return current_inumber;
 }
 
-/*
- * Get the synchstrategy given by the user
- * Input:
- *  - input: synctype
- *  FAIL: if mutex or rwlock do not init properly
- */
-void getSynch(char* input){
-	/* if synchstrategy is mutex, inicializes two mutex locks: one for the commands vector and 
-    the other for the content of the fs */
-    if (strcmp(input, "mutex") == 0) {
-
-        if (pthread_mutex_init(&mutex_vetor, NULL) != 0 || pthread_mutex_init(&mutex, NULL) != 0){
-            printf("synchstrategy mutex: at least one mutex init failed.\n"); 
-            exit(EXIT_FAILURE); 
-        }
-
-		synchstrategy = MUTEX;
-    }
-
-    /* if synchstrategy is rwlock, inicializes a mutex lock for the commands vector and 
-    a rwlock for the content of the fs */
-    else if (strcmp(input, "rwlock") == 0){
-
-        if (pthread_mutex_init(&mutex_vetor, NULL) != 0 || pthread_rwlock_init(&rwlock, NULL) != 0){
-            printf("synchstrategy rwlock: mutex init or rwlock init failed.\n"); 
-            exit(EXIT_FAILURE);
-        }
-
-		synchstrategy = RWLOCK;
-    }
-
-    else {
-        synchstrategy = NOSYNC;
-    }
-
-}
-
-
-/*
- * Lock the mutex or rwlock locks
- * Input:
- *  - synchstrategy: synctype
- * 	- rwlocktype: READONLY or READWRITE
- *  FAIL: if mutex or rwlock do not lock properly
- * 		  or synchstrategu or rwlocktype is invalid
- */
-void lock(int synchstrategy, int rwlocktype){
-
-	switch(synchstrategy){
-		case NOSYNC:
-			return;
-		case MUTEX:
-			if (pthread_mutex_lock(&mutex) != 0){
-				fprintf(stderr, "Error: mutex failed to lock\n");
-                exit(EXIT_FAILURE);
-			}
-			return;
-
-		case RWLOCK:
-			if (rwlocktype == READONLY){
-				if (pthread_rwlock_rdlock(&rwlock) != 0){
-					fprintf(stderr, "Error: rwlock failed to lock\n");
-                    exit(EXIT_FAILURE);
-				}
-				return;
-			}
-			else if (rwlocktype == READWRITE){
-				if (pthread_rwlock_wrlock(&rwlock) != 0){
-					fprintf(stderr, "Error: rwlock failed to lock\n");
-                    exit(EXIT_FAILURE);
-				}
-				return;
-			}
-			else {
-				fprintf(stderr, "Error: invalid rwlocktype\n");
-				return;
-			}
-
-		default: { /* error */
-			fprintf(stderr, "Error: invalid synchstrategy\n");
-			exit(EXIT_FAILURE);
-		}
-	}
-}
-
-/*
- * Unlock the mutex or rwlock locks
- * Input:
- *  - locktype: synchstrategy
- *  FAIL: if mutex or rwlock do not lock properly
- * 		  or locktype is invalid
- */
-void unlock(int locktype){
-
-	switch(locktype){
-		case NOSYNC:
-			return;
-		case MUTEX:
-			if (pthread_mutex_unlock(&mutex) != 0){
-				fprintf(stderr, "Error: mutex failed to unlock\n");
-                exit(EXIT_FAILURE);
-			}
-			return;
-		case RWLOCK:
-			if (pthread_rwlock_unlock(&rwlock) != 0){
-				fprintf(stderr, "Error: mutex failed to unlock\n");
-                exit(EXIT_FAILURE);
-			}
-			return;
-		default: { /* error */
-			fprintf(stderr, "Error: invalid locktype\n");
-			exit(EXIT_FAILURE);
-		}
-	}
-}
-
-
-/*
- * Destroy all the locks created
- * Input:
- *  - synchstrategy: synctype
- *  FAIL: if mutex or rwlock do not get destroyed properly
- * 		  or synchstrategy is invalid
- */
-void destroylocks(int synchstrategy){
-	switch (synchstrategy){
-        case NOSYNC:
-            break;
-        case MUTEX:
-            if (pthread_mutex_destroy(&mutex_vetor) != 0 || pthread_mutex_destroy(&mutex) != 0){
-                printf("synchstrategy mutex: at least one mutex destroy failed.\n"); 
-                exit(EXIT_FAILURE);
-            }
-            break;
-        case RWLOCK:
-            if (pthread_mutex_destroy(&mutex_vetor) != 0 || pthread_rwlock_destroy(&rwlock) != 0){
-                printf("synchstrategy rwlock: mutex init or rwlock destroy failed.\n"); 
-                exit(EXIT_FAILURE);
-            }
-            break;
-        default: {
-            fprintf(stderr, "Error: syncstrategy is not valid\n");
-            exit(EXIT_FAILURE);
-        }
-    }
-}
-
-
 /*
  * Prints tecnicofs tree.
  * Input:
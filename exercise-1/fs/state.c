@@ -7,6 +7,13 @@
 
 inode_t inode_table[INODE_TABLE_SIZE];
 
+/*
+ * Entry tables of the directories, one for each i-node. They are never
+ * freed, so a lookup without locks (seqlock) that races with a delete
+ * still reads valid memory.
+ */
+static DirEntry dir_entries[INODE_TABLE_SIZE][MAX_DIR_ENTRIES];
+
 
 /*
  * Sleeps for synchronization testing.
@@ -33,12 +40,9 @@ void inode_table_init() {
 
 void inode_table_destroy() {
     for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (inode_table[i].nodeType != T_NONE) {
-            /* as data is an union, the same pointer is used for both dirEntries and fileContents */
-            /* just release one of them */
-	  if (inode_table[i].data.dirEntries)
-            free(inode_table[i].data.dirEntries);
-        }
+        /* the entry tables of the directories are not allocated */
+        if (inode_table[i].nodeType == T_FILE && inode_table[i].data.fileContents)
+            free(inode_table[i].data.fileContents);
     }
 }
 
@@ -55,12 +59,16 @@ int inode_create(type nType) {
     insert_delay(DELAY);
 
     for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if (inode_table[inumber].nodeType == T_NONE) {
-            inode_table[inumber].nodeType = nType;
+        type none = T_NONE;
+
+        /* commands in different stripes (see synch.c) may create at once */
+        if (__atomic_load_n(&inode_table[inumber].nodeType, __ATOMIC_ACQUIRE) == T_NONE &&
+            __atomic_compare_exchange_n(&inode_table[inumber].nodeType, &none, nType, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
 
             if (nType == T_DIRECTORY) {
                 /* Initializes entry table */
-                inode_table[inumber].data.dirEntries = malloc(sizeof(DirEntry) * MAX_DIR_ENTRIES);
+                inode_table[inumber].data.dirEntries = dir_entries[inumber];
                 
                 for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
                     inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
@@ -90,28 +98,25 @@ int inode_delete(int inumber) {
         return FAIL;
     } 
 
-    inode_table[inumber].nodeType = T_NONE;
     /* see inode_table_destroy function */
-    if (inode_table[inumber].data.dirEntries)
-        free(inode_table[inumber].data.dirEntries);
+    if (inode_table[inumber].nodeType == T_FILE && inode_table[inumber].data.fileContents)
+        free(inode_table[inumber].data.fileContents);
+
+    /* free for another create only once it is released */
+    __atomic_store_n(&inode_table[inumber].nodeType, T_NONE, __ATOMIC_RELEASE);
     return SUCCESS;
 }
 
 /*
- * Copies the contents of the i-node into the arguments.
- * Only the fields referenced by non-null arguments are copied.
- * Input:
- *  - inumber: identifier of the i-node
- *  - nType: pointer to type
- *  - data: pointer to data
+ * Copies the contents of the i-node into the arguments, as inode_get,
+ * without reporting an invalid inumber.
  * Returns: SUCCESS or FAIL
  */
-int inode_get(int inumber, type *nType, union Data *data) {
+int inode_read(int inumber, type *nType, union Data *data) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
     if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
-        printf("inode_get: invalid inumber %d\n", inumber);
         return FAIL;
     }
 
@@ -124,6 +129,24 @@ int inode_get(int inumber, type *nType, union Data *data) {
     return SUCCESS;
 }
 
+/*
+ * Copies the contents of the i-node into the arguments.
+ * Only the fields referenced by non-null arguments are copied.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - nType: pointer to type
+ *  - data: pointer to data
+ * Returns: SUCCESS or FAIL
+ */
+int inode_get(int inumber, type *nType, union Data *data) {
+    if (inode_read(inumber, nType, data) == FAIL) {
+        printf("inode_get: invalid inumber %d\n", inumber);
+        return FAIL;
+    }
+
+    return SUCCESS;
+}
+
 
 /*
  * Resets an entry for a directory.
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "operations.h"
+
+int synchstrategy;
+
+pthread_mutex_t mutex_vetor;
+
+pthread_mutex_t mutex;
+pthread_rwlock_t rwlock;
+
+/* striped: the root and the stripes, by inumber of the top directory */
+static pthread_rwlock_t stripes[SYNCH_STRIPES];
+
+/* seqlock: odd while a command changes the fs (writers hold mutex) */
+static unsigned sequence = 0;
+
+/* spinlock: 1 while held */
+static int spin = 0;
+
+/* held by a striped lock of a path that is not under any stripe */
+#define STRIPE_ROOT -1
+
+static void check(int result, char *message) {
+    if (result != 0) {
+        fprintf(stderr, "Error: %s\n", message);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline void synch_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * Waits before trying again for a lock, twice as long as the time before.
+ * Once that is SPIN_MAX_BACKOFF, it gives up the processor instead: the
+ * holder may be waiting for it.
+ * Input:
+ *  - backoff: pauses of the wait, starting at SPIN_MIN_BACKOFF
+ */
+static void synch_backoff(int *backoff) {
+    if (*backoff >= SPIN_MAX_BACKOFF) {
+        sched_yield();
+        return;
+    }
+    for (int i = 0; i < *backoff; i++)
+        synch_relax();
+    *backoff *= 2;
+}
+
+
+/*
+ * mutex: a single lock for the fs.
+ */
+static void mutex_init() {
+    check(pthread_mutex_init(&mutex, NULL), "mutex init failed");
+}
+
+static void mutex_lock(int rwlocktype, char *name, int *held) {
+    check(pthread_mutex_lock(&mutex), "mutex failed to lock");
+}
+
+static void mutex_unlock(int held) {
+    check(pthread_mutex_unlock(&mutex), "mutex failed to unlock");
+}
+
+static void mutex_destroy() {
+    check(pthread_mutex_destroy(&mutex), "mutex destroy failed");
+}
+
+
+/*
+ * rwlock: a single lock for the fs, shared by the lookups.
+ */
+static void rw_lock(pthread_rwlock_t *rw, int rwlocktype) {
+    if (rwlocktype == READONLY)
+        check(pthread_rwlock_rdlock(rw), "rwlock failed to lock");
+    else
+        check(pthread_rwlock_wrlock(rw), "rwlock failed to lock");
+}
+
+static void rwlock_init() {
+    check(pthread_rwlock_init(&rwlock, NULL), "rwlock init failed");
+}
+
+static void rwlock_lock(int rwlocktype, char *name, int *held) {
+    rw_lock(&rwlock, rwlocktype);
+}
+
+static void rwlock_unlock(int held) {
+    check(pthread_rwlock_unlock(&rwlock), "rwlock failed to unlock");
+}
+
+static void rwlock_destroy() {
+    check(pthread_rwlock_destroy(&rwlock), "rwlock destroy failed");
+}
+
+
+/*
+ * striped: the directories at the top of the tree split it in subtrees
+ * that don't share any i-node, and a command under one of them only locks
+ * the stripe of its inumber, in the mode it needs, so commands under
+ * different ones run in parallel. rwlock guards the entries of the root:
+ * commands under a top directory share it, and the ones on the entries
+ * of the root take it alone.
+ */
+static void striped_init() {
+    rwlock_init();
+    for (int i = 0; i < SYNCH_STRIPES; i++)
+        check(pthread_rwlock_init(&stripes[i], NULL), "rwlock init failed");
+}
+
+/*
+ * Gets the name of the directory at the top of a path.
+ * Input:
+ *  - name: the path
+ *  - top: where the name of the top directory is stored
+ * Returns: 1 if the path is under it, 0 if it is an entry of the root
+ */
+static int striped_top(char *name, char *top) {
+    int length = 0;
+
+    while (*name == '/')
+        name++;
+    while (*name != '\0' && *name != '/' && length < MAX_FILE_NAME - 1)
+        top[length++] = *name++;
+    top[length] = '\0';
+    while (*name == '/')
+        name++;
+
+    return *name != '\0';
+}
+
+static void striped_lock(int rwlocktype, char *name, int *held) {
+    char top[MAX_FILE_NAME];
+    union Data data;
+    int inumber;
+
+    *held = STRIPE_ROOT;
+    if (!striped_top(name, top)) {
+        rw_lock(&rwlock, rwlocktype);
+        return;
+    }
+
+    /* the top directory can't be deleted while the root is shared */
+    rw_lock(&rwlock, READONLY);
+    inode_get(FS_ROOT, NULL, &data);
+    if ((inumber = lookup_sub_node(top, data.dirEntries)) != FAIL) {
+        *held = inumber % SYNCH_STRIPES;
+        rw_lock(&stripes[*held], rwlocktype);
+    }
+}
+
+static void striped_unlock(int held) {
+    if (held != STRIPE_ROOT)
+        check(pthread_rwlock_unlock(&stripes[held]), "rwlock failed to unlock");
+    check(pthread_rwlock_unlock(&rwlock), "rwlock failed to unlock");
+}
+
+static void striped_destroy() {
+    rwlock_destroy();
+    for (int i = 0; i < SYNCH_STRIPES; i++)
+        check(pthread_rwlock_destroy(&stripes[i]), "rwlock destroy failed");
+}
+
+
+/*
+ * seqlock: the commands that change the fs take mutex and make sequence
+ * odd while they do. Lookups take no lock: they run while sequence is even
+ * and retry if it changed meanwhile, as they may have seen a half done
+ * change. A lookup only reads the i-node table and the entry tables,
+ * which are never freed (see state.c), so it can't fault on one.
+ */
+static void seqlock_init() {
+    mutex_init();
+    sequence = 0;
+}
+
+static void seqlock_lock(int rwlocktype, char *name, int *held) {
+    mutex_lock(rwlocktype, name, held);
+
+    *held = rwlocktype == READWRITE;
+    if (*held) {
+        __atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+static void seqlock_unlock(int held) {
+    if (held)
+        __atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELEASE);
+    mutex_unlock(held);
+}
+
+static int seqlock_lookup(char *name) {
+    int held, result;
+
+    for (int tries = 0; tries < SEQLOCK_RETRIES; tries++) {
+        int backoff = SPIN_MIN_BACKOFF;
+        unsigned start;
+
+        while ((start = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE)) & 1)
+            synch_backoff(&backoff);
+
+        result = lookup(name);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sequence, __ATOMIC_RELAXED) == start)
+            return result;
+    }
+
+    /* too many changes meanwhile: wait for the writers */
+    seqlock_lock(READONLY, name, &held);
+    result = lookup(name);
+    seqlock_unlock(held);
+    return result;
+}
+
+
+/*
+ * spinlock: a single lock for the fs, test-and-test-and-set. Threads wait
+ * reading the lock, so they don't take its cache line from the holder,
+ * and back off (see synch_backoff) after losing it to another.
+ */
+static void spinlock_init() {
+    spin = 0;
+}
+
+static void spinlock_lock(int rwlocktype, char *name, int *held) {
+    int backoff = SPIN_MIN_BACKOFF;
+
+    for (;;) {
+        while (__atomic_load_n(&spin, __ATOMIC_RELAXED))
+            synch_backoff(&backoff);
+
+        if (!__atomic_exchange_n(&spin, 1, __ATOMIC_ACQUIRE))
+            return;
+
+        synch_backoff(&backoff);
+    }
+}
+
+static void spinlock_unlock(int held) {
+    __atomic_store_n(&spin, 0, __ATOMIC_RELEASE);
+}
+
+
+/* a NULL hook has nothing to do */
+static SynchStrategy synch_strategies[SYNCH_STRATEGIES] = {
+    [NOSYNC]   = { "nosync", NULL, NULL, NULL, NULL, NULL },
+    [MUTEX]    = { "mutex", mutex_init, mutex_lock, mutex_unlock, NULL, mutex_destroy },
+    [RWLOCK]   = { "rwlock", rwlock_init, rwlock_lock, rwlock_unlock, NULL, rwlock_destroy },
+    [STRIPED]  = { "striped", striped_init, striped_lock, striped_unlock, NULL, striped_destroy },
+    [SEQLOCK]  = { "seqlock", seqlock_init, seqlock_lock, seqlock_unlock, seqlock_lookup, mutex_destroy },
+    [SPINLOCK] = { "spinlock", spinlock_init, spinlock_lock, spinlock_unlock, NULL, NULL },
+};
+
+
+/*
+ * Get the synchstrategy given by the user
+ * Input:
+ *  - input: synctype (nosync if it is none of them)
+ *  FAIL: if its locks do not init properly
+ */
+void getSynch(char* input){
+    synchstrategy = NOSYNC;
+    for (int i = 0; i < SYNCH_STRATEGIES; i++) {
+        if (strcmp(input, synch_strategies[i].name) == 0)
+            synchstrategy = i;
+    }
+
+    /* besides the locks of the fs, a mutex for the commands vector */
+    if (synchstrategy != NOSYNC)
+        check(pthread_mutex_init(&mutex_vetor, NULL), "mutex init failed");
+
+    if (synch_strategies[synchstrategy].init)
+        synch_strategies[synchstrategy].init();
+}
+
+
+/*
+ * Lock the fs for a command
+ * Input:
+ *  - synchstrategy: synctype
+ *  - rwlocktype: READONLY or READWRITE
+ *  - name: path of the command
+ *  - held: where what was locked is stored, for unlock
+ *  FAIL: if a lock does not lock properly
+ */
+void lock(int synchstrategy, int rwlocktype, char *name, int *held){
+    *held = 0;
+    if (synch_strategies[synchstrategy].lock)
+        synch_strategies[synchstrategy].lock(rwlocktype, name, held);
+}
+
+/*
+ * Unlock the fs after a command
+ * Input:
+ *  - synchstrategy: synctype
+ *  - held: as stored by lock
+ *  FAIL: if a lock does not unlock properly
+ */
+void unlock(int synchstrategy, int held){
+    if (synch_strategies[synchstrategy].unlock)
+        synch_strategies[synchstrategy].unlock(held);
+}
+
+/*
+ * Lookup for a given path, synchronized with the other commands.
+ * Input:
+ *  - synchstrategy: synctype
+ *  - name: path of node
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ */
+int synch_lookup(int synchstrategy, char *name){
+    int held, result;
+
+    if (synch_strategies[synchstrategy].lookup)
+        return synch_strategies[synchstrategy].lookup(name);
+
+    lock(synchstrategy, READONLY, name, &held);
+    result = lookup(name);
+    unlock(synchstrategy, held);
+    return result;
+}
+
+
+/*
+ * Destroy all the locks created
+ * Input:
+ *  - synchstrategy: synctype
+ *  FAIL: if a lock does not get destroyed properly
+ */
+void destroylocks(int synchstrategy){
+    if (synchstrategy != NOSYNC)
+        check(pthread_mutex_destroy(&mutex_vetor), "mutex destroy failed");
+
+    if (synch_strategies[synchstrategy].destroy)
+        synch_strategies[synchstrategy].destroy();
+}
@@ -0,0 +1,47 @@
+#ifndef SYNCH_H
+#define SYNCH_H
+
+/* synchronization strategies (indexes of synch_strategies) */
+#define NOSYNC 0
+#define MUTEX 1
+#define RWLOCK 2
+#define STRIPED 3
+#define SEQLOCK 4
+#define SPINLOCK 5
+#define SYNCH_STRATEGIES 6
+
+/* lock modes */
+#define READONLY 3
+#define READWRITE 4
+
+/* stripes of the striped strategy */
+#define SYNCH_STRIPES 16
+/* lookups without locks (seqlock) that see a write before they take the
+lock of the writers */
+#define SEQLOCK_RETRIES 8
+/* pauses between tries for a spinning lock, at first and before it
+yields the processor */
+#define SPIN_MIN_BACKOFF 4
+#define SPIN_MAX_BACKOFF 1024
+
+/*
+ * A synchronization strategy. lock and unlock bracket a command on a
+ * path; held is whatever lock needs to pass to unlock. lookup searches
+ * a path, with whatever locks (or none) the strategy needs.
+ */
+typedef struct synchStrategy {
+    char *name;
+    void (*init)();
+    void (*lock)(int rwlocktype, char *name, int *held);
+    void (*unlock)(int held);
+    int (*lookup)(char *name);
+    void (*destroy)();
+} SynchStrategy;
+
+void getSynch(char* input);
+void lock(int synchstrategy, int rwlocktype, char *name, int *held);
+void unlock(int synchstrategy, int held);
+int synch_lookup(int synchstrategy, char *name);
+void destroylocks(int synchstrategy);
+
+#endif /* SYNCH_H */
@@ -0,0 +1,147 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+
+/*
+ * Opens and maps a command file.
+ * Input:
+ *  - path: path of the file
+ * Returns: 0 if successful, -1 otherwise
+ */
+int input_open(Input *input, const char *path) {
+    struct stat st;
+
+    input->data = NULL;
+    input->size = 0;
+    input->position = 0;
+    input->released = 0;
+
+    if ((input->fd = open(path, O_RDONLY)) == -1)
+        return -1;
+
+    if (fstat(input->fd, &st) == -1) {
+        close(input->fd);
+        return -1;
+    }
+
+    /* an empty file can't be mapped, it just has no lines */
+    if (st.st_size == 0)
+        return 0;
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, input->fd, 0);
+
+    if (data == MAP_FAILED) {
+        close(input->fd);
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    input->data = data;
+    input->size = st.st_size;
+    return 0;
+}
+
+/*
+ * Gives back the pages read since the last release. They are only dropped
+ * from this process: the mapping is of an unchanged file, so a line still
+ * in use is read again from it if needed.
+ */
+static void input_release(Input *input) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t end = input->position & ~(page - 1);
+
+    if (end > input->released) {
+        madvise((char *) input->data + input->released, end - input->released, MADV_DONTNEED);
+        input->released = end;
+    }
+}
+
+/*
+ * Gets the next line of the file, without its newline.
+ * Input:
+ *  - line: where the start of the line (in the mapping) is stored
+ *  - length: where its length is stored
+ * Returns: 1 if there is a line, 0 at the end of the file
+ */
+int input_next(Input *input, const char **line, size_t *length) {
+    if (input->position >= input->size)
+        return 0;
+
+    const char *start = input->data + input->position;
+    const char *newline = memchr(start, '\n', input->size - input->position);
+    size_t n = newline ? (size_t) (newline - start) : input->size - input->position;
+
+    *line = start;
+    *length = n;
+    input->position += newline ? n + 1 : n;
+
+    if (input->position - input->released >= INPUT_WINDOW)
+        input_release(input);
+
+    return 1;
+}
+
+static int input_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/*
+ * Copies a word of a line, skipping the blanks before it.
+ * Returns: 1 if there is a word, 0 if the line ends first, -1 if the word
+ * doesn't fit in max bytes
+ */
+static int input_word(const char *line, size_t length, size_t *i, char *word, size_t max) {
+    size_t start;
+
+    while (*i < length && input_space(line[*i]))
+        (*i)++;
+    if (*i == length)
+        return 0;
+
+    for (start = *i; *i < length && !input_space(line[*i]); (*i)++)
+        ;
+    if (*i - start >= max)
+        return -1;
+
+    memcpy(word, line + start, *i - start);
+    word[*i - start] = '\0';
+    return 1;
+}
+
+/*
+ * Splits a line in a one character token and up to two words, as
+ * sscanf(line, "%c %s %s") would.
+ * Input:
+ *  - line, length: the line
+ *  - token: where the first character is stored
+ *  - first, second: where the words are stored
+ *  - max: size of first and second
+ * Returns: number of fields stored (0 if the line is empty), -1 if a word
+ * doesn't fit
+ */
+int input_tokens(const char *line, size_t length, char *token, char *first, char *second, size_t max) {
+    size_t i = 1;
+    int n;
+
+    if (length == 0)
+        return 0;
+    *token = line[0];
+
+    if ((n = input_word(line, length, &i, first, max)) <= 0)
+        return n == 0 ? 1 : -1;
+    if ((n = input_word(line, length, &i, second, max)) <= 0)
+        return n == 0 ? 2 : -1;
+    return 3;
+}
+
+/*
+ * Unmaps and closes a command file.
+ */
+void input_close(Input *input) {
+    if (input->data != NULL)
+        munmap((void *) input->data, input->size);
+    close(input->fd);
+}
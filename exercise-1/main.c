@@ -7,8 +7,8 @@
 #include <pthread.h>
 #include <sys/time.h>
 #include "fs/operations.h"
+#include "input.h"
 
-#define MAX_COMMANDS 150000
 #define MAX_INPUT_SIZE 100
 
 int numberThreads = 0;
@@ -19,24 +19,28 @@ extern pthread_mutex_t mutex_vetor;
 extern pthread_mutex_t mutex;
 extern pthread_rwlock_t rwlock;
 
-char inputCommands[MAX_COMMANDS][MAX_INPUT_SIZE];
-int numberCommands = 0;
-int headQueue = 0;
+/* the commands, read in place by the threads */
+Input inputCommands;
 
-int insertCommand(char* data) {
-    if(numberCommands != MAX_COMMANDS) {
-        strcpy(inputCommands[numberCommands++], data);
-        return 1;
+/*
+ * Takes the next line of the input.
+ * Input:
+ *  - line, length: where the line (in the input file) is stored
+ * Returns: 1 if there is a line, 0 at the end of the input
+ */
+int removeCommand(const char **line, size_t *length) {
+    int found;
+
+    if (synchstrategy != NOSYNC){
+        pthread_mutex_lock(&mutex_vetor);
     }
-    return 0;
-}
 
-char* removeCommand() {
-    if(numberCommands > 0){
-        numberCommands--;
-        return inputCommands[headQueue++];  
+    found = input_next(&inputCommands, line, length);
+
+    if (synchstrategy != NOSYNC){
+        pthread_mutex_unlock(&mutex_vetor);
     }
-    return NULL;
+    return found;
 }
 
 void errorParse(){
@@ -44,92 +48,57 @@ void errorParse(){
     exit(EXIT_FAILURE);
 }
 
-void processInput( FILE *input ){
-    char line[MAX_INPUT_SIZE];
+void *applyCommands(){
+    const char *line;
+    size_t length;
 
-    /* break loop with ^Z or ^D */
-    while (fgets(line, sizeof(line)/sizeof(char), input)) {
-        char token, type;
-        char name[MAX_INPUT_SIZE];
+    /* the lines are parsed where they are mapped, no queue is filled first */
+    while (removeCommand(&line, &length)){
+        char token, type = '\0';
+        char name[MAX_INPUT_SIZE], arg[MAX_INPUT_SIZE];
 
-        int numTokens = sscanf(line, "%c %s %c", &token, name, &type);
+        int numTokens = input_tokens(line, length, &token, name, arg, MAX_INPUT_SIZE);
 
         /* perform minimal validation */
-        if (numTokens < 1) {
+        if (numTokens < 0) {
+            errorParse();
+        }
+        if (numTokens < 1 || token == '#') {
             continue;
         }
         switch (token) {
             case 'c':
                 if(numTokens != 3)
                     errorParse();
-                if(insertCommand(line))
-                    break;
-                return;
-            
+                type = arg[0];
+                break;
+
             case 'l':
-                if(numTokens != 2)
-                    errorParse();
-                if(insertCommand(line))
-                    break;
-                return;
-            
             case 'd':
                 if(numTokens != 2)
                     errorParse();
-                if(insertCommand(line))
-                    break;
-                return;
-            
-            case '#':
                 break;
-            
+
             default: { /* error */
                 errorParse();
             }
         }
-    }
-}
-
-void *applyCommands(){
-
-    while (numberCommands > 0){
-        if (synchstrategy != NOSYNC){
-            pthread_mutex_lock(&mutex_vetor);
-        }
-        
-        const char* command = removeCommand();
-
-        if (synchstrategy != NOSYNC){
-            pthread_mutex_unlock(&mutex_vetor);
-        }
-
-        if (command == NULL){
-            continue;
-        }
-
-        char token, type;
-        char name[MAX_INPUT_SIZE];
-        int numTokens = sscanf(command, "%c %s %c", &token, name, &type);
-        if (numTokens < 2) {
-            fprintf(stderr, "Error: invalid command in Queue\n");
-            exit(EXIT_FAILURE);
-        }
 
-        int searchResult;
+        int searchResult, held;
         switch (token) {
             case 'c':
                 switch (type) {
                     case 'f':
-                        lock(synchstrategy, READWRITE);
+                        lock(synchstrategy, READWRITE, name, &held);
                         printf("Create file: %s\n", name);
                         create(name, T_FILE);
-                        unlock(synchstrategy);
+                        unlock(synchstrategy, held);
                         break;
                     case 'd':
-                        lock(synchstrategy, READWRITE);
+                        lock(synchstrategy, READWRITE, name, &held);
                         printf("Create directory: %s\n", name);
                         create(name, T_DIRECTORY);
-                        unlock(synchstrategy);
+                        unlock(synchstrategy, held);
                         break;
                     default: {
                         fprintf(stderr, "Error: invalid node type\n");
@@ -138,19 +107,18 @@ void *applyCommands(){
                 }
                 break;
             case 'l': 
-                lock(synchstrategy, READONLY);
-                searchResult = lookup(name);
+                /* a strategy may look it up without locks, and retry */
+                searchResult = synch_lookup(synchstrategy, name);
                 if (searchResult >= 0)
                     printf("Search: %s found\n", name);
                 else
                     printf("Search: %s not found\n", name);
-                unlock(synchstrategy);
                 break;
             case 'd':
-                lock(synchstrategy, READWRITE);
+                lock(synchstrategy, READWRITE, name, &held);
                 printf("Delete: %s\n", name);
                 delete(name);
-                unlock(synchstrategy);
+                unlock(synchstrategy, held);
                 break;
             default: { /* error */
                 fprintf(stderr, "Error: command to apply\n");
@@ -193,9 +161,12 @@ int main(int argc, char* argv[]){
     init_fs();
 
     /* open input file, process input and close the file*/
-    FILE *inputfile, *outputfile;
-    inputfile = fopen(argv[1], "r");
-    processInput(inputfile);
+    FILE *outputfile;
+
+    if (input_open(&inputCommands, argv[1]) != 0){
+        fprintf(stderr, "Error: Input file not found\n");
+        exit(EXIT_FAILURE);
+    }
 
     /* create the threads */
     for (i = 0; i < numberThreads; i++){
@@ -213,7 +184,7 @@ int main(int argc, char* argv[]){
     }
 
     /* close inputfile */
-    fclose(inputfile);
+    input_close(&inputCommands);
 
 
     /* destroy all the locks created */
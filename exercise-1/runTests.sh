@@ -0,0 +1,41 @@
+#!/bin/bash
+
+inputdir=$1
+outputdir=$2
+numthreads=$3
+
+# nosync only runs with one thread
+strategies="nosync mutex rwlock striped seqlock spinlock"
+
+if ! [ -d "$inputdir" ]; then
+    echo "Input directory does not exist."
+    exit 1
+fi
+
+if ! [ -d "$outputdir" ]; then  
+    echo "Output directory does not exist."
+    exit 1
+fi 
+
+if ! [[ "$numthreads" =~ ^[0-9]+$ ]]; then
+    echo "Not positive integer."
+    exit 1
+fi
+
+for input in $(ls $inputdir)
+do
+    for strategy in $strategies
+    do
+        maxthreads=$numthreads
+        if [ "$strategy" = "nosync" ]; then
+            maxthreads=1
+        fi
+
+        for Numthreads in $(seq 1 $maxthreads)
+        do 
+            echo InputFile = $input NumThreads = $Numthreads Strategy = $strategy
+            ./tecnicofs $inputdir/$input $2/"${input%.*}-${strategy}-${Numthreads}.txt" $Numthreads $strategy | 
+                grep -m 1 "TecnicoFS" | head -1
+        done
+    done
+done
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include "lockprof.h"
+#include "state.h"
+
+/*
+ * Counters of an i-node.
+ */
+typedef struct lockStats {
+    unsigned long acquisitions;
+    unsigned long contended;
+    unsigned long busy;
+    unsigned long wait_ns;
+    unsigned long hold_ns;
+} LockStats;
+
+/*
+ * Lock held by the calling thread, until its release.
+ */
+typedef struct heldLock {
+    pthread_rwlock_t *lock;
+    LockSite *site;
+    long acquired;
+} HeldLock;
+
+static LockStats lockprof_inodes[INODE_TABLE_SIZE];
+/* call sites that took a lock, pushed when they first do */
+static LockSite *lockprof_sites = NULL;
+
+/* a command holds at most LOCKSVECTOR_SIZE locks */
+static __thread HeldLock held[LOCKSVECTOR_SIZE];
+static __thread int nheld = 0;
+
+#define LOCKPROF_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+
+static long lockprof_clock() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/*
+ * Adds a call site to the list of the sites, the first time it locks.
+ */
+static void lockprof_register(LockSite *site) {
+    int registered = 0;
+
+    if (__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE) ||
+        !__atomic_compare_exchange_n(&site->registered, &registered, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+
+    site->next = __atomic_load_n(&lockprof_sites, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&lockprof_sites, &site->next, site, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        ;
+}
+
+/*
+ * Locks an i-node lock, recording if it had to wait and for how long.
+ * Input:
+ *  - lock: the lock
+ *  - inumber: identifier of its i-node
+ *  - flags: LOCKPROF_READ for a read lock, LOCKPROF_TRY to only try it
+ *  - site: the call site (LOCK_SITE)
+ * Returns: the result of the pthread call
+ */
+int lockprof_acquire(pthread_rwlock_t *lock, int inumber, int flags, LockSite *site) {
+    LockStats *stats = &lockprof_inodes[inumber];
+    int read = flags & LOCKPROF_READ;
+    int res = read ? pthread_rwlock_tryrdlock(lock) : pthread_rwlock_trywrlock(lock);
+    long start = 0, now;
+
+    lockprof_register(site);
+
+    if (res == EBUSY && (flags & LOCKPROF_TRY)) {
+        LOCKPROF_ADD(stats->busy, 1);
+        LOCKPROF_ADD(site->busy, 1);
+        return res;
+    }
+
+    /* only the acquisitions that found the lock taken are timed */
+    if (res == EBUSY) {
+        start = lockprof_clock();
+        res = read ? pthread_rwlock_rdlock(lock) : pthread_rwlock_wrlock(lock);
+    }
+
+    if (res != 0)
+        return res;
+
+    now = lockprof_clock();
+    LOCKPROF_ADD(stats->acquisitions, 1);
+    LOCKPROF_ADD(site->acquisitions, 1);
+    if (start != 0) {
+        LOCKPROF_ADD(stats->contended, 1);
+        LOCKPROF_ADD(stats->wait_ns, now - start);
+        LOCKPROF_ADD(site->contended, 1);
+        LOCKPROF_ADD(site->wait_ns, now - start);
+    }
+
+    if (nheld < LOCKSVECTOR_SIZE)
+        held[nheld++] = (HeldLock) { lock, site, now };
+
+    return res;
+}
+
+/*
+ * Unlocks an i-node lock, recording how long it was held.
+ * Input:
+ *  - lock: the lock
+ *  - inumber: identifier of its i-node
+ * Returns: the result of the pthread call
+ */
+int lockprof_release(pthread_rwlock_t *lock, int inumber) {
+    long now = lockprof_clock();
+
+    for (int i = nheld - 1; i >= 0; i--) {
+        if (held[i].lock == lock) {
+            LOCKPROF_ADD(lockprof_inodes[inumber].hold_ns, now - held[i].acquired);
+            LOCKPROF_ADD(held[i].site->hold_ns, now - held[i].acquired);
+            held[i] = held[--nheld];
+            break;
+        }
+    }
+
+    return pthread_rwlock_unlock(lock);
+}
+
+/*
+ * Prints the i-nodes and the call sites that waited the longest for their
+ * locks, LOCKPROF_TOP of each. Called once all threads have joined.
+ * Input:
+ *  - fp: where the report is printed
+ */
+void lockprof_report(FILE *fp) {
+    int inodes[LOCKPROF_TOP], ninodes = 0, nsites = 0;
+    LockSite *sites[LOCKPROF_TOP];
+
+    /* the top i-nodes, by time waited and then by acquisitions */
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        LockStats *s = &lockprof_inodes[i];
+        int j;
+
+        if (s->acquisitions == 0 && s->busy == 0)
+            continue;
+
+        for (j = ninodes; j > 0 && (s->wait_ns > lockprof_inodes[inodes[j - 1]].wait_ns ||
+             (s->wait_ns == lockprof_inodes[inodes[j - 1]].wait_ns &&
+              s->acquisitions > lockprof_inodes[inodes[j - 1]].acquisitions)); j--)
+            if (j < LOCKPROF_TOP)
+                inodes[j] = inodes[j - 1];
+        if (j < LOCKPROF_TOP) {
+            inodes[j] = i;
+            if (ninodes < LOCKPROF_TOP)
+                ninodes++;
+        }
+    }
+
+    /* by time waited and then by time held */
+    for (LockSite *site = lockprof_sites; site != NULL; site = site->next) {
+        int j;
+
+        for (j = nsites; j > 0 && (site->wait_ns > sites[j - 1]->wait_ns ||
+             (site->wait_ns == sites[j - 1]->wait_ns && site->hold_ns > sites[j - 1]->hold_ns)); j--)
+            if (j < LOCKPROF_TOP)
+                sites[j] = sites[j - 1];
+        if (j < LOCKPROF_TOP) {
+            sites[j] = site;
+            if (nsites < LOCKPROF_TOP)
+                nsites++;
+        }
+    }
+
+    fprintf(fp, "locks, the i-nodes that waited the longest:\n");
+    fprintf(fp, "%-8s %10s %10s %10s %10s %12s %10s %12s\n", "i-node", "acquired", "contended",
+            "busy", "wait ms", "mean wait us", "hold ms", "mean hold us");
+    for (int i = 0; i < ninodes; i++) {
+        LockStats *s = &lockprof_inodes[inodes[i]];
+        char name[16];
+
+        snprintf(name, sizeof(name), inodes[i] == FS_ROOT ? "%d (root)" : "%d", inodes[i]);
+        fprintf(fp, "%-8s %10lu %10lu %10lu %10.3f %12.2f %10.3f %12.2f\n", name, s->acquisitions,
+                s->contended, s->busy, s->wait_ns / 1e6, s->contended ? s->wait_ns / 1e3 / s->contended : 0.0,
+                s->hold_ns / 1e6, s->acquisitions ? s->hold_ns / 1e3 / s->acquisitions : 0.0);
+    }
+
+    fprintf(fp, "locks, the call sites that waited the longest:\n");
+    fprintf(fp, "%-28s %10s %10s %10s %10s %10s\n", "site", "acquired", "contended", "busy",
+            "wait ms", "hold ms");
+    for (int i = 0; i < nsites; i++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "%s:%d", sites[i]->function, sites[i]->line);
+        fprintf(fp, "%-28s %10lu %10lu %10lu %10.3f %10.3f\n", name, sites[i]->acquisitions,
+                sites[i]->contended, sites[i]->busy, sites[i]->wait_ns / 1e6, sites[i]->hold_ns / 1e6);
+    }
+}
@@ -5,8 +5,6 @@
 #include <pthread.h>
 
 
-pthread_mutex_t mutex;
-
 extern inode_t inode_table[INODE_TABLE_SIZE];
 extern int locks_vector[LOCKSVECTOR_SIZE];
 
@@ -141,7 +139,7 @@ void unlock_locksvector(int locks_vector[]){
 		if (locks_vector[i] == EMPTY)
 			return;
 
-		else if (pthread_rwlock_unlock(&inode_table[locks_vector[i]].rwlock) != SUCCESS){
+		else if (lockprof_unlock(&inode_table[locks_vector[i]].rwlock, locks_vector[i]) != SUCCESS){
 			printf("lock failed to unlock.\n"); 
             exit(EXIT_FAILURE);
 		}
@@ -204,7 +202,7 @@ int create(char *name, type nodeType){
 		return FAIL;
 	}
 
-	if (pthread_rwlock_wrlock(&inode_table[child_inumber].rwlock)!= SUCCESS){
+	if (lockprof_wrlock(&inode_table[child_inumber].rwlock, child_inumber, LOCK_SITE)!= SUCCESS){
         printf("Error: rwlock in inode number %d failed to lock (rdlock)\n", child_inumber);
 		unlock_locksvector(locks_vector);
         return FAIL;
@@ -272,7 +270,7 @@ int delete(char *name){
 	}
 
 	/* lock child inode */
-	if (pthread_rwlock_wrlock(&inode_table[child_inumber].rwlock)!= SUCCESS){
+	if (lockprof_wrlock(&inode_table[child_inumber].rwlock, child_inumber, LOCK_SITE)!= SUCCESS){
         printf("Error: rwlock in inode number %d failed to lock (wrlock)\n", child_inumber);
 		unlock_locksvector(locks_vector);
         return FAIL;
@@ -338,13 +336,13 @@ int lookup(char *name, int locks_vector[], int mode){
 	files/directories which have the root as a parent) */
 	if (mode == MOVE){
 		if (strcmp(full_path, "") == 0){
-			if (pthread_rwlock_trywrlock(&inode_table[current_inumber].rwlock) == 0)
+			if (lockprof_trywrlock(&inode_table[current_inumber].rwlock, current_inumber, LOCK_SITE) == 0)
 				add_locksvector(current_inumber, locks_vector);
 		}
 
 		/* rdlock the root */
 		else {
-			if (pthread_rwlock_tryrdlock(&inode_table[current_inumber].rwlock) == SUCCESS)
+			if (lockprof_tryrdlock(&inode_table[current_inumber].rwlock, current_inumber, LOCK_SITE) == SUCCESS)
 				add_locksvector(current_inumber, locks_vector);
 		}
 			
@@ -352,7 +350,7 @@ int lookup(char *name, int locks_vector[], int mode){
 
 	else {
 		if (strcmp(full_path, "") == 0){
-			if (pthread_rwlock_wrlock(&inode_table[current_inumber].rwlock)!= SUCCESS) {
+			if (lockprof_wrlock(&inode_table[current_inumber].rwlock, current_inumber, LOCK_SITE)!= SUCCESS) {
 				printf("Error: rwlock in inode number %d failed to lock (wrlock)\n", current_inumber);
 				unlock_locksvector(locks_vector);
 				return FAIL;
@@ -361,7 +359,7 @@ int lookup(char *name, int locks_vector[], int mode){
 
 		/* rdlock the root */
 		else {
-			if (pthread_rwlock_rdlock(&inode_table[current_inumber].rwlock)!= SUCCESS ){
+			if (lockprof_rdlock(&inode_table[current_inumber].rwlock, current_inumber, LOCK_SITE)!= SUCCESS ){
 				printf("Error: rwlock in inode number %d failed to lock (rdlock)\n", current_inumber);
 				unlock_locksvector(locks_vector);
 				return FAIL;
@@ -382,14 +380,14 @@ int lookup(char *name, int locks_vector[], int mode){
 		path = strtok_r(NULL, delim, &saveptr);
 
 		if (mode == MOVE){
-			if (pthread_rwlock_tryrdlock(&inode_table[current_inumber].rwlock) == SUCCESS){
+			if (lockprof_tryrdlock(&inode_table[current_inumber].rwlock, current_inumber, LOCK_SITE) == SUCCESS){
 				add_locksvector(current_inumber, locks_vector);
 				inode_get(current_inumber, &nType, &data);
 				break;
 			}
 
 			if (path == NULL){
-				if (pthread_rwlock_trywrlock(&inode_table[current_inumber].rwlock)== SUCCESS){
+				if (lockprof_trywrlock(&inode_table[current_inumber].rwlock, current_inumber, LOCK_SITE)== SUCCESS){
 					add_locksvector(current_inumber, locks_vector);
 					break;
 				} 
@@ -398,7 +396,7 @@ int lookup(char *name, int locks_vector[], int mode){
 		}
 
 		else if (path == NULL){
-			if (pthread_rwlock_wrlock(&inode_table[current_inumber].rwlock)!= SUCCESS){
+			if (lockprof_wrlock(&inode_table[current_inumber].rwlock, current_inumber, LOCK_SITE)!= SUCCESS){
         		printf("Error: rwlock in inode number %d failed to lock (wrlock)\n", current_inumber);
 				unlock_locksvector(locks_vector);
         		return FAIL;
@@ -408,7 +406,7 @@ int lookup(char *name, int locks_vector[], int mode){
 			break;
 		}
 
-		else if (pthread_rwlock_rdlock(&inode_table[current_inumber].rwlock)!= SUCCESS){
+		else if (lockprof_rdlock(&inode_table[current_inumber].rwlock, current_inumber, LOCK_SITE)!= SUCCESS){
         	printf("Error: rwlock in inode number %d failed to lock (rdlock)\n", current_inumber);
 			unlock_locksvector(locks_vector);
         	return FAIL;
@@ -479,7 +477,7 @@ int parent_and_child_inumber(char* name, int locks_vector[], char* parent_name,
 	in the move function) */
 	if (*child_inumber != FAIL){
 		/* lock child inode */
-		if (pthread_rwlock_wrlock(&inode_table[*child_inumber].rwlock)!= SUCCESS){
+		if (lockprof_wrlock(&inode_table[*child_inumber].rwlock, *child_inumber, LOCK_SITE)!= SUCCESS){
 			printf("Error: rwlock in inode number %d failed to lock (wrlock)\n", *child_inumber);
 			unlock_locksvector(locks_vector);
 			return FAIL;
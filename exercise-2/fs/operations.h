@@ -1,6 +1,7 @@
 #ifndef FS_H
 #define FS_H
 #include "state.h"
+#include "lockprof.h"
 
 #define EMPTY -1
 
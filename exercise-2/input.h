@@ -0,0 +1,28 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+/* bytes read between releases of the pages behind them */
+#define INPUT_WINDOW (4 * 1024 * 1024)
+
+/*
+ * Command file, mapped to memory and read in place. The lines are handed
+ * out as pointers into the mapping, and the pages already read are given
+ * back every INPUT_WINDOW bytes, so the memory used does not grow with the
+ * size of the file.
+ */
+typedef struct input {
+    const char *data;   /* the mapping (NULL if the file is empty) */
+    size_t size;
+    size_t position;    /* start of the next line */
+    size_t released;    /* the pages before it were given back */
+    int fd;
+} Input;
+
+int input_open(Input *input, const char *path);
+int input_next(Input *input, const char **line, size_t *length);
+int input_tokens(const char *line, size_t length, char *token, char *first, char *second, size_t max);
+void input_close(Input *input);
+
+#endif /* INPUT_H */
@@ -8,200 +8,151 @@
 #include <sys/time.h>
 #include <ctype.h>
 #include "fs/operations.h"
-
-#define MAX_COMMANDS 10
-#define MAX_INPUT_SIZE 100
-
-pthread_mutex_t mutex;
-pthread_cond_t canProcess = PTHREAD_COND_INITIALIZER;
-pthread_cond_t canApply = PTHREAD_COND_INITIALIZER;
+#include "queue.h"
+#include "input.h"
+#include "sched.h"
 
 int numberThreads = 0;
 extern int synchstrategy;
 
-char inputCommands[MAX_COMMANDS][MAX_INPUT_SIZE];
-int numberCommands = 0;
-int processptr = 0;
-int applyptr = 0;
-
-int STOP = 0;
-
-int insertCommand(char* data) {
-    numberCommands++;
-    strcpy(inputCommands[processptr++], data);
-    processptr %= MAX_COMMANDS;
-
-    return 1;
-}
-
-char* removeCommand() {
-    if(numberCommands > 0){
-        numberCommands--;
-        char* command = inputCommands[applyptr++];
-        applyptr %= MAX_COMMANDS;
-        return command;
-    }
-    return NULL;
-}
+/* commands read by the producer, applied by the consumers */
+Queue commandQueue;
+/* orders the commands that conflict before they are queued */
+Sched scheduler;
 
 void errorParse(){
     fprintf(stderr, "Error: command invalid\n");
     exit(EXIT_FAILURE);
 }
 
-void *processInput( void *arg ){
-
-    char line[MAX_INPUT_SIZE];
-    FILE* input = (FILE*)arg;
-
-    /* break loop with ^Z or ^D */
-    while (fgets(line, sizeof(line)/sizeof(char), input)) {
-        pthread_mutex_lock(&mutex);
+/*
+ * Parses a line of the input.
+ * Input:
+ *  - line, length: the line, in the input file
+ *  - command: where the command is stored
+ * Returns: 1 if the line has a command, 0 if it is empty or a comment
+ */
+int parseCommand(const char *line, size_t length, Command *command) {
+    int numTokens = input_tokens(line, length, &command->token, command->name, command->arg,
+                                 MAX_INPUT_SIZE);
+
+    if (numTokens < 0)
+        errorParse();
+    if (numTokens < 1)
+        return 0;
+
+    switch (command->token) {
+        case 'c':
+            if (numTokens != 3)
+                errorParse();
+            if (command->arg[0] != 'f' && command->arg[0] != 'd') {
+                fprintf(stderr, "Error: invalid node type\n");
+                exit(EXIT_FAILURE);
+            }
+            return 1;
 
-        while (numberCommands == MAX_COMMANDS)
-            pthread_cond_wait(&canProcess, &mutex);
-        
-        char token;
-        char name[MAX_INPUT_SIZE], type[MAX_INPUT_SIZE];
-        
-        int numTokens = sscanf(line, "%c %s %s", &token, name, type);
+        case 'l':
+        case 'd':
+            if (numTokens != 2)
+                errorParse();
+            return 1;
 
-        if (numTokens < 1) {
-            continue;
-        }
+        case 'm':
+            if (numTokens != 3)
+                errorParse();
+            return 1;
 
-        switch (token) {
-            case 'c':
-                if(numTokens != 3)
-                    errorParse();
-                if(insertCommand(line))
-                    break;
-            
-            case 'l':
-                if(numTokens != 2)
-                    errorParse();
-                if(insertCommand(line))
-                    break;
-            
-            case 'd':
-                if(numTokens != 2)
-                    errorParse();
-                if(insertCommand(line))
-                    break;
-            
-            case 'm':
-                if (numTokens != 3)
-                    errorParse();
-                if (insertCommand(line)){
-                    break;
-                }
+        case '#':
+            return 0;
 
-            case '#':
-                break;
-            
-            default: { /* error */
-                errorParse();
-            }
+        default: { /* error */
+            errorParse();
         }
-
-        pthread_cond_signal(&canApply);
-        pthread_mutex_unlock(&mutex);
     }
-    
-    STOP = 1;
-    pthread_cond_broadcast(&canApply);
-        
-    return NULL;
+    return 0;
 }
 
+void *processInput( void *arg ){
 
+    Input *input = (Input*)arg;
+    const char *line;
+    size_t length;
+    Command command;
 
-void *applyCommands(){
-    while (1){
-
-        pthread_mutex_lock(&mutex);
-
-        while (numberCommands == 0 && !STOP)
-            pthread_cond_wait(&canApply, &mutex);
-        
-        int locks_vector[LOCKSVECTOR_SIZE];
-
-        if (numberCommands > 0){
-            
-            char command_[MAX_INPUT_SIZE];
-            const char* command = removeCommand();
-
-            strcpy(command_, command);
-
-            /* Send a signal to the producer */
-            pthread_cond_signal(&canProcess);
-
-            pthread_mutex_unlock(&mutex);
-
-            if (command_ == NULL){
-                continue;
-            }
-
-            char token;
-            char name[MAX_INPUT_SIZE], type[MAX_INPUT_SIZE];
-
+    /* the lines are parsed where they are mapped, while the consumers run */
+    while (input_next(input, &line, &length)) {
+        if (parseCommand(line, length, &command))
+            sched_add(&scheduler, &command);
+    }
 
-            int numTokens = sscanf(command_, "%c %s %s", &token, name, type);
+    /* the consumers may still dispatch commands until all are applied */
+    sched_drain(&scheduler);
+    queue_close(&commandQueue);
 
-            if (numTokens < 2) {
-                fprintf(stderr, "Error: invalid command in Queue\n");
-                exit(EXIT_FAILURE);
-            }
+    return NULL;
+}
 
-            int searchResult;
-            switch (token) {
-                case 'c':
-                    switch (type[0]) {
-                        case 'f':
-                            printf("Create file: %s\n", name);
-                            create(name, T_FILE);
-                            break;
-                        case 'd':
-                            printf("Create directory: %s\n", name);
-                            create(name, T_DIRECTORY);
-                            break;
-                        default: {
-                            fprintf(stderr, "Error: invalid node type\n");
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                    break;
-                case 'l':
-                    init_locks_vector(locks_vector);
-                    searchResult = lookup(name, locks_vector, FIND);
-                    if (searchResult >= 0)
-                        printf("Search: %s found\n", name);
-                    else
-                        printf("Search: %s not found\n", name);
+/*
+ * Applies a command to the filesystem.
+ */
+void applyCommand(Command *command) {
+    int locks_vector[LOCKSVECTOR_SIZE];
+    int searchResult;
+
+    switch (command->token) {
+        case 'c':
+            switch (command->arg[0]) {
+                case 'f':
+                    printf("Create file: %s\n", command->name);
+                    create(command->name, T_FILE);
                     break;
                 case 'd':
-                    printf("Delete: %s\n", name);
-                    delete(name);
+                    printf("Create directory: %s\n", command->name);
+                    create(command->name, T_DIRECTORY);
                     break;
-
-                case 'm':
-                    printf("Move: %s to %s\n", name, type);
-                    move(name, type);
-                    break;
-
-                default: { /* error */
-                    fprintf(stderr, "Error: command to apply\n");
+                default: {
+                    fprintf(stderr, "Error: invalid node type\n");
                     exit(EXIT_FAILURE);
                 }
             }
-    
+            break;
+        case 'l':
+            init_locks_vector(locks_vector);
+            searchResult = lookup(command->name, locks_vector, FIND);
+            if (searchResult >= 0)
+                printf("Search: %s found\n", command->name);
+            else
+                printf("Search: %s not found\n", command->name);
+            break;
+        case 'd':
+            printf("Delete: %s\n", command->name);
+            delete(command->name);
+            break;
+
+        case 'm':
+            printf("Move: %s to %s\n", command->name, command->arg);
+            move(command->name, command->arg);
+            break;
+
+        default: { /* error */
+            fprintf(stderr, "Error: command to apply\n");
+            exit(EXIT_FAILURE);
         }
+    }
+}
 
-        else if (STOP){
-            pthread_mutex_unlock(&mutex);
-            return NULL;
+void *applyCommands(){
+    Command commands[QUEUE_BATCH];
+    int count;
+
+    /* until the producer is done and the queue is empty */
+    while ((count = queue_dequeue(&commandQueue, commands, QUEUE_BATCH)) > 0) {
+        for (int i = 0; i < count; i++) {
+            applyCommand(&commands[i]);
+            sched_done(&scheduler, commands[i].task);
         }
     }
+    return NULL;
 }
 
 int main(int argc, char* argv[]){
@@ -231,16 +182,18 @@ int main(int argc, char* argv[]){
         exit(EXIT_FAILURE);
     }
 
-    pthread_t tid[numberThreads];
+    pthread_t tid[numberThreads + 1];     /* the producer and the consumers */
 
     /* init filesystem */
     init_fs();
+    queue_init(&commandQueue);
+    sched_init(&scheduler, &commandQueue);
 
     /* open input file, process input and close the file*/
-    FILE *inputfile, *outputfile;
-    inputfile = fopen(argv[1], "r");
+    Input inputfile;
+    FILE *outputfile;
 
-    if (inputfile == NULL){
+    if (input_open(&inputfile, argv[1]) != 0){
         fprintf(stderr, "Error: Input file not found\n");
         exit(EXIT_FAILURE);
     }
@@ -249,7 +202,7 @@ int main(int argc, char* argv[]){
     gettimeofday(&start, NULL);
 
     /* create the main thread (producer) */
-    pthread_create(&tid[0], NULL, processInput, inputfile);
+    pthread_create(&tid[0], NULL, processInput, &inputfile);
 
 
     /* create the slave threads (consumers) */
@@ -272,7 +225,7 @@ int main(int argc, char* argv[]){
     gettimeofday(&stop, NULL);
 
     /* close inputfile */
-    fclose(inputfile);
+    input_close(&inputfile);
 
     /* open output file, print the tree to it and close the file*/
     outputfile = fopen(argv[2], "w");
@@ -281,10 +234,15 @@ int main(int argc, char* argv[]){
     fclose(outputfile);
 
     /* release allocated memory */
+    sched_destroy(&scheduler);
     destroy_fs();
 
     printf("TecnicoFS completed in %.4f seconds.\n", (double) (stop.tv_sec - start.tv_sec)+
                                                     (double) (stop.tv_usec - start.tv_usec)/1000000);
 
+#ifdef LOCK_PROFILE
+    lockprof_report(stdout);
+#endif
+
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,196 @@
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "queue.h"
+
+/*
+ * Bounded MPMC queue (after D. Vyukov). Position p of the queue goes to
+ * slot p % QUEUE_SIZE, whose sequence number is p while the slot is free
+ * for it, p + 1 once its command is there, and p + QUEUE_SIZE when it is
+ * taken, which frees the slot for the next round. A thread claims a run of
+ * consecutive positions, whose slots it checked are ready, by moving head
+ * (or tail) past them with a single compare and swap; the slots are then
+ * its own until it updates their sequence numbers.
+ */
+
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+
+static inline void queue_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(int *futex, int value) {
+    syscall(SYS_futex, futex, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(int *futex, int count) {
+    syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/*
+ * Initializes an empty queue.
+ */
+void queue_init(Queue *queue) {
+    queue->head = 0;
+    queue->tail = 0;
+    queue->items = 0;
+    queue->itemsWaiters = 0;
+    queue->space = 0;
+    queue->spaceWaiters = 0;
+    queue->closed = 0;
+    for (int i = 0; i < QUEUE_SIZE; i++)
+        queue->slots[i].seq = i;
+}
+
+/*
+ * Claims a run of positions whose slots are ready.
+ * Input:
+ *  - position: head (to enqueue) or tail (to dequeue)
+ *  - ready: 0 if the slots must be free, 1 if they must have a command
+ *  - max: positions claimed, at most
+ *  - start: where the first position claimed is stored
+ * Returns: number of positions claimed, 0 if the queue is full (or empty)
+ */
+static int queue_claim(Queue *queue, unsigned long *position, unsigned long ready, int max,
+                       unsigned long *start) {
+    unsigned long pos = __atomic_load_n(position, __ATOMIC_RELAXED);
+
+    for (;;) {
+        int n = 0;
+
+        while (n < max && __atomic_load_n(&queue->slots[(pos + n) & QUEUE_MASK].seq, __ATOMIC_ACQUIRE) ==
+                          pos + n + ready)
+            n++;
+
+        if (n == 0) {
+            unsigned long now = __atomic_load_n(position, __ATOMIC_RELAXED);
+
+            /* another thread claimed the position meanwhile */
+            if (now != pos) {
+                pos = now;
+                continue;
+            }
+            return 0;
+        }
+
+        if (__atomic_compare_exchange_n(position, &pos, pos + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *start = pos;
+            return n;
+        }
+    }
+}
+
+/*
+ * Checks if the slot of the next position is ready, or the position
+ * already moved on.
+ */
+static int queue_ready(Queue *queue, unsigned long *position, unsigned long ready) {
+    unsigned long pos = __atomic_load_n(position, __ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&queue->slots[pos & QUEUE_MASK].seq, __ATOMIC_SEQ_CST) >= pos + ready;
+}
+
+/*
+ * Sleeps until the futex changes, unless the queue is ready meanwhile.
+ * The waiter is counted before the last check, so a thread that changes
+ * the futex after it always sees there is someone to wake.
+ */
+static void queue_wait(Queue *queue, unsigned long *position, unsigned long ready, int *futex,
+                       int *waiters) {
+    int value;
+
+    __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    value = __atomic_load_n(futex, __ATOMIC_SEQ_CST);
+
+    if (!queue_ready(queue, position, ready) && !(ready && __atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST)))
+        futex_wait(futex, value);
+
+    __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Changes the futex and wakes the threads sleeping on it, if any.
+ */
+static void queue_signal(int *futex, int *waiters, int count) {
+    __atomic_add_fetch(futex, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(futex, count);
+}
+
+/*
+ * Enqueues commands, waiting while the queue is full.
+ * Input:
+ *  - commands: the commands
+ *  - count: number of commands (at least 1)
+ * Returns: number of commands enqueued (at least 1, the first ones)
+ */
+int queue_enqueue(Queue *queue, Command *commands, int count) {
+    unsigned long start;
+    int n;
+
+    for (int spins = 0; (n = queue_claim(queue, &queue->head, 0, count, &start)) == 0; spins++) {
+        if (spins < QUEUE_SPINS)
+            queue_relax();
+        else
+            queue_wait(queue, &queue->head, 0, &queue->space, &queue->spaceWaiters);
+    }
+
+    for (int i = 0; i < n; i++) {
+        QueueSlot *slot = &queue->slots[(start + i) & QUEUE_MASK];
+
+        slot->command = commands[i];
+        __atomic_store_n(&slot->seq, start + i + 1, __ATOMIC_RELEASE);
+    }
+
+    queue_signal(&queue->items, &queue->itemsWaiters, n);
+    return n;
+}
+
+/*
+ * Dequeues commands, waiting while the queue is empty.
+ * Input:
+ *  - commands: where the commands are stored
+ *  - max: number of commands dequeued, at most
+ * Returns: number of commands dequeued, 0 once the queue is closed and
+ * empty
+ */
+int queue_dequeue(Queue *queue, Command *commands, int max) {
+    unsigned long start;
+    int n;
+
+    for (int spins = 0; (n = queue_claim(queue, &queue->tail, 1, max, &start)) == 0; spins++) {
+        /* the commands enqueued before it was closed are still taken */
+        if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+            if ((n = queue_claim(queue, &queue->tail, 1, max, &start)) == 0)
+                return 0;
+            break;
+        }
+
+        if (spins < QUEUE_SPINS)
+            queue_relax();
+        else
+            queue_wait(queue, &queue->tail, 1, &queue->items, &queue->itemsWaiters);
+    }
+
+    for (int i = 0; i < n; i++) {
+        QueueSlot *slot = &queue->slots[(start + i) & QUEUE_MASK];
+
+        commands[i] = slot->command;
+        __atomic_store_n(&slot->seq, start + i + QUEUE_SIZE, __ATOMIC_RELEASE);
+    }
+
+    queue_signal(&queue->space, &queue->spaceWaiters, n);
+    return n;
+}
+
+/*
+ * Closes the queue: no more commands are enqueued, and the consumers
+ * return once it is empty.
+ */
+void queue_close(Queue *queue) {
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_SEQ_CST);
+    queue_signal(&queue->items, &queue->itemsWaiters, INT_MAX);
+}
@@ -0,0 +1,53 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#define MAX_INPUT_SIZE 100
+
+/* slots of the queue (a power of two) */
+#define QUEUE_SIZE 64
+/* commands moved at once, at most */
+#define QUEUE_BATCH 8
+/* tries on an empty or full queue before the thread sleeps */
+#define QUEUE_SPINS 100
+
+/*
+ * A command, parsed by the producer.
+ */
+typedef struct command {
+    char token;                 /* c, l, d or m */
+    char name[MAX_INPUT_SIZE];
+    char arg[MAX_INPUT_SIZE];   /* type of a create, new name of a move */
+    int task;                   /* its slot in the scheduler window */
+} Command;
+
+/*
+ * Slot of the queue. Its sequence number tells which position of the queue
+ * it holds and if the command is there yet (see queue.c).
+ */
+typedef struct queueSlot {
+    unsigned long seq;
+    Command command;
+} QueueSlot;
+
+/*
+ * Bounded queue of commands for any number of producers and consumers,
+ * without locks. Threads only sleep (on a futex) when the queue is empty
+ * or full.
+ */
+typedef struct queue {
+    unsigned long head __attribute__((aligned(64)));  /* next position to enqueue */
+    unsigned long tail __attribute__((aligned(64)));  /* next position to dequeue */
+    int items __attribute__((aligned(64)));   /* changes when commands are enqueued (futex) */
+    int itemsWaiters;
+    int space __attribute__((aligned(64)));   /* changes when commands are dequeued (futex) */
+    int spaceWaiters;
+    int closed;
+    QueueSlot slots[QUEUE_SIZE] __attribute__((aligned(64)));
+} Queue;
+
+void queue_init(Queue *queue);
+int queue_enqueue(Queue *queue, Command *commands, int count);
+int queue_dequeue(Queue *queue, Command *commands, int max);
+void queue_close(Queue *queue);
+
+#endif /* QUEUE_H */
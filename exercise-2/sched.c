@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sched.h"
+
+/*
+ * Two commands conflict if applying them in either order may give
+ * different results, or a different tree:
+ *  - a lookup depends on the changes to its path and to the directories
+ *    above it;
+ *  - a change also depends on the changes below its path (a directory is
+ *    only deleted if it is empty, a path is only created where it is not);
+ *  - changes to the entries of the same directory take the slots of its
+ *    table, in the order they are applied;
+ *  - creates and deletes take and release i-nodes of the same table, so
+ *    whether a create finds one free depends on their order;
+ *  - a move conflicts with every command: the MOVE lookups of move() stop
+ *    at the first directory they can lock, so what it changes depends on
+ *    the locks the commands applied with it hold. Only alone is it the
+ *    move of a single threaded run.
+ * Each command added waits for the commands of the window it conflicts
+ * with that were not applied yet, which are all earlier in the file.
+ */
+
+/*
+ * Normalizes a path.
+ * Input:
+ *  - name: the path, as in the command
+ *  - path: where the normalized path is stored (MAX_INPUT_SIZE bytes)
+ *  - parent: where the length of its parent is stored
+ * Returns: length of the normalized path
+ */
+static int sched_path(const char *name, char *path, int *parent) {
+    int length = 0;
+
+    *parent = 0;
+    while (*name != '\0') {
+        if (*name == '/') {
+            name++;
+            continue;
+        }
+        if (length > 0) {
+            *parent = length;
+            path[length++] = '/';
+        }
+        while (*name != '\0' && *name != '/')
+            path[length++] = *name++;
+    }
+    path[length] = '\0';
+    return length;
+}
+
+static void sched_footprint(Command *command, Footprint *footprint) {
+    footprint->write = command->token != 'l';
+    footprint->inodes = command->token == 'c' || command->token == 'd';
+    footprint->barrier = command->token == 'm';
+    footprint->length = sched_path(command->name, footprint->path, &footprint->parent);
+}
+
+/*
+ * Checks if the path of a footprint is the path of another or a directory
+ * above it.
+ */
+static int sched_above(const Footprint *a, const Footprint *b) {
+    int length = a->length;
+
+    return length <= b->length && memcmp(a->path, b->path, length) == 0 &&
+           (length == 0 || length == b->length || b->path[length] == '/');
+}
+
+static int sched_same_parent(const Footprint *a, const Footprint *b) {
+    return a->parent == b->parent && memcmp(a->path, b->path, a->parent) == 0;
+}
+
+static int sched_conflict(const Footprint *earlier, const Footprint *later) {
+    if (earlier->barrier || later->barrier)
+        return 1;
+    if (!earlier->write && !later->write)
+        return 0;
+    if (earlier->inodes && later->inodes)
+        return 1;
+
+    if (earlier->write && later->write)
+        return sched_above(earlier, later) || sched_above(later, earlier) ||
+               sched_same_parent(earlier, later);
+    return earlier->write ? sched_above(earlier, later) : sched_above(later, earlier);
+}
+
+/*
+ * Initializes an empty scheduler.
+ * Input:
+ *  - queue: where the commands are dispatched to
+ */
+void sched_init(Sched *sched, Queue *queue) {
+    sched->queue = queue;
+    if (pthread_mutex_init(&sched->mutex, NULL) != 0 || pthread_cond_init(&sched->freed, NULL) != 0) {
+        fprintf(stderr, "Error: scheduler not initialized\n");
+        exit(EXIT_FAILURE);
+    }
+    sched->wakeAt = 0;
+    sched->nready = 0;
+    sched->nfree = SCHED_WINDOW;
+    for (int i = 0; i < SCHED_WINDOW; i++) {
+        sched->free[i] = SCHED_WINDOW - 1 - i;
+        sched->tasks[i].busy = 0;
+    }
+}
+
+void sched_destroy(Sched *sched) {
+    pthread_mutex_destroy(&sched->mutex);
+    pthread_cond_destroy(&sched->freed);
+}
+
+static void sched_enqueue(Sched *sched, Command *commands, int count) {
+    for (int done = 0; done < count; )
+        done += queue_enqueue(sched->queue, commands + done, count - done);
+}
+
+/*
+ * Enqueues the commands the producer dispatched.
+ */
+static void sched_flush(Sched *sched) {
+    sched_enqueue(sched, sched->ready, sched->nready);
+    sched->nready = 0;
+}
+
+/*
+ * Waits until a number of slots of the window are free. Called by the
+ * producer with the mutex locked.
+ */
+static void sched_wait(Sched *sched, int slots) {
+    sched->wakeAt = slots;
+    while (sched->nfree < slots)
+        pthread_cond_wait(&sched->freed, &sched->mutex);
+    sched->wakeAt = 0;
+}
+
+/*
+ * Adds the next command of the file, waiting while the window is full.
+ * Only the producer adds commands.
+ */
+void sched_add(Sched *sched, Command *command) {
+    int conflicts[SCHED_WINDOW];
+    int nconflicts = 0;
+    int slot, pending;
+
+    pthread_mutex_lock(&sched->mutex);
+    if (sched->nfree == 0) {
+        /* the commands it would wait for may not be enqueued yet */
+        pthread_mutex_unlock(&sched->mutex);
+        sched_flush(sched);
+        pthread_mutex_lock(&sched->mutex);
+        /* half of it, so it isn't woken for each command applied */
+        sched_wait(sched, SCHED_WINDOW / 2);
+    }
+    slot = sched->free[--sched->nfree];
+    pthread_mutex_unlock(&sched->mutex);
+
+    Task *task = &sched->tasks[slot];
+
+    task->command = *command;
+    task->command.task = slot;
+    sched_footprint(command, &task->footprint);
+
+    /* the footprints don't change while the tasks are busy, as only the
+    producer reuses the slots; the ones applied meanwhile are left out below */
+    for (int i = 0; i < SCHED_WINDOW; i++) {
+        if (i != slot && __atomic_load_n(&sched->tasks[i].busy, __ATOMIC_ACQUIRE) &&
+            sched_conflict(&sched->tasks[i].footprint, &task->footprint))
+            conflicts[nconflicts++] = i;
+    }
+
+    pthread_mutex_lock(&sched->mutex);
+    task->pending = 0;
+    task->nsuccessors = 0;
+    for (int i = 0; i < nconflicts; i++) {
+        Task *earlier = &sched->tasks[conflicts[i]];
+
+        if (earlier->busy) {
+            earlier->successors[earlier->nsuccessors++] = slot;
+            task->pending++;
+        }
+    }
+    pending = task->pending;
+    __atomic_store_n(&task->busy, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sched->mutex);
+
+    /* once it waits for others, it is theirs to dispatch */
+    if (pending == 0) {
+        sched->ready[sched->nready++] = task->command;
+        if (sched->nready == QUEUE_BATCH)
+            sched_flush(sched);
+    }
+}
+
+/*
+ * Marks a command as applied, and dispatches the commands that were only
+ * waiting for it.
+ * Input:
+ *  - task: slot of the command
+ */
+void sched_done(Sched *sched, int task) {
+    Command ready[SCHED_WINDOW];
+    int nready = 0;
+    Task *done = &sched->tasks[task];
+
+    pthread_mutex_lock(&sched->mutex);
+
+    for (int i = 0; i < done->nsuccessors; i++) {
+        Task *later = &sched->tasks[done->successors[i]];
+
+        if (--later->pending == 0)
+            ready[nready++] = later->command;
+    }
+
+    __atomic_store_n(&done->busy, 0, __ATOMIC_RELEASE);
+    sched->free[sched->nfree++] = task;
+    if (sched->wakeAt > 0 && sched->nfree >= sched->wakeAt)
+        pthread_cond_signal(&sched->freed);
+
+    pthread_mutex_unlock(&sched->mutex);
+
+    sched_enqueue(sched, ready, nready);
+}
+
+/*
+ * Waits until every command added was applied.
+ */
+void sched_drain(Sched *sched) {
+    sched_flush(sched);
+
+    pthread_mutex_lock(&sched->mutex);
+    sched_wait(sched, SCHED_WINDOW);
+    pthread_mutex_unlock(&sched->mutex);
+}
@@ -0,0 +1,59 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <pthread.h>
+#include "queue.h"
+
+/* commands in flight, at most (the queue must hold all of them) */
+#define SCHED_WINDOW QUEUE_SIZE
+
+/*
+ * Path a command reads or changes, normalized to "a/b/c" (no leading,
+ * trailing or repeated slashes; the root is "").
+ */
+typedef struct footprint {
+    int write;                          /* changes the tree (not a lookup) */
+    int inodes;                         /* creates or deletes i-nodes */
+    int barrier;                        /* a move: conflicts with every command */
+    int length;
+    int parent;                         /* length of the parent of the path */
+    char path[MAX_INPUT_SIZE];
+} Footprint;
+
+/*
+ * Command of the window, from the time it is added until it is applied.
+ */
+typedef struct task {
+    Command command;
+    Footprint footprint;
+    int busy;                           /* added and not applied yet */
+    int pending;                        /* earlier commands it waits for */
+    int nsuccessors;
+    int successors[SCHED_WINDOW];       /* later commands waiting for it */
+} Task;
+
+/*
+ * Scheduler of the commands of a file: a command is only dispatched to the
+ * queue once every earlier command it conflicts with was applied, so the
+ * conflicting ones are applied in the order of the file and the others in
+ * parallel.
+ */
+typedef struct sched {
+    Queue *queue;
+    pthread_mutex_t mutex;              /* protects the graph */
+    pthread_cond_t freed;               /* wakeAt slots are free */
+    int wakeAt;                         /* 0 if the producer is not waiting */
+    int nfree;
+    int free[SCHED_WINDOW];             /* slots of the window not in use */
+    int nready;
+    Command ready[QUEUE_BATCH];         /* dispatched by the producer, not enqueued yet */
+    Task tasks[SCHED_WINDOW];
+} Sched;
+
+void sched_init(Sched *sched, Queue *queue);
+void sched_destroy(Sched *sched);
+void sched_add(Sched *sched, Command *command);
+void sched_done(Sched *sched, int task);
+void sched_drain(Sched *sched);
+
+#endif /* SCHED_H */
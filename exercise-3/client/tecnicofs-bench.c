@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "tecnicofs-client-api.h"
+#include "../tecnicofs-api-constants.h"
+
+/*
+ * Load generator: clients, each a process with its own session (the
+ * client API has a single session per process), send a mix of operations
+ * on the files of a tree, with keys picked uniformly or with a zipf
+ * distribution. In a closed loop each client keeps a number of requests
+ * in flight, in an open loop it sends them at a fixed rate, and their
+ * latency counts from when they were due (the time waiting for a slot in
+ * flight included). The latencies go to histograms shared with the parent,
+ * which reports them.
+ */
+
+#define OP_CREATE 0
+#define OP_LOOKUP 1
+#define OP_DELETE 2
+#define OP_MOVE 3
+#define OPS 4
+
+/* ns between checks of the requests in flight, open loop */
+#define POLL_INTERVAL 50000
+
+char *opNames[OPS] = { "create", "lookup", "delete", "move" };
+
+/* histograms of latencies in ns: 16 buckets for each power of two */
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define BUCKETS (64 * SUB_BUCKETS)
+
+typedef struct histogram {
+    unsigned long counts[BUCKETS];
+    unsigned long total;
+    unsigned long failed;    /* operations with an error as result */
+    double sum;
+    long max;
+} histogram;
+
+char *serverName;
+int clients = 4;
+int operations = 20000;      /* of each client */
+int weights[OPS] = { 20, 60, 10, 10 };
+int depth = 2, fanout = 8, filesPerDir = 16;
+int populate = 50;           /* percentage of the files created before */
+double theta = 0;            /* zipf skew, 0 for uniform keys */
+double rate = 0;             /* per client, 0 for a closed loop */
+int window = 1;              /* requests in flight of each client */
+int mode = TFS_MODE_SESSION;
+int serverStats = 0;         /* prints the statistics of the server after the run */
+
+int keys;                    /* files of the tree */
+double *zipfCdf;             /* cumulative probability of each rank */
+int stride;                  /* scatters the ranks over the tree */
+
+static void displayUsage (const char* appName) {
+    printf("Usage: %s [options] server_socket_name\n"
+           "  -c clients        sessions, each in its own process (4)\n"
+           "  -n operations     of each client (20000)\n"
+           "  -x c:l:d:m        weights of creates, lookups, deletes and moves (20:60:10:10)\n"
+           "  -D depth          levels of directories (2)\n"
+           "  -F fanout         directories in each directory (8)\n"
+           "  -K files          files in each directory of the last level (16)\n"
+           "  -p percentage     of the files created before the run (50)\n"
+           "  -z theta          zipf skew of the keys, 0 for uniform (0)\n"
+           "  -r rate           operations per second of each client, open loop\n"
+           "                    (0: closed loop)\n"
+           "  -w window         requests in flight of each client (1; open loop: %d)\n"
+           "  -m transport      datagram, session or ring (session)\n"
+           "  -s                prints the statistics of the server after the run\n",
+           appName, TFS_MAX_INFLIGHT);
+    exit(EXIT_FAILURE);
+}
+
+static void parseArgs (long argc, char* const argv[]) {
+
+    int opt, windowSet = 0;
+
+    while ((opt = getopt(argc, argv, "c:n:x:D:F:K:p:z:r:w:m:s")) != -1) {
+        switch (opt) {
+            case 'c': clients = atoi(optarg); break;
+            case 'n': operations = atoi(optarg); break;
+            case 'x':
+                if (sscanf(optarg, "%d:%d:%d:%d", &weights[0], &weights[1], &weights[2], &weights[3]) != 4)
+                    displayUsage(argv[0]);
+                break;
+            case 'D': depth = atoi(optarg); break;
+            case 'F': fanout = atoi(optarg); break;
+            case 'K': filesPerDir = atoi(optarg); break;
+            case 'p': populate = atoi(optarg); break;
+            case 'z': theta = atof(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'w': window = atoi(optarg); windowSet = 1; break;
+            case 's': serverStats = 1; break;
+            case 'm':
+                if (strcmp(optarg, "datagram") == 0)
+                    mode = TFS_MODE_DATAGRAM;
+                else if (strcmp(optarg, "session") == 0)
+                    mode = TFS_MODE_SESSION;
+                else if (strcmp(optarg, "ring") == 0)
+                    mode = TFS_MODE_RING;
+                else
+                    displayUsage(argv[0]);
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "Invalid format:\n");
+        displayUsage(argv[0]);
+    }
+    serverName = argv[optind];
+
+    if (rate > 0 && !windowSet)
+        window = TFS_MAX_INFLIGHT;
+
+    if (clients <= 0 || operations <= 0 || depth < 0 || fanout <= 0 || filesPerDir <= 0 ||
+        populate < 0 || populate > 100 || theta < 0 || rate < 0 ||
+        window <= 0 || window > TFS_MAX_INFLIGHT ||
+        weights[0] < 0 || weights[1] < 0 || weights[2] < 0 || weights[3] < 0 ||
+        weights[0] + weights[1] + weights[2] + weights[3] == 0) {
+        fprintf(stderr, "Error: invalid option\n");
+        exit(EXIT_FAILURE);
+    }
+
+    keys = filesPerDir;
+    for (int i = 0; i < depth; i++)
+        keys *= fanout;
+}
+
+static long nanoseconds() {
+
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/* xorshift64*, a generator for each client */
+static unsigned long nextRandom(unsigned long *state) {
+
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717UL;
+}
+
+/* uniform in [0, 1) */
+static double randomUnit(unsigned long *state) {
+    return (nextRandom(state) >> 11) * (1.0 / (1UL << 53));
+}
+
+static int gcd(int a, int b) {
+    return b == 0 ? a : gcd(b, a % b);
+}
+
+/*
+ * Prepares the key distribution: the cumulative probabilities of the ranks
+ * for zipf, and a stride coprime with the number of keys, so the popular
+ * keys are spread over the directories.
+ */
+static void prepareKeys() {
+
+    double sum = 0;
+
+    for (stride = keys / 2 + 1; gcd(stride, keys) != 1; stride++)
+        ;
+
+    if (theta == 0)
+        return;
+
+    if ((zipfCdf = malloc(keys * sizeof(double))) == NULL) {
+        fprintf(stderr, "Error: no memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < keys; i++)
+        zipfCdf[i] = sum += 1 / pow(i + 1, theta);
+    for (int i = 0; i < keys; i++)
+        zipfCdf[i] /= sum;
+}
+
+static int pickKey(unsigned long *state) {
+
+    double u = randomUnit(state);
+    int low = 0, high = keys - 1;
+
+    if (theta == 0)
+        return u * keys;
+
+    /* the first rank with a cumulative probability above u */
+    while (low < high) {
+        int middle = (low + high) / 2;
+
+        if (zipfCdf[middle] > u)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return (long) low * stride % keys;
+}
+
+/*
+ * Writes the path of a key, or of a directory of the tree.
+ * Input:
+ *  - path: where the path is written
+ *  - key: the key, or the index of the directory
+ *  - levels: levels of directories in the path
+ *  - file: nonzero for the path of a file
+ */
+static void keyPath(char *path, int key, int levels, int file) {
+
+    int names[depth + 1];
+
+    if (file) {
+        names[levels] = key % filesPerDir;
+        key /= filesPerDir;
+    }
+    for (int i = levels - 1; i >= 0; i--) {
+        names[i] = key % fanout;
+        key /= fanout;
+    }
+
+    path += sprintf(path, "/bench");
+    for (int i = 0; i < levels; i++)
+        path += sprintf(path, "/d%d", names[i]);
+    if (file)
+        sprintf(path, "/f%d", names[levels]);
+}
+
+/*
+ * Builds the tree: its directories and part of its files.
+ */
+static void buildTree() {
+
+    char path[MAX_INPUT_SIZE];
+    int count = 1;
+    unsigned long state = 1;
+
+    if (tfsMountMode(serverName, mode) != 0) {
+        fprintf(stderr, "Error: can't mount %s\n", serverName);
+        exit(EXIT_FAILURE);
+    }
+
+    tfsCreate("/bench", 'd');
+    for (int level = 1; level <= depth; level++) {
+        count *= fanout;
+        for (int i = 0; i < count; i++) {
+            keyPath(path, i, level, 0);
+            tfsCreate(path, 'd');
+        }
+    }
+
+    for (int i = 0; i < keys; i++) {
+        if (nextRandom(&state) % 100 < (unsigned long) populate) {
+            keyPath(path, i, depth, 1);
+            tfsCreate(path, 'f');
+        }
+    }
+
+    tfsUnmount();
+}
+
+static void record(histogram *h, long latency, int failed) {
+
+    int bucket = latency;
+
+    if (latency < 0)
+        latency = bucket = 0;
+    if (latency >= SUB_BUCKETS) {
+        int e = 63 - __builtin_clzl(latency);
+
+        bucket = (e - SUB_BITS + 1) * SUB_BUCKETS + ((latency >> (e - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    h->counts[bucket]++;
+    h->total++;
+    h->failed += failed != 0;
+    h->sum += latency;
+    if (latency > h->max)
+        h->max = latency;
+}
+
+/* the middle of the values of a bucket */
+static double bucketValue(int bucket) {
+
+    int e = bucket / SUB_BUCKETS + SUB_BITS - 1;
+
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    return ((double) ((SUB_BUCKETS + bucket % SUB_BUCKETS) * 2 + 1) / 2) * (1UL << (e - SUB_BITS));
+}
+
+static double percentile(histogram *h, double p) {
+
+    unsigned long rank = h->total * p, seen = 0;
+
+    /* the middle of the last bucket may be past the largest latency in it */
+    for (int i = 0; i < BUCKETS; i++)
+        if ((seen += h->counts[i]) > rank)
+            return fmin(bucketValue(i), h->max);
+    return h->max;
+}
+
+static void merge(histogram *to, histogram *from) {
+
+    for (int i = 0; i < BUCKETS; i++)
+        to->counts[i] += from->counts[i];
+    to->total += from->total;
+    to->failed += from->failed;
+    to->sum += from->sum;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+static int submit(int op, unsigned long *state) {
+
+    char path[MAX_INPUT_SIZE], to[MAX_INPUT_SIZE];
+
+    keyPath(path, pickKey(state), depth, 1);
+
+    switch (op) {
+        case OP_CREATE:
+            return tfsCreateAsync(path, 'f');
+        case OP_LOOKUP:
+            return tfsLookupAsync(path);
+        case OP_DELETE:
+            return tfsDeleteAsync(path);
+        default:
+            keyPath(to, pickKey(state), depth, 1);
+            return tfsMoveAsync(path, to);
+    }
+}
+
+static void check(int res) {
+
+    if (res == TECNICOFS_ERROR_CONNECTION_ERROR || res == TECNICOFS_ERROR_NO_OPEN_SESSION ||
+        res == TECNICOFS_ERROR_TOO_MANY_REQUESTS) {
+        fprintf(stderr, "Error: request failed (%d)\n", res);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Runs a client: its operations, keeping up to `window` of them in flight.
+ * Input:
+ *  - id: number of the client
+ *  - start: read end of a pipe, closed when the clients should start
+ *  - histograms: where the latencies of each operation are recorded
+ */
+static void runClient(int id, int start, histogram *histograms) {
+
+    int handles[window], ops[window];
+    long due[window];
+    int sent = 0, inflight = 0, total = weights[0] + weights[1] + weights[2] + weights[3];
+    unsigned long state = 0x9e3779b97f4a7c15UL * (id + 1);
+    long begin, now;
+    char c;
+
+    if (tfsMountMode(serverName, mode) != 0) {
+        fprintf(stderr, "Error: can't mount %s\n", serverName);
+        exit(EXIT_FAILURE);
+    }
+
+    /* returns once the parent closes the pipe */
+    if (read(start, &c, 1) < 0)
+        exit(EXIT_FAILURE);
+
+    begin = nanoseconds();
+
+    while (sent < operations || inflight > 0) {
+        int done = 0;
+
+        now = nanoseconds();
+
+        while (sent < operations && inflight < window &&
+               (rate == 0 || begin + (long) (sent * 1e9 / rate) <= now)) {
+            int r = nextRandom(&state) % total, op;
+
+            for (op = 0; r >= weights[op]; op++)
+                r -= weights[op];
+
+            ops[inflight] = op;
+            due[inflight] = rate == 0 ? now : begin + (long) (sent * 1e9 / rate);
+            check(handles[inflight] = submit(op, &state));
+            inflight++;
+            sent++;
+        }
+
+        for (int i = 0; i < inflight; i++) {
+            int result, res;
+
+            check(res = tfsPoll(handles[i], &result));
+            if (res == 1) {
+                record(&histograms[ops[i]], nanoseconds() - due[i], result < 0);
+                inflight--;
+                handles[i] = handles[inflight];
+                ops[i] = ops[inflight];
+                due[i] = due[inflight];
+                i--;
+                done++;
+            }
+        }
+
+        if (done > 0 || (inflight == 0 && sent == operations))
+            continue;
+
+        /* nothing to send before one completes */
+        if (inflight == window || rate == 0) {
+            int result = tfsWait(handles[0]);
+
+            check(result);
+            record(&histograms[ops[0]], nanoseconds() - due[0], result < 0);
+            inflight--;
+            handles[0] = handles[inflight];
+            ops[0] = ops[inflight];
+            due[0] = due[inflight];
+        }
+        /* until the next one is due, checking the ones in flight meanwhile */
+        else {
+            long wait = begin + (long) (sent * 1e9 / rate) - nanoseconds();
+            struct timespec t;
+
+            if (inflight > 0 && wait > POLL_INTERVAL)
+                wait = POLL_INTERVAL;
+            t = (struct timespec) { wait / 1000000000L, wait % 1000000000L };
+            if (wait > 0)
+                nanosleep(&t, NULL);
+        }
+    }
+
+    tfsUnmount();
+    exit(EXIT_SUCCESS);
+}
+
+static void report(char *name, histogram *h) {
+
+    if (h->total == 0)
+        return;
+
+    printf("%-8s %9lu %9lu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, h->total, h->failed,
+           h->sum / h->total / 1000, percentile(h, 0.5) / 1000, percentile(h, 0.99) / 1000,
+           percentile(h, 0.999) / 1000, h->max / 1000.0);
+}
+
+int main(int argc, char* argv[]) {
+
+    histogram *histograms, all;
+    int startPipe[2], status, failed = 0;
+    long begin, elapsed;
+
+    parseArgs(argc, argv);
+    prepareKeys();
+    buildTree();
+
+    /* a histogram of each operation for each client, seen by the parent */
+    histograms = mmap(NULL, clients * OPS * sizeof(histogram), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (histograms == MAP_FAILED || pipe(startPipe) < 0) {
+        perror("bench: can't prepare the clients");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < clients; i++) {
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            perror("bench: fork error");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            close(startPipe[1]);
+            runClient(i, startPipe[0], &histograms[i * OPS]);
+        }
+    }
+
+    /* the clients mount before the start */
+    close(startPipe[0]);
+    sleep(1);
+    begin = nanoseconds();
+    close(startPipe[1]);
+
+    while (wait(&status) > 0)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    elapsed = nanoseconds() - begin;
+
+    if (failed) {
+        fprintf(stderr, "Error: a client failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%d clients, %d keys (zipf %.2f), ", clients, keys, theta);
+    if (rate > 0)
+        printf("open loop at %.0f ops/s each, ", rate);
+    else
+        printf("closed loop with %d in flight each, ", window);
+    printf("%.0f ops/s\n", (double) clients * operations / (elapsed / 1e9));
+
+    printf("%-8s %9s %9s %9s %9s %9s %9s %9s\n", "op", "count", "failed",
+           "mean", "p50", "p99", "p99.9", "max (us)");
+    memset(&all, 0, sizeof(all));
+    for (int op = 0; op < OPS; op++) {
+        histogram h;
+
+        memset(&h, 0, sizeof(h));
+        for (int i = 0; i < clients; i++)
+            merge(&h, &histograms[i * OPS + op]);
+        report(opNames[op], &h);
+        merge(&all, &h);
+    }
+    report("all", &all);
+
+    if (serverStats) {
+        static char stats[TFS_MAX_MESSAGE];
+
+        if (tfsMountMode(serverName, mode) != 0 || tfsStats(stats, sizeof(stats), TFS_STATS_TEXT) < 0) {
+            fprintf(stderr, "Error: can't get the statistics of the server\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("\nserver:\n%s", stats);
+        tfsUnmount();
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -1,17 +1,78 @@
+/* memfd_create */
+#define _GNU_SOURCE
+
 #include "tecnicofs-client-api.h"
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 #include <stdio.h>
 #include <arpa/inet.h>
 
-int sockfd;
+int sockfd = -1;
+/* TFS_MODE_SESSION or TFS_MODE_DATAGRAM, while there's a session */
+int sessionMode;
+
+/* polls of the ring of responses before sleeping, on multiprocessors */
+#define TFS_RING_SPINS 2000
+
+/* the shared memory rings of the session, if it has them */
+tfs_shm *shm = NULL;
+int serverEvent = -1, clientEvent = -1;
+/* the indexes owned by the client */
+uint32_t requestTail, responseHead;
+/* requests sent through the socket while there are rings (bulk transfers) */
+int socketPending;
+int ringSpins;
 socklen_t servlen;
 struct sockaddr_un serv_addr, client_addr;
 char clientSocketID[MAX_INPUT_SIZE];
 
+/* sequence number of the next request, part of its id */
+uint32_t nextRequestId = 0;
+
+#define INFLIGHT_FREE 0
+#define INFLIGHT_SENT 1
+#define INFLIGHT_DONE 2
+
+/* requests in flight, the id of a request is also its handle */
+typedef struct tfs_inflight {
+  uint32_t request_id;
+  int state;
+  uint8_t opcode;
+  int count;             /* number of results */
+  tfs_result *results;   /* where the results are stored */
+  tfs_result result;     /* result of a single operation */
+  char *data;            /* where the data of a read is stored */
+  int size;              /* room in data */
+} tfs_inflight;
+
+/* control message with a single descriptor */
+typedef union tfs_control {
+  struct cmsghdr align;
+  char buf[CMSG_SPACE(sizeof(int))];
+} tfs_control;
+
+tfs_inflight inflight[TFS_MAX_INFLIGHT];
+/* where the search for a free slot starts */
+int nextSlot = 0;
+
+/* batch being built, the message is ready to be sent */
+struct {
+  tfs_header header;
+  char payload[TFS_MAX_MESSAGE - sizeof(tfs_header)];
+} batch;
+/* number of operations in the batch, -1 if there's no batch */
+int batchCount = -1;
+uint8_t batchOpcodes[TFS_MAX_BATCH];
+
 int setSockAddrUn(char *path, struct sockaddr_un *addr) {
 
   if (addr == NULL)
@@ -24,106 +85,1070 @@ int setSockAddrUn(char *path, struct sockaddr_un *addr) {
   return SUN_LEN(addr);
 }
 
-int tfsCreate(char *filename, char nodeType) {
+/*
+ * Finds the slot of a request in flight.
+ * Input:
+ *  - handle: handle of the request
+ * Returns: the slot or NULL if the handle isn't in flight
+ */
+tfs_inflight *tfsInflight(int handle) {
 
-  char command[MAX_INPUT_SIZE];
-  int result;
+  tfs_inflight *slot;
 
-  sprintf(command, "c %s %c", filename, nodeType);
+  if (handle < 0)
+    return NULL;
 
-  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
-    perror("client: sendto error");
-    exit(EXIT_FAILURE);
+  slot = &inflight[handle % TFS_MAX_INFLIGHT];
+
+  if (slot->state == INFLIGHT_FREE || slot->request_id != (uint32_t) handle)
+    return NULL;
+
+  return slot;
+}
+
+/*
+ * Copies the data of a bulk read from the memfd passed by the server.
+ * Input:
+ *  - slot: the read, with its result
+ *  - memfd: the memfd or -1 if none was passed
+ */
+void tfsCopyBulk(tfs_inflight *slot, int memfd) {
+
+  int length = slot->results[0].value < slot->size ? slot->results[0].value : slot->size;
+  char *map = NULL;
+
+  if (length > 0 &&
+      (memfd < 0 || (map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, memfd, 0)) == MAP_FAILED)) {
+    slot->results[0].status = TECNICOFS_ERROR_OTHER;
+    return;
   }
 
-  if (recvfrom(sockfd, &result, sizeof(int), 0, 0, 0) < 0) {
-    perror("client: recvfrom error");
-    exit(EXIT_FAILURE);
+  if (length > 0) {
+    memcpy(slot->data, map, length);
+    munmap(map, length);
+  }
+  slot->results[0].value = length;
+}
+
+/*
+ * Completes the request of a response.
+ * Input:
+ *  - header: the response, its results follow the header
+ *  - c: length of the response
+ *  - passed: descriptor passed with the response or -1
+ */
+void tfsDeliver(tfs_header *header, ssize_t c, int passed) {
+
+  tfs_result *results = (tfs_result *) (header + 1);
+  tfs_inflight *slot;
+  ssize_t dataLength;
+  int each;
+
+  /* responses to requests that were given up on are skipped */
+  slot = tfsInflight(header->request_id);
+  if (c < (ssize_t) (sizeof(tfs_header) + sizeof(tfs_result)) ||
+      slot == NULL || slot->state != INFLIGHT_SENT) {
+    if (passed >= 0)
+      close(passed);
+    return;
+  }
+
+  /* a rejected batch has a single result, shared by all its operations,
+  and so has a response that doesn't hold one for each of them */
+  each = header->count == slot->count &&
+         c >= (ssize_t) (sizeof(tfs_header) + slot->count * sizeof(tfs_result));
+  for (int i = 0; i < slot->count; i++)
+    slot->results[i] = results[each ? i : 0];
+
+  /* the data read follows the result */
+  if ((slot->opcode == TFS_OP_READ || slot->opcode == TFS_OP_STATS) && slot->results[0].status == 0) {
+    dataLength = c - sizeof(tfs_header) - sizeof(tfs_result);
+    if (dataLength > slot->results[0].value)
+      dataLength = slot->results[0].value;
+    if (dataLength > slot->size)
+      dataLength = slot->size;
+    memcpy(slot->data, &results[1], dataLength);
+    slot->results[0].value = dataLength;
+    /* the statistics are text, the room for the '\0' was kept */
+    if (slot->opcode == TFS_OP_STATS)
+      slot->data[dataLength] = '\0';
   }
 
-  return result;
+  if (slot->opcode == TFS_OP_READ_BULK && slot->results[0].status == 0)
+    tfsCopyBulk(slot, passed);
+  if (passed >= 0)
+    close(passed);
+
+  slot->state = INFLIGHT_DONE;
 }
 
-int tfsDelete(char *path) {
+/*
+ * Receives the responses that arrived through the socket.
+ * Input:
+ *  - block: if nonzero, waits for at least one response
+ * Returns: number of responses or a TECNICOFS_ERROR_* code
+ */
+int tfsReceiveSocket(int block) {
 
-  char command[MAX_INPUT_SIZE];
-  int result;
-  sprintf(command, "d %s", path);
+  int flags = block ? 0 : MSG_DONTWAIT;
+  int received = 0;
 
-  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
-    perror("client: sendto error");
-    exit(EXIT_FAILURE);
+  while (1) {
+    struct {
+      tfs_header header;
+      /* room for the largest message (rounded up) */
+      tfs_result results[(TFS_MAX_MESSAGE - sizeof(tfs_header) + sizeof(tfs_result) - 1) / sizeof(tfs_result)];
+    } response;
+    tfs_control control;
+    struct iovec iov = { &response, sizeof(response) };
+    struct msghdr msg = { NULL, 0, &iov, 1, control.buf, sizeof(control.buf), 0 };
+    struct cmsghdr *cmsg;
+    int passed = -1;
+
+    ssize_t c = recvmsg(sockfd, &msg, flags | MSG_CMSG_CLOEXEC);
+
+    if (c < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return received;
+      perror("client: recv error");
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
+    }
+
+    /* the server closed the connection */
+    if (c == 0 && sessionMode == TFS_MODE_SESSION) {
+      fprintf(stderr, "client: connection closed\n");
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
+    }
+
+    flags = MSG_DONTWAIT;
+    received++;
+
+    /* a descriptor passed with the response (bulk read) */
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+      memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+
+    tfsDeliver(&response.header, c, passed);
   }
+}
 
-  if (recvfrom(sockfd, &result, sizeof(int), 0, 0, 0) < 0){
-    perror("client: recvfrom error");
-    exit(EXIT_FAILURE);
+/*
+ * Checks if the ring of responses has responses.
+ */
+int tfsRingReady() {
+  return __atomic_load_n(&shm->responses.tail, __ATOMIC_ACQUIRE) != responseHead;
+}
+
+/*
+ * Takes the responses in the ring of responses, read in place.
+ * Returns: number of responses
+ */
+int tfsReceiveRing() {
+
+  uint32_t tail = __atomic_load_n(&shm->responses.tail, __ATOMIC_ACQUIRE);
+  int received = 0;
+
+  for (; responseHead != tail; responseHead++, received++) {
+    tfs_header *header = (tfs_header *) shm->responses.slots[responseHead % TFS_RING_SLOTS];
+    ssize_t c = sizeof(tfs_header) + header->length;
+
+    tfsDeliver(header, c <= TFS_MAX_MESSAGE ? c : 0, -1);
   }
 
-  return result;
+  /* the slots can be reused by the server */
+  if (received > 0)
+    __atomic_store_n(&shm->responses.head, responseHead, __ATOMIC_RELEASE);
+
+  return received;
 }
 
-int tfsMove(char *from, char *to) {
+/*
+ * Receives the responses that arrived and completes their requests. With
+ * rings, their responses are polled for a while (on multiprocessors)
+ * before sleeping until the server wakes the client.
+ * Input:
+ *  - block: if nonzero, waits for at least one response
+ * Returns: 0 or a TECNICOFS_ERROR_* code
+ */
+int tfsReceive(int block) {
 
-  char command[MAX_INPUT_SIZE];
-  int result;
-  sprintf(command, "m %s %s", from, to);
+  struct pollfd pfds[2] = { { sockfd, POLLIN, 0 }, { clientEvent, POLLIN, 0 } };
+  eventfd_t value;
+  int res;
 
-  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
-    perror("client: sendto error");
-    exit(EXIT_FAILURE);
+  if (shm == NULL)
+    return (res = tfsReceiveSocket(block)) < 0 ? res : 0;
+
+  while (1) {
+    int received = tfsReceiveRing();
+
+    if (socketPending > 0) {
+      if ((res = tfsReceiveSocket(0)) < 0)
+        return res;
+      socketPending -= res;
+      received += res;
+    }
+
+    if (received > 0 || !block)
+      return 0;
+
+    for (int spin = 0; spin < ringSpins && !tfsRingReady(); spin++)
+      tfs_relax();
+    if (tfsRingReady())
+      continue;
+
+    /* the server sees the flag or the client sees the response */
+    __atomic_store_n(&shm->responses.sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!tfsRingReady() && poll(pfds, 2, -1) < 0 && errno != EINTR) {
+      perror("client: poll error");
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
+    }
+    __atomic_store_n(&shm->responses.sleeping, 0, __ATOMIC_RELAXED);
+    eventfd_read(clientEvent, &value);
+
+    /* a closed connection is only seen in the socket */
+    if (pfds[0].revents != 0 && socketPending == 0 && tfsReceiveSocket(0) < 0)
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
   }
+}
 
-  if (recvfrom(sockfd, &result, sizeof(int), 0, 0, 0) < 0){
-    perror("client: recvfrom error");
-    exit(EXIT_FAILURE);
+/*
+ * Copies a request to the ring of requests, waking the server if it
+ * sleeps. There are never more than TFS_RING_SLOTS requests in the rings,
+ * so the server always has room for their responses.
+ * Input:
+ *  - msg: the request
+ * Returns: 0 or a TECNICOFS_ERROR_* code
+ */
+int tfsRingSend(struct msghdr *msg) {
+
+  char *slot;
+  int res;
+
+  while (requestTail - responseHead >= TFS_RING_SLOTS)
+    if ((res = tfsReceive(1)) != 0)
+      return res;
+
+  slot = shm->requests.slots[requestTail % TFS_RING_SLOTS];
+  for (size_t i = 0; i < msg->msg_iovlen; i++) {
+    memcpy(slot, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+    slot += msg->msg_iov[i].iov_len;
   }
+  requestTail++;
+  __atomic_store_n(&shm->requests.tail, requestTail, __ATOMIC_RELEASE);
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&shm->requests.sleeping, __ATOMIC_RELAXED))
+    eventfd_write(serverEvent, 1);
 
-  return result;
+  return 0;
 }
 
-int tfsLookup(char *path) {
+/*
+ * Sends a request to the server in a free slot. While the server can't
+ * take more requests the responses are received, so neither side stays
+ * blocked on the other. With rings, the requests go through them, except
+ * bulk transfers, which pass a memfd through the socket.
+ * Input:
+ *  - msg: the request, the first buffer holds its header
+ *  - opcode: operation of the request
+ *  - results: where the results are stored
+ *  - count: number of results expected
+ * Returns: handle of the request or a TECNICOFS_ERROR_* code
+ */
+int tfsSubmit(struct msghdr *msg, uint8_t opcode, tfs_result *results, int count) {
 
-  char command[MAX_INPUT_SIZE] ;
-  int result;
-  sprintf(command, "l %s", path);
+  tfs_header *request = msg->msg_iov[0].iov_base;
+  tfs_inflight *slot = NULL;
+  struct pollfd pfd = { sockfd, POLLIN | POLLOUT, 0 };
 
-  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
-    perror("client: sendto error");
-    exit(EXIT_FAILURE);
+  for (int i = 0; i < TFS_MAX_INFLIGHT; i++) {
+    if (inflight[nextSlot].state == INFLIGHT_FREE) {
+      slot = &inflight[nextSlot];
+      break;
+    }
+    nextSlot = (nextSlot + 1) % TFS_MAX_INFLIGHT;
   }
 
-  if (recvfrom(sockfd, &result, sizeof(int), 0, 0, 0) < 0){
-    perror("client: recvfrom error");
-    exit(EXIT_FAILURE);
+  if (sockfd < 0)
+    return TECNICOFS_ERROR_NO_OPEN_SESSION;
+
+  if (slot == NULL)
+    return TECNICOFS_ERROR_TOO_MANY_REQUESTS;
+
+  /* the slot is part of the id, the sequence number tells reuses apart */
+  request->request_id = (nextRequestId++ % (INT32_MAX / TFS_MAX_INFLIGHT)) * TFS_MAX_INFLIGHT + nextSlot;
+  nextSlot = (nextSlot + 1) % TFS_MAX_INFLIGHT;
+
+  if (shm != NULL && msg->msg_controllen == 0 && opcode != TFS_OP_READ_BULK) {
+    int res = tfsRingSend(msg);
+
+    if (res != 0)
+      return res;
+  }
+  else while (sendmsg(sockfd, msg, MSG_DONTWAIT) < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      perror("client: sendmsg error");
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
+    }
+    if (poll(&pfd, 1, -1) < 0 || ((pfd.revents & POLLIN) && tfsReceive(0) != 0))
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
   }
 
-  return result;
+  if (shm != NULL && (msg->msg_controllen != 0 || opcode == TFS_OP_READ_BULK))
+    socketPending++;
+
+  slot->request_id = request->request_id;
+  slot->state = INFLIGHT_SENT;
+  slot->opcode = opcode;
+  slot->count = count;
+  slot->results = results != NULL ? results : &slot->result;
+  slot->data = NULL;
+
+  return slot->request_id;
+}
+
+/*
+ * Sends a request to the server without waiting for its result. The
+ * message is gathered from the arguments themselves, nothing is copied.
+ * Input:
+ *  - opcode: operation of the request
+ *  - arg: small argument of the operation (node type of a create)
+ *  - args: the string arguments of the operation
+ *  - nargs: number of string arguments
+ * Returns: handle of the request or a TECNICOFS_ERROR_* code
+ */
+int tfsRequest(uint8_t opcode, uint8_t arg, char **args, int nargs) {
+
+  tfs_header header = { opcode, arg, 0, 0, 0 };
+  tfs_arglen lengths[nargs];
+  struct iovec iov[1 + 2 * nargs];
+  struct msghdr msg = { NULL, 0, iov, 1 + 2 * nargs, NULL, 0, 0 };
+
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+
+  for (int i = 0; i < nargs; i++) {
+    size_t len = strlen(args[i]);
+
+    if (len > TFS_MAX_MESSAGE) {
+      fprintf(stderr, "client: argument too long\n");
+      return TECNICOFS_ERROR_OTHER;
+    }
+
+    lengths[i] = len;
+    iov[1 + 2 * i].iov_base = &lengths[i];
+    iov[1 + 2 * i].iov_len = sizeof(tfs_arglen);
+    /* the string goes with its '\0' */
+    iov[2 + 2 * i].iov_base = args[i];
+    iov[2 + 2 * i].iov_len = len + 1;
+    header.length += sizeof(tfs_arglen) + len + 1;
+  }
+
+  if (sizeof(header) + header.length > TFS_MAX_MESSAGE) {
+    fprintf(stderr, "client: request too long\n");
+    return TECNICOFS_ERROR_OTHER;
+  }
+
+  return tfsSubmit(&msg, opcode, NULL, 1);
+}
+
+/*
+ * Checks if a request is complete, optionally waiting for it.
+ * Input:
+ *  - handle: handle of the request
+ *  - block: if nonzero, waits for the request to complete
+ * Returns: 1 if the request is complete, 0 if it isn't or a
+ * TECNICOFS_ERROR_* code
+ */
+int tfsComplete(int handle, int block) {
+
+  tfs_inflight *slot = tfsInflight(handle);
+  int res;
+
+  if (slot == NULL)
+    return TECNICOFS_ERROR_OTHER;
+
+  if (slot->state == INFLIGHT_SENT && (res = tfsReceive(0)) != 0)
+    return res;
+
+  while (block && slot->state == INFLIGHT_SENT)
+    if ((res = tfsReceive(1)) != 0)
+      return res;
+
+  return slot->state == INFLIGHT_DONE;
+}
+
+/*
+ * Releases the slot of a request, whether it completed or not. A response
+ * that still arrives for it is then skipped, instead of being stored where
+ * the request kept its results.
+ * Input:
+ *  - handle: handle of the request
+ */
+void tfsForget(int handle) {
+
+  tfs_inflight *slot = tfsInflight(handle);
+
+  if (slot != NULL)
+    slot->state = INFLIGHT_FREE;
+}
+
+/*
+ * Returns the result of a completed operation and releases its slot.
+ */
+int tfsRelease(tfs_inflight *slot) {
+
+  int res = slot->results[0].status;
+
+  if (res == 0 && (slot->opcode == TFS_OP_LOOKUP || slot->opcode == TFS_OP_OPEN ||
+                   slot->opcode == TFS_OP_READ || slot->opcode == TFS_OP_WRITE ||
+                   slot->opcode == TFS_OP_READ_BULK || slot->opcode == TFS_OP_WRITE_BULK ||
+                   slot->opcode == TFS_OP_STATS))
+    res = slot->results[0].value;
+
+  slot->state = INFLIGHT_FREE;
+  return res;
+}
+
+/*
+ * Checks, without blocking, if a request sent with tfs*Async is complete.
+ * Input:
+ *  - handle: handle of the request
+ *  - result: where the result is stored, the same the synchronous call
+ *    would return (the handle is then no longer valid)
+ * Returns: 1 if the request is complete, 0 if it is still in flight or a
+ * TECNICOFS_ERROR_* code
+ */
+int tfsPoll(int handle, int *result) {
+
+  int res = tfsComplete(handle, 0);
+
+  if (res == 1)
+    *result = tfsRelease(tfsInflight(handle));
+
+  return res;
+}
+
+/*
+ * Waits for a request sent with tfs*Async to complete. The handle is then
+ * no longer valid.
+ * Input:
+ *  - handle: handle of the request
+ * Returns: the same the synchronous call would return
+ */
+int tfsWait(int handle) {
+
+  int res = tfsComplete(handle, 1);
+
+  if (res < 0) {
+    tfsForget(handle);
+    return res;
+  }
+
+  return tfsRelease(tfsInflight(handle));
+}
+
+int tfsCreateAsync(char *filename, char nodeType) {
+
+  if (nodeType != 'f' && nodeType != 'd')
+    return TECNICOFS_ERROR_OTHER;
+
+  return tfsRequest(TFS_OP_CREATE, nodeType == 'f' ? T_FILE : T_DIRECTORY, &filename, 1);
+}
+
+int tfsDeleteAsync(char *path) {
+  return tfsRequest(TFS_OP_DELETE, 0, &path, 1);
+}
+
+int tfsMoveAsync(char *from, char *to) {
+
+  char *args[2] = { from, to };
+
+  return tfsRequest(TFS_OP_MOVE, 0, args, 2);
+}
+
+int tfsLookupAsync(char *path) {
+  return tfsRequest(TFS_OP_LOOKUP, 0, &path, 1);
+}
+
+int tfsPrintAsync(char *outputfile) {
+  return tfsRequest(TFS_OP_PRINT, 0, &outputfile, 1);
+}
+
+int tfsOpenAsync(char *filename, permission mode) {
+  return tfsRequest(TFS_OP_OPEN, mode, &filename, 1);
+}
+
+int tfsCloseAsync(int fd) {
+
+  tfs_header header = { TFS_OP_CLOSE, fd, 0, 0, 0 };
+  struct iovec iov = { &header, sizeof(header) };
+  struct msghdr msg = { NULL, 0, &iov, 1, NULL, 0, 0 };
+
+  if (fd < 0 || fd >= TFS_MAX_OPEN_FILES)
+    return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+  return tfsSubmit(&msg, TFS_OP_CLOSE, NULL, 1);
+}
+
+/*
+ * Reads from an open file, from its offset, which moves past the bytes
+ * read. At most TFS_MAX_READ bytes are read at once.
+ * Input:
+ *  - fd: file descriptor returned by tfsOpen
+ *  - buffer: where the data is stored, it must stay valid until the read
+ *    completes
+ *  - len: number of bytes to read
+ * Returns: handle of the request or a TECNICOFS_ERROR_* code
+ */
+int tfsReadAsync(int fd, char *buffer, int len) {
+
+  tfs_header header = { TFS_OP_READ, fd, 0, 0, sizeof(tfs_argint) };
+  tfs_argint count = len < (int) TFS_MAX_READ ? len : TFS_MAX_READ;
+  struct iovec iov[2] = { { &header, sizeof(header) }, { &count, sizeof(count) } };
+  struct msghdr msg = { NULL, 0, iov, 2, NULL, 0, 0 };
+  int handle;
+
+  if (fd < 0 || fd >= TFS_MAX_OPEN_FILES)
+    return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+  if (len < 0)
+    return TECNICOFS_ERROR_OTHER;
+
+  if ((handle = tfsSubmit(&msg, TFS_OP_READ, NULL, 1)) >= 0) {
+    tfsInflight(handle)->data = buffer;
+    tfsInflight(handle)->size = count;
+  }
+
+  return handle;
+}
+
+/*
+ * Writes to an open file, from its offset, which moves past the bytes
+ * written. At most TFS_MAX_WRITE bytes are written at once. The data is
+ * sent as is, nothing is copied.
+ * Input:
+ *  - fd: file descriptor returned by tfsOpen
+ *  - buffer: the data
+ *  - len: number of bytes to write
+ * Returns: handle of the request or a TECNICOFS_ERROR_* code
+ */
+int tfsWriteAsync(int fd, char *buffer, int len) {
+
+  tfs_arglen length = len < (int) TFS_MAX_WRITE ? len : TFS_MAX_WRITE;
+  tfs_header header = { TFS_OP_WRITE, fd, 0, 0, sizeof(tfs_arglen) + length + 1 };
+  struct iovec iov[4] = { { &header, sizeof(header) }, { &length, sizeof(length) },
+                          { buffer, length }, { "", 1 } };
+  struct msghdr msg = { NULL, 0, iov, 4, NULL, 0, 0 };
+
+  if (fd < 0 || fd >= TFS_MAX_OPEN_FILES)
+    return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+  if (len < 0)
+    return TECNICOFS_ERROR_OTHER;
+
+  return tfsSubmit(&msg, TFS_OP_WRITE, NULL, 1);
+}
+
+/*
+ * Asks for the statistics of the server: counts and latencies of the
+ * operations, requests queued and occupancy of the i-node table.
+ * Input:
+ *  - buffer: where the statistics are stored, as a string, it must stay
+ *    valid until the request completes
+ *  - len: room in the buffer, the statistics are truncated to fit
+ *  - format: TFS_STATS_TEXT or TFS_STATS_JSON
+ * Returns: handle of the request or a TECNICOFS_ERROR_* code
+ */
+int tfsStatsAsync(char *buffer, int len, int format) {
+
+  tfs_header header = { TFS_OP_STATS, format, 0, 0, 0 };
+  struct iovec iov = { &header, sizeof(header) };
+  struct msghdr msg = { NULL, 0, &iov, 1, NULL, 0, 0 };
+  int handle;
+
+  if (len <= 0 || (format != TFS_STATS_TEXT && format != TFS_STATS_JSON))
+    return TECNICOFS_ERROR_OTHER;
+
+  if ((handle = tfsSubmit(&msg, TFS_OP_STATS, NULL, 1)) >= 0) {
+    tfsInflight(handle)->data = buffer;
+    tfsInflight(handle)->size = len - 1;
+  }
+
+  return handle;
+}
+
+/*
+ * Reads from an open file like tfsReadAsync, but the data comes in a
+ * sealed memfd passed by the server instead of in the response, for reads
+ * larger than TFS_MAX_READ. Only for clients on the same host.
+ * Input:
+ *  - fd: file descriptor returned by tfsOpen
+ *  - buffer: where the data is stored, it must stay valid until the read
+ *    completes
+ *  - len: number of bytes to read
+ * Returns: handle of the request or a TECNICOFS_ERROR_* code
+ */
+int tfsReadBulkAsync(int fd, char *buffer, int len) {
+
+  tfs_header header = { TFS_OP_READ_BULK, fd, 0, 0, sizeof(tfs_argint) };
+  tfs_argint count = len;
+  struct iovec iov[2] = { { &header, sizeof(header) }, { &count, sizeof(count) } };
+  struct msghdr msg = { NULL, 0, iov, 2, NULL, 0, 0 };
+  int handle;
+
+  if (fd < 0 || fd >= TFS_MAX_OPEN_FILES)
+    return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+  if (len < 0)
+    return TECNICOFS_ERROR_OTHER;
+
+  if ((handle = tfsSubmit(&msg, TFS_OP_READ_BULK, NULL, 1)) >= 0) {
+    tfsInflight(handle)->data = buffer;
+    tfsInflight(handle)->size = len;
+  }
+
+  return handle;
+}
+
+/*
+ * Writes to an open file like tfsWriteAsync, but the data goes in a sealed
+ * memfd passed to the server instead of in the request, for writes larger
+ * than TFS_MAX_WRITE. Only for clients on the same host.
+ * Input:
+ *  - fd: file descriptor returned by tfsOpen
+ *  - buffer: the data, copied to the memfd
+ *  - len: number of bytes to write
+ * Returns: handle of the request or a TECNICOFS_ERROR_* code
+ */
+int tfsWriteBulkAsync(int fd, char *buffer, int len) {
+
+  tfs_header header = { TFS_OP_WRITE_BULK, fd, 0, 0, sizeof(tfs_argint) };
+  tfs_argint count = len;
+  struct iovec iov[2] = { { &header, sizeof(header) }, { &count, sizeof(count) } };
+  tfs_control control;
+  struct msghdr msg = { NULL, 0, iov, 2, control.buf, sizeof(control.buf), 0 };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  int memfd, handle;
+  ssize_t n;
+
+  if (fd < 0 || fd >= TFS_MAX_OPEN_FILES)
+    return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+  if (len < 0)
+    return TECNICOFS_ERROR_OTHER;
+
+  if ((memfd = memfd_create("tecnicofs-write", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+    perror("client: memfd_create error");
+    return TECNICOFS_ERROR_OTHER;
+  }
+
+  for (int done = 0; done < len; done += n) {
+    if ((n = write(memfd, buffer + done, len - done)) < 0) {
+      perror("client: memfd write error");
+      close(memfd);
+      return TECNICOFS_ERROR_OTHER;
+    }
+  }
+
+  /* the server maps it, it can't change from then on */
+  if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+    perror("client: memfd seal error");
+    close(memfd);
+    return TECNICOFS_ERROR_OTHER;
+  }
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+  handle = tfsSubmit(&msg, TFS_OP_WRITE_BULK, NULL, 1);
+
+  /* the message took its own reference */
+  close(memfd);
+  return handle;
+}
+
+int tfsCreate(char *filename, char nodeType) {
+
+  int handle = tfsCreateAsync(filename, nodeType);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+int tfsDelete(char *path) {
+
+  int handle = tfsDeleteAsync(path);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+int tfsMove(char *from, char *to) {
+
+  int handle = tfsMoveAsync(from, to);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+int tfsLookup(char *path) {
+
+  int handle = tfsLookupAsync(path);
+
+  return handle < 0 ? handle : tfsWait(handle);
 }
 
 int tfsPrint(char *outputfile){
 
-  char command[MAX_INPUT_SIZE] ;
-  int result;
-  sprintf(command, "p %s", outputfile);
+  int handle = tfsPrintAsync(outputfile);
 
-  if (sendto(sockfd, command, strlen(command)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
-    perror("client: sendto error");
-    exit(EXIT_FAILURE);
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+/*
+ * Opens a file, which must exist, in the session with the server.
+ * Input:
+ *  - filename: path of the file
+ *  - mode: READ, WRITE or RW
+ * Returns: file descriptor or a TECNICOFS_ERROR_* code
+ */
+int tfsOpen(char *filename, permission mode) {
+
+  int handle = tfsOpenAsync(filename, mode);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+int tfsClose(int fd) {
+
+  int handle = tfsCloseAsync(fd);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+/*
+ * Reads from an open file (see tfsReadAsync).
+ * Returns: number of bytes read (0 at the end of the file) or a
+ * TECNICOFS_ERROR_* code
+ */
+int tfsRead(int fd, char *buffer, int len) {
+
+  int handle = tfsReadAsync(fd, buffer, len);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+/*
+ * Asks for the statistics of the server (see tfsStatsAsync).
+ * Returns: length of the statistics or a TECNICOFS_ERROR_* code
+ */
+int tfsStats(char *buffer, int len, int format) {
+
+  int handle = tfsStatsAsync(buffer, len, format);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+/*
+ * Writes to an open file (see tfsWriteAsync).
+ * Returns: number of bytes written or a TECNICOFS_ERROR_* code
+ */
+int tfsWrite(int fd, char *buffer, int len) {
+
+  int handle = tfsWriteAsync(fd, buffer, len);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+/*
+ * Reads from an open file through a memfd (see tfsReadBulkAsync).
+ * Returns: number of bytes read (0 at the end of the file) or a
+ * TECNICOFS_ERROR_* code
+ */
+int tfsReadBulk(int fd, char *buffer, int len) {
+
+  int handle = tfsReadBulkAsync(fd, buffer, len);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+/*
+ * Writes to an open file through a memfd (see tfsWriteBulkAsync).
+ * Returns: number of bytes written or a TECNICOFS_ERROR_* code
+ */
+int tfsWriteBulk(int fd, char *buffer, int len) {
+
+  int handle = tfsWriteBulkAsync(fd, buffer, len);
+
+  return handle < 0 ? handle : tfsWait(handle);
+}
+
+/*
+ * Starts a new batch of operations, discarding the one that wasn't
+ * committed. The operations added with tfsBatch* are sent together, in a
+ * single message, by tfsBatchCommit.
+ * Returns: 0
+ */
+int tfsBatchBegin() {
+
+  batchCount = 0;
+  batch.header.length = 0;
+
+  return 0;
+}
+
+/*
+ * Adds an operation to the batch. The arguments are copied.
+ * Input:
+ *  - opcode: operation
+ *  - arg: small argument of the operation (node type of a create)
+ *  - args: the string arguments of the operation
+ *  - nargs: number of string arguments
+ * Returns: position of the operation in the batch or a TECNICOFS_ERROR_*
+ * code (TECNICOFS_ERROR_BATCH_FULL if it must be committed first)
+ */
+int tfsBatchAdd(uint8_t opcode, uint8_t arg, char **args, int nargs) {
+
+  tfs_batch_op op = { opcode, arg };
+  uint32_t length = sizeof(tfs_batch_op);
+
+  if (batchCount < 0)
+    return TECNICOFS_ERROR_OTHER;
+
+  for (int i = 0; i < nargs; i++)
+    length += sizeof(tfs_arglen) + strlen(args[i]) + 1;
+
+  if (batchCount == TFS_MAX_BATCH ||
+      sizeof(tfs_header) + batch.header.length + length > TFS_MAX_MESSAGE)
+    return batchCount == 0 ? TECNICOFS_ERROR_OTHER : TECNICOFS_ERROR_BATCH_FULL;
+
+  memcpy(batch.payload + batch.header.length, &op, sizeof(tfs_batch_op));
+  batch.header.length += sizeof(tfs_batch_op);
+
+  for (int i = 0; i < nargs; i++) {
+    tfs_arglen len = strlen(args[i]);
+
+    memcpy(batch.payload + batch.header.length, &len, sizeof(tfs_arglen));
+    memcpy(batch.payload + batch.header.length + sizeof(tfs_arglen), args[i], len + 1);
+    batch.header.length += sizeof(tfs_arglen) + len + 1;
   }
 
-  if (recvfrom(sockfd, &result, sizeof(int), 0, 0, 0) < 0){
-    perror("client: recvfrom error");
-    exit(EXIT_FAILURE);
+  batchOpcodes[batchCount] = opcode;
+  return batchCount++;
+}
+
+int tfsBatchCreate(char *filename, char nodeType) {
+
+  if (nodeType != 'f' && nodeType != 'd')
+    return TECNICOFS_ERROR_OTHER;
+
+  return tfsBatchAdd(TFS_OP_CREATE, nodeType == 'f' ? T_FILE : T_DIRECTORY, &filename, 1);
+}
+
+int tfsBatchDelete(char *path) {
+  return tfsBatchAdd(TFS_OP_DELETE, 0, &path, 1);
+}
+
+int tfsBatchMove(char *from, char *to) {
+
+  char *args[2] = { from, to };
+
+  return tfsBatchAdd(TFS_OP_MOVE, 0, args, 2);
+}
+
+int tfsBatchLookup(char *path) {
+  return tfsBatchAdd(TFS_OP_LOOKUP, 0, &path, 1);
+}
+
+int tfsBatchPrint(char *outputfile) {
+  return tfsBatchAdd(TFS_OP_PRINT, 0, &outputfile, 1);
+}
+
+/*
+ * Sends the batch to the server, where its operations are executed in
+ * order, and waits for their results. The batch is closed.
+ * Input:
+ *  - results: where the result of each operation is stored, the same the
+ *    single operation call would return (room for the operations added)
+ * Returns: number of operations or a TECNICOFS_ERROR_* code
+ */
+int tfsBatchCommit(int results[]) {
+
+  int count = batchCount;
+  int handle, res;
+  tfs_result replies[TFS_MAX_BATCH];
+  struct iovec iov = { &batch, sizeof(tfs_header) + batch.header.length };
+  struct msghdr msg = { NULL, 0, &iov, 1, NULL, 0, 0 };
+
+  if (count < 0)
+    return TECNICOFS_ERROR_OTHER;
+
+  batchCount = -1;
+
+  if (count == 0)
+    return 0;
+
+  batch.header.opcode = TFS_OP_BATCH;
+  batch.header.count = count;
+
+  if ((handle = tfsSubmit(&msg, TFS_OP_BATCH, replies, count)) < 0)
+    return handle;
+
+  /* the results would be stored in replies after it is gone */
+  if ((res = tfsComplete(handle, 1)) < 0) {
+    tfsForget(handle);
+    return res;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (batchOpcodes[i] == TFS_OP_LOOKUP && replies[i].status == 0)
+      results[i] = replies[i].value;
+    else
+      results[i] = replies[i].status;
   }
 
-  return result;
+  tfsForget(handle);
+  return count;
+}
+
+/*
+ * Sets up the shared memory rings of a session: the memfd with the rings
+ * goes to the server, which answers with the eventfds that wake it and
+ * the client.
+ * Returns: 0 or a TECNICOFS_ERROR_* code
+ */
+int tfsRingSetup() {
+
+  tfs_header header = { TFS_OP_RING, 0, 0, 0, 0 };
+  struct {
+    tfs_header header;
+    tfs_result result;
+  } response;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+  } control;
+  struct iovec iov = { &header, sizeof(header) };
+  struct msghdr msg = { NULL, 0, &iov, 1, control.buf, CMSG_SPACE(sizeof(int)), 0 };
+  struct cmsghdr *cmsg;
+  int memfd, fds[2];
+  tfs_shm *map;
+  ssize_t c;
+
+  /* the server maps it too, it must not shrink */
+  if ((memfd = memfd_create("tecnicofs-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    return TECNICOFS_ERROR_OTHER;
+  if (ftruncate(memfd, sizeof(tfs_shm)) < 0 ||
+      fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 ||
+      (map = mmap(NULL, sizeof(tfs_shm), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+    close(memfd);
+    return TECNICOFS_ERROR_OTHER;
+  }
 
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+  /* nothing is in flight yet, the answer is the next message */
+  c = sendmsg(sockfd, &msg, 0);
+  close(memfd);
+
+  iov = (struct iovec) { &response, sizeof(response) };
+  msg = (struct msghdr) { NULL, 0, &iov, 1, control.buf, sizeof(control.buf), 0 };
+  if (c < 0 || (c = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC)) < (ssize_t) sizeof(response)) {
+    munmap(map, sizeof(tfs_shm));
+    return TECNICOFS_ERROR_CONNECTION_ERROR;
+  }
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+    munmap(map, sizeof(tfs_shm));
+    return response.result.status != 0 ? response.result.status : TECNICOFS_ERROR_OTHER;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+
+  shm = map;
+  serverEvent = fds[0];
+  clientEvent = fds[1];
+  requestTail = responseHead = 0;
+  socketPending = 0;
+  ringSpins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? TFS_RING_SPINS : 0;
+
+  return 0;
 }
 
+/*
+ * Opens a session with the server, with shared memory rings in a
+ * connection to its session socket if it has one, or with datagrams
+ * otherwise.
+ * Input:
+ *  - sockPath: path of the server socket
+ * Returns: 0 or a TECNICOFS_ERROR_* code
+ */
 int tfsMount(char * sockPath) {
 
+  int res = tfsMountMode(sockPath, TFS_MODE_RING);
+
+  if (res == TECNICOFS_ERROR_CONNECTION_ERROR)
+    res = tfsMountMode(sockPath, TFS_MODE_DATAGRAM);
+
+  return res;
+}
+
+/*
+ * Opens a session with the server.
+ * Input:
+ *  - sockPath: path of the server socket
+ *  - mode: TFS_MODE_SESSION for a connection to the session socket of
+ *    the server, TFS_MODE_RING for that connection with shared memory
+ *    rings if the server accepts them, TFS_MODE_DATAGRAM for datagrams
+ * Returns: 0 or a TECNICOFS_ERROR_* code
+ */
+int tfsMountMode(char *sockPath, int mode) {
+
   socklen_t clilen;
+  char sessionPath[strlen(sockPath) + sizeof(TFS_SESSION_SUFFIX)];
+
+  if (sockfd >= 0)
+    return TECNICOFS_ERROR_OPEN_SESSION;
+
+  sprintf(sessionPath, "%s%s", sockPath, TFS_SESSION_SUFFIX);
+
+  if (strlen(sessionPath) >= sizeof(serv_addr.sun_path)) {
+    fprintf(stderr, "client: socket path too long\n");
+    return TECNICOFS_ERROR_OTHER;
+  }
+
+  if (mode == TFS_MODE_SESSION || mode == TFS_MODE_RING) {
+    if ((sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) {
+      perror("client: can't open socket");
+      exit(EXIT_FAILURE);
+    }
+
+    servlen = setSockAddrUn(sessionPath, &serv_addr);
+
+    /* no address of our own, the connection is the session */
+    if (connect(sockfd, (struct sockaddr *) &serv_addr, servlen) < 0) {
+      close(sockfd);
+      sockfd = -1;
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
+    }
+
+    sessionMode = TFS_MODE_SESSION;
+
+    /* without the rings, it's still a session */
+    if (mode == TFS_MODE_RING && tfsRingSetup() == TECNICOFS_ERROR_CONNECTION_ERROR) {
+      close(sockfd);
+      sockfd = -1;
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
+    }
+    return 0;
+  }
 
   if ((sockfd = socket(AF_UNIX, SOCK_DGRAM, 0) ) < 0) {
     perror("client: can't open socket");
@@ -145,13 +1170,39 @@ int tfsMount(char * sockPath) {
 
   servlen = setSockAddrUn(sockPath, &serv_addr);
 
+  /* the server is the only peer, a full server queue is seen by poll */
+  if (connect(sockfd, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    perror("client: connect error");
+    close(sockfd);
+    sockfd = -1;
+    unlink(clientSocketID);
+    return TECNICOFS_ERROR_CONNECTION_ERROR;
+  }
+
+  sessionMode = TFS_MODE_DATAGRAM;
   return 0;
 }
 
 int tfsUnmount() {
+
+  if (sockfd < 0)
+    return TECNICOFS_ERROR_NO_OPEN_SESSION;
+
   close(sockfd);
+  sockfd = -1;
 
-  unlink(clientSocketID);
+  if (shm != NULL) {
+    munmap(shm, sizeof(tfs_shm));
+    shm = NULL;
+    close(serverEvent);
+    close(clientEvent);
+  }
+
+  if (sessionMode == TFS_MODE_DATAGRAM)
+    unlink(clientSocketID);
+
+  /* the requests in flight are lost with the session */
+  memset(inflight, 0, sizeof(inflight));
 
   return 0;
 }
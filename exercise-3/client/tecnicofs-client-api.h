@@ -3,12 +3,51 @@
 
 #include "../tecnicofs-api-constants.h"
 
+/* Ways of opening a session with tfsMountMode */
+#define TFS_MODE_DATAGRAM 0
+#define TFS_MODE_SESSION 1
+#define TFS_MODE_RING 2
+
+/* Largest number of requests in flight */
+#define TFS_MAX_INFLIGHT 256
+
 int tfsCreate(char *path, char nodeType);
 int tfsDelete(char *path);
 int tfsLookup(char *path);
 int tfsMove(char *from, char *to);
 int tfsMount(char* serverName);
+int tfsMountMode(char *serverName, int mode);
 int tfsUnmount();
 int tfsPrint(char* filename);
+int tfsOpen(char *filename, permission mode);
+int tfsClose(int fd);
+int tfsRead(int fd, char *buffer, int len);
+int tfsWrite(int fd, char *buffer, int len);
+int tfsReadBulk(int fd, char *buffer, int len);
+int tfsWriteBulk(int fd, char *buffer, int len);
+int tfsStats(char *buffer, int len, int format);
+
+int tfsCreateAsync(char *path, char nodeType);
+int tfsDeleteAsync(char *path);
+int tfsLookupAsync(char *path);
+int tfsMoveAsync(char *from, char *to);
+int tfsPrintAsync(char *filename);
+int tfsOpenAsync(char *filename, permission mode);
+int tfsCloseAsync(int fd);
+int tfsReadAsync(int fd, char *buffer, int len);
+int tfsWriteAsync(int fd, char *buffer, int len);
+int tfsReadBulkAsync(int fd, char *buffer, int len);
+int tfsWriteBulkAsync(int fd, char *buffer, int len);
+int tfsStatsAsync(char *buffer, int len, int format);
+int tfsPoll(int handle, int *result);
+int tfsWait(int handle);
+
+int tfsBatchBegin();
+int tfsBatchCreate(char *path, char nodeType);
+int tfsBatchDelete(char *path);
+int tfsBatchLookup(char *path);
+int tfsBatchMove(char *from, char *to);
+int tfsBatchPrint(char *filename);
+int tfsBatchCommit(int results[]);
 
 #endif /* CLIENT_H */
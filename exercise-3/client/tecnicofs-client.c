@@ -30,18 +30,157 @@ static void parseArgs (long argc, char* const argv[]) {
     }
 }
 
+/* commands in the batch, their output is shown once it is committed */
+typedef struct command {
+    char op;
+    char nodeType;
+    char *arg1;
+    char *arg2;
+} command;
+
+command pending[TFS_MAX_BATCH];
+int numPending = 0;
+
+/*
+ * Sends the batch of commands and shows their results.
+ */
+void flushBatch() {
+    int res[TFS_MAX_BATCH];
+    int count = tfsBatchCommit(res);
+
+    for (int i = 0; i < numPending; i++) {
+        command *cmd = &pending[i];
+
+        if (count < 0)
+            res[i] = count;
+
+        switch (cmd->op) {
+            case 'c':
+                if (cmd->nodeType == 'f') {
+                    if (!res[i])
+                      printf("Created file: %s\n", cmd->arg1);
+                    else
+                      printf("Unable to create file: %s\n", cmd->arg1);
+                }
+                else {
+                    if (!res[i])
+                      printf("Created directory: %s\n", cmd->arg1);
+                    else
+                      printf("Unable to create directory: %s\n", cmd->arg1);
+                }
+                break;
+            case 'l':
+                if (res[i] >= 0)
+                    printf("Search: %s found\n", cmd->arg1);
+                else
+                    printf("Search: %s not found\n", cmd->arg1);
+                break;
+            case 'd':
+                if (!res[i])
+                  printf("Deleted: %s\n", cmd->arg1);
+                else
+                  printf("Unable to delete: %s\n", cmd->arg1);
+                break;
+            case 'm':
+                if (!res[i])
+                  printf("Moved: %s to %s\n", cmd->arg1, cmd->arg2);
+                else
+                  printf("Unable to move: %s to %s\n", cmd->arg1, cmd->arg2);
+                break;
+            case 'p':
+                if (!res[i])
+                  printf("Printed to: %s\n", cmd->arg1);
+                else
+                  printf("Unable to print to: %s\n", cmd->arg1);
+                break;
+        }
+        free(cmd->arg1);
+        free(cmd->arg2);
+    }
+
+    numPending = 0;
+    tfsBatchBegin();
+}
+
+/*
+ * Adds a command to the batch, sending the batch first if it is full.
+ */
+void addCommand(char op, char nodeType, char *arg1, char *arg2) {
+    int res;
+
+    while (1) {
+        switch (op) {
+            case 'c':
+                res = tfsBatchCreate(arg1, nodeType);
+                break;
+            case 'l':
+                res = tfsBatchLookup(arg1);
+                break;
+            case 'd':
+                res = tfsBatchDelete(arg1);
+                break;
+            case 'm':
+                res = tfsBatchMove(arg1, arg2);
+                break;
+            default:
+                res = tfsBatchPrint(arg1);
+        }
+        if (res != TECNICOFS_ERROR_BATCH_FULL)
+            break;
+        flushBatch();
+    }
+
+    if (res < 0) {
+        fprintf(stderr, "Error: command too long\n");
+        return;
+    }
+
+    pending[numPending].op = op;
+    pending[numPending].nodeType = nodeType;
+    pending[numPending].arg1 = strdup(arg1);
+    pending[numPending].arg2 = arg2 != NULL ? strdup(arg2) : NULL;
+    numPending++;
+}
+
+/*
+ * Writes a text to a file, after the commands before it (files are not
+ * opened or written in batches).
+ */
+void writeFile(char *name, char *text) {
+    int fd, res;
+
+    flushBatch();
+
+    if ((fd = tfsOpen(name, WRITE)) < 0) {
+        printf("Unable to write: %s\n", name);
+        return;
+    }
+    res = tfsWrite(fd, text, strlen(text));
+    tfsClose(fd);
+
+    if (res >= 0)
+        printf("Wrote: %s\n", name);
+    else
+        printf("Unable to write: %s\n", name);
+}
+
 void errorParse(){
+    /* the commands before the invalid one are still executed */
+    flushBatch();
     fprintf(stderr, "Error: command invalid\n");
     exit(EXIT_FAILURE);
 }
 
 void *processInput() {
-    char line[MAX_INPUT_SIZE];
+    char *line = NULL;
+    size_t size = 0;
+
+    tfsBatchBegin();
 
-    while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
+    /* lines (and paths) can have any length */
+    while (getline(&line, &size, inputFile) != -1) {
         char op;
-        char arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
-        int res;
+        char arg1[strlen(line) + 1], arg2[strlen(line) + 1];
 
         int numTokens = sscanf(line, "%c %s %s", &op, arg1, arg2);
 
@@ -57,58 +196,29 @@ void *processInput() {
                 }
                 switch (arg2[0]) {
                     case 'f':
-                        res = tfsCreate(arg1, 'f');
-                        if (!res)
-                          printf("Created file: %s\n", arg1);
-                        else
-                          printf("Unable to create file: %s\n", arg1);
-                        break;
                     case 'd':
-                        res = tfsCreate(arg1, 'd');
-                        if (!res)
-                          printf("Created directory: %s\n", arg1);
-                        else
-                          printf("Unable to create directory: %s\n", arg1);
+                        addCommand(op, arg2[0], arg1, NULL);
                         break;
                     default:
                         fprintf(stderr, "Error: invalid node type\n");
                 }
                 break;
             case 'l':
-                if(numTokens != 2)
-                    errorParse();
-                res = tfsLookup(arg1);
-                if (res >= 0)
-                    printf("Search: %s found\n", arg1);
-                else
-                    printf("Search: %s not found\n", arg1);
-                break;
             case 'd':
+            case 'p':
                 if(numTokens != 2)
                     errorParse();
-                res = tfsDelete(arg1);
-                if (!res)
-                  printf("Deleted: %s\n", arg1);
-                else
-                  printf("Unable to delete: %s\n", arg1);
+                addCommand(op, 0, arg1, NULL);
                 break;
             case 'm':
                 if(numTokens != 3)
                     errorParse();
-                res = tfsMove(arg1, arg2);
-                if (!res)
-                  printf("Moved: %s to %s\n", arg1, arg2);
-                else
-                  printf("Unable to move: %s to %s\n", arg1, arg2);
+                addCommand(op, 0, arg1, arg2);
                 break;
-            case 'p':
-                if(numTokens != 2)
+            case 'w':
+                if(numTokens != 3)
                     errorParse();
-                res = tfsPrint(arg1);
-                if (!res)
-                  printf("Printed to: %s\n", arg1);
-                else
-                  printf("Unable to print to: %s\n", arg1);
+                writeFile(arg1, arg2);
                 break;
             case '#':
                 break;
@@ -117,6 +227,8 @@ void *processInput() {
             }
         }
     }
+    flushBatch();
+    free(line);
     fclose(inputFile);
     return NULL;
 }
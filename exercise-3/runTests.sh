@@ -0,0 +1,43 @@
+#!/bin/bash
+
+inputdir=$1
+outputdir=$2
+numthreads=$3
+
+socket=/tmp/tecnicofs-tests.socket
+
+if ! [ -d "$inputdir" ]; then
+    echo "Input directory does not exist."
+    exit 1
+fi
+
+if ! [ -d "$outputdir" ]; then  
+    echo "Output directory does not exist."
+    exit 1
+fi 
+
+if ! [[ "$numthreads" =~ ^[0-9]+$ ]]; then
+    echo "Not positive integer."
+    exit 1
+fi
+
+for input in $(ls $inputdir)
+do
+    for Numthreads in $(seq 1 $numthreads)
+    do 
+        echo InputFile = $input NumThreads = $Numthreads
+        rm -f $socket
+        ./tecnicofs $Numthreads $socket > /dev/null &
+        server=$!
+        sleep 0.2
+
+        ./tecnicofs-client $inputdir/$input $socket > $2/"${input%.*}-${Numthreads}.txt"
+
+        # the server must outlive its clients
+        if ! kill $server 2> /dev/null; then
+            echo "Server died"
+            exit 1
+        fi
+        wait $server 2> /dev/null || true
+    done
+done
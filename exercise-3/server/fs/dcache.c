@@ -0,0 +1,103 @@
+#include <string.h>
+#include "dcache.h"
+#include "state.h"
+
+/*
+ * Cached path. The sequence number is odd while the entry is written, so
+ * readers can tell a changed entry apart, and writers use it to own the
+ * entry (an entry being written by another thread is just not updated).
+ */
+typedef struct dcache_entry {
+    unsigned int seq;
+    unsigned int hash;
+    int length;
+    char path[DCACHE_MAX_PATH];
+    DcacheChain chain;
+} dcache_entry;
+
+static dcache_entry dcache[DCACHE_SIZE];
+
+/*
+ * Looks for a path in the cache.
+ * Input:
+ *  - path: the path (not necessarily terminated)
+ *  - length: length of the path
+ *  - chain: where the directories of the path are stored, the entry is
+ *    only valid while dcache_valid holds for them
+ * Returns: SUCCESS or FAIL if the path is not in the cache
+ */
+int dcache_lookup(char *path, int length, DcacheChain *chain) {
+    unsigned int hash;
+
+    if (length >= DCACHE_MAX_PATH)
+        return FAIL;
+
+    hash = name_hash(path, length);
+    dcache_entry *entry = &dcache[hash & (DCACHE_SIZE - 1)];
+
+    while (1) {
+        unsigned int seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        int match;
+
+        if (seq & 1)
+            return FAIL;
+
+        match = entry->hash == hash && entry->length == length &&
+                memcmp(entry->path, path, length) == 0;
+        if (match)
+            memcpy(chain, &entry->chain, sizeof(DcacheChain));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq)
+            return match ? SUCCESS : FAIL;
+    }
+}
+
+/*
+ * Adds a path to the cache, replacing the path in its slot. The caller
+ * must read the generations of the chain while the path can't be moved
+ * (holding locks on it).
+ * Input:
+ *  - path: the path (not necessarily terminated)
+ *  - length: length of the path
+ *  - chain: the directories of the path
+ */
+void dcache_insert(char *path, int length, DcacheChain *chain) {
+    unsigned int hash, seq;
+
+    if (length >= DCACHE_MAX_PATH || chain->depth > DCACHE_MAX_DEPTH)
+        return;
+
+    hash = name_hash(path, length);
+    dcache_entry *entry = &dcache[hash & (DCACHE_SIZE - 1)];
+
+    seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) || !__atomic_compare_exchange_n(&entry->seq, &seq, seq + 1, 0,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entry->hash = hash;
+    entry->length = length;
+    memcpy(entry->path, path, length);
+    memcpy(&entry->chain, chain, sizeof(DcacheChain));
+
+    __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Checks if the directories of a cached path still have the generations
+ * they had when it was added. A move changes the generation of the
+ * directory before it unlinks it, so when they all match the path was
+ * still there at the time the first one was read.
+ * Input:
+ *  - chain: as stored by dcache_lookup
+ * Returns: 1 if the path still leads to its directory, 0 otherwise
+ */
+int dcache_valid(DcacheChain *chain) {
+    for (int i = 0; i < chain->depth; i++) {
+        if (inode_generation(chain->inumber[i]) != chain->generation[i])
+            return 0;
+    }
+    return 1;
+}
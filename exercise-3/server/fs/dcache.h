@@ -0,0 +1,34 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+/*
+ * Cache of the i-numbers of directory paths, so a path can be resolved with
+ * a single probe instead of a walk from the root.
+ * An entry keeps the directories of the path, from the top down, with the
+ * generation each i-node had (it changes when the i-node is deleted or, for
+ * a directory, moved). It is only valid while all of them keep it: a move
+ * changes the paths of its own subtree only, so it only invalidates the
+ * entries that go through the directory moved.
+ */
+
+/* number of slots (a power of two), each path has a single slot */
+#define DCACHE_SIZE 4096
+/* longest path kept in the cache */
+#define DCACHE_MAX_PATH 120
+/* deepest path kept in the cache */
+#define DCACHE_MAX_DEPTH 16
+
+/*
+ * Directories of a cached path, the last one is the directory of the path.
+ */
+typedef struct dcacheChain {
+    int depth;
+    int inumber[DCACHE_MAX_DEPTH];
+    unsigned int generation[DCACHE_MAX_DEPTH];
+} DcacheChain;
+
+int dcache_lookup(char *path, int length, DcacheChain *chain);
+void dcache_insert(char *path, int length, DcacheChain *chain);
+int dcache_valid(DcacheChain *chain);
+
+#endif /* DCACHE_H */
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "epoch.h"
+
+/*
+ * Object waiting to be reclaimed.
+ */
+typedef struct retired {
+    void (*reclaim)(void *);
+    void *ptr;
+    unsigned long epoch; /* global epoch when it was retired */
+} retired;
+
+/*
+ * State of a thread. The epoch is read by the other threads, the retired
+ * objects are only used by the thread itself.
+ */
+typedef struct epoch_thread {
+    unsigned long epoch; /* epoch seen when entering, 0 outside a read section */
+    int nesting;
+    retired *retired;
+    int count;
+    int capacity;
+} __attribute__((aligned(64))) epoch_thread;
+
+static epoch_thread epoch_threads[EPOCH_MAX_THREADS];
+static int epoch_nthreads = 0;
+/* never 0, which marks a thread outside a read section */
+static unsigned long global_epoch = 1;
+
+static __thread epoch_thread *self = NULL;
+
+/*
+ * Returns the state of the calling thread, registering it on first use.
+ */
+static epoch_thread *epoch_self() {
+    if (self == NULL) {
+        int index = __atomic_fetch_add(&epoch_nthreads, 1, __ATOMIC_ACQ_REL);
+
+        if (index >= EPOCH_MAX_THREADS) {
+            printf("epoch: too many threads\n");
+            exit(EXIT_FAILURE);
+        }
+        self = &epoch_threads[index];
+    }
+    return self;
+}
+
+/*
+ * Starts a read section: nothing retired from now on is reclaimed before
+ * the matching epoch_leave. Read sections can be nested.
+ */
+void epoch_enter() {
+    epoch_thread *thread = epoch_self();
+    unsigned long epoch;
+
+    if (thread->nesting++ > 0)
+        return;
+
+    /* the epoch must be visible before any shared data is read */
+    do {
+        epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&thread->epoch, epoch, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while (epoch != __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Ends a read section.
+ */
+void epoch_leave() {
+    epoch_thread *thread = epoch_self();
+
+    if (--thread->nesting > 0)
+        return;
+
+    __atomic_store_n(&thread->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Moves the global epoch forward, if every thread in a read section has
+ * already seen the current one.
+ */
+static void epoch_advance() {
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    int nthreads = __atomic_load_n(&epoch_nthreads, __ATOMIC_ACQUIRE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < nthreads && i < EPOCH_MAX_THREADS; i++) {
+        unsigned long seen = __atomic_load_n(&epoch_threads[i].epoch, __ATOMIC_ACQUIRE);
+
+        if (seen != 0 && seen != epoch)
+            return;
+    }
+
+    __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/*
+ * Reclaims the objects retired by the calling thread that no reader can
+ * be using anymore.
+ */
+static void epoch_reclaim(epoch_thread *thread) {
+    unsigned long epoch;
+    int kept = 0;
+
+    epoch_advance();
+    epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < thread->count; i++) {
+        if (thread->retired[i].epoch + 2 <= epoch)
+            thread->retired[i].reclaim(thread->retired[i].ptr);
+        else
+            thread->retired[kept++] = thread->retired[i];
+    }
+    thread->count = kept;
+}
+
+/*
+ * Hands an object that was unlinked from the shared data to be reclaimed
+ * once no reader can be using it.
+ * Input:
+ *  - reclaim: function that reclaims the object
+ *  - ptr: the object
+ */
+void epoch_retire(void (*reclaim)(void *), void *ptr) {
+    epoch_thread *thread = epoch_self();
+
+    if (thread->count == thread->capacity) {
+        int capacity = thread->capacity ? thread->capacity * 2 : EPOCH_RECLAIM_THRESHOLD * 2;
+        retired *list = realloc(thread->retired, sizeof(retired) * capacity);
+
+        if (list == NULL) {
+            printf("epoch_retire: failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        thread->retired = list;
+        thread->capacity = capacity;
+    }
+
+    /* the object was unlinked before the epoch is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    thread->retired[thread->count].reclaim = reclaim;
+    thread->retired[thread->count].ptr = ptr;
+    thread->retired[thread->count].epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    thread->count++;
+
+    if (thread->count >= EPOCH_RECLAIM_THRESHOLD)
+        epoch_reclaim(thread);
+}
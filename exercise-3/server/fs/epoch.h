@@ -0,0 +1,23 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+ * Epoch based reclamation, for data that is read without locks.
+ * Readers run between epoch_enter and epoch_leave. Whatever a writer
+ * unlinks while readers may still be using it is handed to epoch_retire,
+ * and only reclaimed once every reader that could have seen it has left:
+ * the global epoch moves on when all the threads inside a read section
+ * have seen the current one, and what was retired in an epoch is
+ * reclaimed two epochs later.
+ */
+
+/* threads that can use the epochs */
+#define EPOCH_MAX_THREADS 1024
+/* retired objects a thread keeps before trying to reclaim them */
+#define EPOCH_RECLAIM_THRESHOLD 64
+
+void epoch_enter();
+void epoch_leave();
+void epoch_retire(void (*reclaim)(void *), void *ptr);
+
+#endif /* EPOCH_H */
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "lockprof.h"
+#include "state.h"
+#include "../../tecnicofs-api-constants.h"
+
+/*
+ * Counters of an i-node, in chunks that follow the chunks of the i-node
+ * table, allocated when an i-node of the chunk is first locked.
+ */
+typedef struct lockStats {
+    unsigned long acquisitions;
+    unsigned long contended;
+    unsigned long busy;
+    unsigned long wait_ns;
+    unsigned long hold_ns;
+} LockStats;
+
+/*
+ * Lock held by the calling thread, until its release.
+ */
+typedef struct heldLock {
+    pthread_rwlock_t *lock;
+    int inumber;
+    LockSite *site;
+    long acquired;
+} HeldLock;
+
+static LockStats *lockprof_chunks[INODE_MAX_CHUNKS];
+/* call sites that took a lock, pushed when they first do */
+static LockSite *lockprof_sites = NULL;
+
+/* an operation holds at most LOCKSVECTOR_SIZE locks */
+static __thread HeldLock held[LOCKSVECTOR_SIZE];
+static __thread int nheld = 0;
+
+#define LOCKPROF_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define LOCKPROF_READ_COUNTER(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+static long lockprof_clock() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/*
+ * Returns the counters of an i-node, allocating their chunk on first use.
+ */
+static LockStats *lockprof_inode(int inumber) {
+    int chunk = inumber >> INODE_CHUNK_SHIFT;
+    LockStats *stats = __atomic_load_n(&lockprof_chunks[chunk], __ATOMIC_ACQUIRE);
+
+    if (stats == NULL) {
+        LockStats *new = calloc(INODE_CHUNK_SIZE, sizeof(LockStats));
+
+        if (new == NULL) {
+            printf("lockprof: failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        /* another thread may have allocated it meanwhile */
+        if (__atomic_compare_exchange_n(&lockprof_chunks[chunk], &stats, new, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            stats = new;
+        else
+            free(new);
+    }
+    return &stats[inumber & (INODE_CHUNK_SIZE - 1)];
+}
+
+/*
+ * Adds a call site to the list of the sites, the first time it locks.
+ */
+static void lockprof_register(LockSite *site) {
+    int registered = 0;
+
+    if (__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE) ||
+        !__atomic_compare_exchange_n(&site->registered, &registered, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+
+    site->next = __atomic_load_n(&lockprof_sites, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&lockprof_sites, &site->next, site, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        ;
+}
+
+/*
+ * Locks an i-node lock, recording if it had to wait and for how long.
+ * Input:
+ *  - lock: the lock
+ *  - inumber: identifier of its i-node
+ *  - flags: LOCKPROF_READ for a read lock, LOCKPROF_TRY to only try it
+ *  - site: the call site (LOCK_SITE)
+ * Returns: the result of the pthread call
+ */
+int lockprof_acquire(pthread_rwlock_t *lock, int inumber, int flags, LockSite *site) {
+    LockStats *stats = lockprof_inode(inumber);
+    int read = flags & LOCKPROF_READ;
+    int res = read ? pthread_rwlock_tryrdlock(lock) : pthread_rwlock_trywrlock(lock);
+    long start = 0, now;
+
+    lockprof_register(site);
+
+    if (res == EBUSY && (flags & LOCKPROF_TRY)) {
+        LOCKPROF_ADD(stats->busy, 1);
+        LOCKPROF_ADD(site->busy, 1);
+        return res;
+    }
+
+    /* only the acquisitions that found the lock taken are timed */
+    if (res == EBUSY) {
+        start = lockprof_clock();
+        res = read ? pthread_rwlock_rdlock(lock) : pthread_rwlock_wrlock(lock);
+    }
+
+    if (res != 0)
+        return res;
+
+    now = lockprof_clock();
+    LOCKPROF_ADD(stats->acquisitions, 1);
+    LOCKPROF_ADD(site->acquisitions, 1);
+    if (start != 0) {
+        LOCKPROF_ADD(stats->contended, 1);
+        LOCKPROF_ADD(stats->wait_ns, now - start);
+        LOCKPROF_ADD(site->contended, 1);
+        LOCKPROF_ADD(site->wait_ns, now - start);
+    }
+
+    if (nheld < LOCKSVECTOR_SIZE)
+        held[nheld++] = (HeldLock) { lock, inumber, site, now };
+
+    return res;
+}
+
+/*
+ * Unlocks an i-node lock, recording how long it was held.
+ * Input:
+ *  - lock: the lock
+ *  - inumber: identifier of its i-node
+ * Returns: the result of the pthread call
+ */
+int lockprof_release(pthread_rwlock_t *lock, int inumber) {
+    long now = lockprof_clock();
+
+    for (int i = nheld - 1; i >= 0; i--) {
+        if (held[i].lock == lock) {
+            LOCKPROF_ADD(lockprof_inode(inumber)->hold_ns, now - held[i].acquired);
+            LOCKPROF_ADD(held[i].site->hold_ns, now - held[i].acquired);
+            held[i] = held[--nheld];
+            break;
+        }
+    }
+
+    return pthread_rwlock_unlock(lock);
+}
+
+/* appends to the buffer, as much as fits */
+#define LOCKPROF_PRINT(...) \
+    (length += snprintf(buffer + length, length < size ? size - length : 0, __VA_ARGS__))
+
+/*
+ * Writes the i-nodes and the call sites that waited the longest for their
+ * locks, LOCKPROF_TOP of each.
+ * Input:
+ *  - buffer: where the report is written
+ *  - size: room in the buffer
+ *  - format: TFS_STATS_TEXT or TFS_STATS_JSON (an object)
+ * Returns: length of the report, even if it didn't fit
+ */
+int lockprof_report(char *buffer, int size, int format) {
+    int inodes[LOCKPROF_TOP], ninodes = 0, nsites = 0, length = 0;
+    LockStats top[LOCKPROF_TOP];
+    LockSite *sites[LOCKPROF_TOP];
+
+    /* the top i-nodes, by time waited and then by acquisitions */
+    for (int chunk = 0; chunk < INODE_MAX_CHUNKS; chunk++) {
+        LockStats *stats = __atomic_load_n(&lockprof_chunks[chunk], __ATOMIC_ACQUIRE);
+
+        if (stats == NULL)
+            continue;
+
+        for (int i = 0; i < INODE_CHUNK_SIZE; i++) {
+            LockStats s = {
+                LOCKPROF_READ_COUNTER(stats[i].acquisitions), LOCKPROF_READ_COUNTER(stats[i].contended),
+                LOCKPROF_READ_COUNTER(stats[i].busy), LOCKPROF_READ_COUNTER(stats[i].wait_ns),
+                LOCKPROF_READ_COUNTER(stats[i].hold_ns)
+            };
+            int j;
+
+            if (s.acquisitions == 0 && s.busy == 0)
+                continue;
+
+            for (j = ninodes; j > 0 && (s.wait_ns > top[j - 1].wait_ns ||
+                 (s.wait_ns == top[j - 1].wait_ns && s.acquisitions > top[j - 1].acquisitions)); j--) {
+                if (j < LOCKPROF_TOP) {
+                    top[j] = top[j - 1];
+                    inodes[j] = inodes[j - 1];
+                }
+            }
+            if (j < LOCKPROF_TOP) {
+                top[j] = s;
+                inodes[j] = (chunk << INODE_CHUNK_SHIFT) + i;
+                if (ninodes < LOCKPROF_TOP)
+                    ninodes++;
+            }
+        }
+    }
+
+    for (LockSite *site = __atomic_load_n(&lockprof_sites, __ATOMIC_ACQUIRE); site != NULL; site = site->next) {
+        unsigned long wait = LOCKPROF_READ_COUNTER(site->wait_ns), hold = LOCKPROF_READ_COUNTER(site->hold_ns);
+        int j;
+
+        /* by time waited and then by time held */
+        for (j = nsites; j > 0 && (wait > LOCKPROF_READ_COUNTER(sites[j - 1]->wait_ns) ||
+             (wait == LOCKPROF_READ_COUNTER(sites[j - 1]->wait_ns) &&
+              hold > LOCKPROF_READ_COUNTER(sites[j - 1]->hold_ns))); j--)
+            if (j < LOCKPROF_TOP)
+                sites[j] = sites[j - 1];
+        if (j < LOCKPROF_TOP) {
+            sites[j] = site;
+            if (nsites < LOCKPROF_TOP)
+                nsites++;
+        }
+    }
+
+    if (format == TFS_STATS_JSON) {
+        LOCKPROF_PRINT("{\"inodes\":[");
+        for (int i = 0; i < ninodes; i++)
+            LOCKPROF_PRINT("%s{\"inumber\":%d,\"acquisitions\":%lu,\"contended\":%lu,\"busy\":%lu,"
+                           "\"wait_ns\":%lu,\"hold_ns\":%lu}", i ? "," : "", inodes[i], top[i].acquisitions,
+                           top[i].contended, top[i].busy, top[i].wait_ns, top[i].hold_ns);
+        LOCKPROF_PRINT("],\"sites\":[");
+        for (int i = 0; i < nsites; i++)
+            LOCKPROF_PRINT("%s{\"function\":\"%s\",\"line\":%d,\"acquisitions\":%lu,\"contended\":%lu,"
+                           "\"busy\":%lu,\"wait_ns\":%lu,\"hold_ns\":%lu}", i ? "," : "", sites[i]->function,
+                           sites[i]->line, sites[i]->acquisitions, sites[i]->contended, sites[i]->busy,
+                           sites[i]->wait_ns, sites[i]->hold_ns);
+        LOCKPROF_PRINT("]}");
+        return length;
+    }
+
+    LOCKPROF_PRINT("locks, the i-nodes that waited the longest:\n");
+    LOCKPROF_PRINT("%-8s %10s %10s %10s %10s %12s %10s %12s\n", "i-node", "acquired", "contended",
+                   "busy", "wait ms", "mean wait us", "hold ms", "mean hold us");
+    for (int i = 0; i < ninodes; i++) {
+        char name[16];
+
+        snprintf(name, sizeof(name), inodes[i] == FS_ROOT ? "%d (root)" : "%d", inodes[i]);
+        LOCKPROF_PRINT("%-8s %10lu %10lu %10lu %10.3f %12.2f %10.3f %12.2f\n", name, top[i].acquisitions,
+                       top[i].contended, top[i].busy, top[i].wait_ns / 1e6,
+                       top[i].contended ? top[i].wait_ns / 1e3 / top[i].contended : 0.0, top[i].hold_ns / 1e6,
+                       top[i].acquisitions ? top[i].hold_ns / 1e3 / top[i].acquisitions : 0.0);
+    }
+
+    LOCKPROF_PRINT("locks, the call sites that waited the longest:\n");
+    LOCKPROF_PRINT("%-28s %10s %10s %10s %10s %10s\n", "site", "acquired", "contended", "busy",
+                   "wait ms", "hold ms");
+    for (int i = 0; i < nsites; i++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "%s:%d", sites[i]->function, sites[i]->line);
+        LOCKPROF_PRINT("%-28s %10lu %10lu %10lu %10.3f %10.3f\n", name, sites[i]->acquisitions,
+                       sites[i]->contended, sites[i]->busy, sites[i]->wait_ns / 1e6, sites[i]->hold_ns / 1e6);
+    }
+
+    return length;
+}
@@ -0,0 +1,63 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+
+/*
+ * Lock contention profiler of the i-node locks, only compiled in with
+ * LOCK_PROFILE (make tecnicofs-profile). Each acquisition records if it
+ * had to wait, how long, and how long the lock was then held, both for the
+ * i-node and for the call site that took the lock (see LOCK_SITE).
+ * Without LOCK_PROFILE the lockprof_* calls are the plain pthread ones.
+ */
+
+/* i-nodes and call sites in the report */
+#define LOCKPROF_TOP 10
+
+/*
+ * Counters of a call site, kept next to the code that takes the lock.
+ */
+typedef struct lockSite {
+    const char *function;
+    int line;
+    int registered;
+    unsigned long acquisitions;
+    unsigned long contended;    /* acquisitions that had to wait */
+    unsigned long busy;         /* tries that failed */
+    unsigned long wait_ns;
+    unsigned long hold_ns;
+    struct lockSite *next;
+} LockSite;
+
+#ifdef LOCK_PROFILE
+
+#define LOCKPROF_READ 1
+#define LOCKPROF_TRY 2
+
+/* the call site of a lock, a static LockSite where the macro is expanded */
+#define LOCK_SITE ({ static LockSite site = { __func__, __LINE__ }; &site; })
+
+#define lockprof_rdlock(lock, inumber, site) lockprof_acquire(lock, inumber, LOCKPROF_READ, site)
+#define lockprof_wrlock(lock, inumber, site) lockprof_acquire(lock, inumber, 0, site)
+#define lockprof_tryrdlock(lock, inumber, site) \
+    lockprof_acquire(lock, inumber, LOCKPROF_READ | LOCKPROF_TRY, site)
+#define lockprof_trywrlock(lock, inumber, site) lockprof_acquire(lock, inumber, LOCKPROF_TRY, site)
+#define lockprof_unlock(lock, inumber) lockprof_release(lock, inumber)
+
+int lockprof_acquire(pthread_rwlock_t *lock, int inumber, int flags, LockSite *site);
+int lockprof_release(pthread_rwlock_t *lock, int inumber);
+int lockprof_report(char *buffer, int size, int format);
+
+#else
+
+#define LOCK_SITE NULL
+
+#define lockprof_rdlock(lock, inumber, site) pthread_rwlock_rdlock(lock)
+#define lockprof_wrlock(lock, inumber, site) pthread_rwlock_wrlock(lock)
+#define lockprof_tryrdlock(lock, inumber, site) pthread_rwlock_tryrdlock(lock)
+#define lockprof_trywrlock(lock, inumber, site) pthread_rwlock_trywrlock(lock)
+#define lockprof_unlock(lock, inumber) pthread_rwlock_unlock(lock)
+
+#endif /* LOCK_PROFILE */
+
+#endif /* LOCKPROF_H */
@@ -6,14 +6,16 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <arpa/inet.h>
+#include <sched.h>
+#include <errno.h>
 #include "operations.h"
 #include "../../tecnicofs-api-constants.h"
 
-extern inode_t inode_table[INODE_TABLE_SIZE];
-extern pthread_mutex_t mutex;
 extern int numberThreads;
 
 int sockfd;
+/* listening socket of the sessions */
+int sessionfd;
 struct sockaddr_un server_addr;
 socklen_t addrlen;
 char *path;
@@ -32,14 +34,25 @@ int setSockAddrUn(char *path, struct sockaddr_un *addr) {
 }
 
 /*
- * Given a path, mounts the socket and binds it to the
- * server address.
+ * Given a path, mounts the sockets and binds them to the server
+ * addresses: a datagram socket in the path and a socket for sessions
+ * (connections) in the path with TFS_SESSION_SUFFIX.
  * Input:
  * 	- sockPath: the server address path
  * Returns: SUCESS or exits with failure
  */
 int tfsMount(char *sockPath) {
 
+	char sessionPath[strlen(sockPath) + sizeof(TFS_SESSION_SUFFIX)];
+	struct sockaddr_un session_addr;
+
+	sprintf(sessionPath, "%s%s", sockPath, TFS_SESSION_SUFFIX);
+
+	if (strlen(sessionPath) >= sizeof(server_addr.sun_path)) {
+		fprintf(stderr, "server: socket path too long\n");
+		exit(EXIT_FAILURE);
+	}
+
 	if ((sockfd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
     	perror("server: can't open socket");
         exit(EXIT_FAILURE);
@@ -55,47 +68,27 @@ int tfsMount(char *sockPath) {
 		perror("server: bind error");
 		exit(EXIT_FAILURE);
 	}
-	
-	return SUCCESS;
-}
 
-/* Given a path, fills pointers with strings for the parent path and child
- * file name
- * Input:
- *  - path: the path to split. ATENTION: the function may alter this parameter
- *  - parent: reference to a char*, to store parent path
- *  - child: reference to a char*, to store child file name
- */
-void split_parent_child_from_path(char * path, char ** parent, char ** child) {
-
-	int n_slashes = 0, last_slash_location = 0;
-	int len = strlen(path);
-
-	// deal with trailing slash ( a/x vs a/x/ )
-	if (path[len-1] == '/') {
-		path[len-1] = '\0';
+	if ((sessionfd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) {
+		perror("server: can't open session socket");
+		exit(EXIT_FAILURE);
 	}
 
-	for (int i=0; i < len; ++i) {
-		if (path[i] == '/' && path[i+1] != '\0') {
-			last_slash_location = i;
-			n_slashes++;
-		}
-	}
+	unlink(sessionPath);
 
-	if (n_slashes == 0) { // root directory
-		*parent = "";
-		*child = path;
-		return;
+	if (bind(sessionfd, (struct sockaddr *) &session_addr, setSockAddrUn(sessionPath, &session_addr)) < 0) {
+		perror("server: bind error");
+		exit(EXIT_FAILURE);
 	}
 
-	path[last_slash_location] = '\0';
-	*parent = path;
-	*child = path + last_slash_location + 1;
-
+	if (listen(sessionfd, SOMAXCONN) < 0) {
+		perror("server: listen error");
+		exit(EXIT_FAILURE);
+	}
+	
+	return SUCCESS;
 }
 
-
 /*
  * Initializes tecnicofs and creates root node.
  */
@@ -119,22 +112,146 @@ void destroy_fs() {
 	inode_table_destroy();
 }
 
+/*
+ * Marks every position of the locks vector as empty.
+ * Input:
+ *  - locks_vector: vector of locks held by the operation
+ */
+void init_locks_vector(int locks_vector[]){
+	for (int i = 0; i < LOCKSVECTOR_SIZE; i++){
+		locks_vector[i] = EMPTY;
+	}
+}
+
+/*
+ * Checks if the operation already holds the lock of an inode.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - locks_vector: vector of locks held by the operation
+ * Returns: 1 if the lock is held, 0 otherwise
+ */
+int in_locksvector(int inumber, int locks_vector[]){
+
+	for (int i = 0; i < LOCKSVECTOR_SIZE && locks_vector[i] != EMPTY; i++){
+		if (locks_vector[i] == inumber)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Adds a lock to the lock vector
+ */
+void add_locksvector(int inumber, int locks_vector[]){
+
+	for (int i = 0; i < LOCKSVECTOR_SIZE; i++){
+		if (locks_vector[i] == EMPTY){
+			locks_vector[i] = inumber;
+			return;
+		}
+	}
+
+	printf("Error: locks vector is full\n");
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Unlocks all locks in the lock vector (in the reverse order they were taken)
+ * and leaves the vector empty.
+ */
+void unlock_locksvector(int locks_vector[]){
+
+	int i;
+
+	for (i = 0; i < LOCKSVECTOR_SIZE && locks_vector[i] != EMPTY; i++);
+
+	while (--i >= 0){
+		if (lockprof_unlock(&inode_ref(locks_vector[i])->rwlock, locks_vector[i]) != SUCCESS){
+			printf("lock failed to unlock.\n"); 
+			exit(EXIT_FAILURE);
+		}
+		locks_vector[i] = EMPTY;
+	}
+}
+
+/*
+ * Unlocks an i-node and removes it from the locks vector.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - locks_vector: vector of locks held by the operation
+ */
+void unlock_inode(int inumber, int locks_vector[]){
+
+	int i;
+
+	for (i = 0; i < LOCKSVECTOR_SIZE && locks_vector[i] != inumber; i++);
+
+	if (i == LOCKSVECTOR_SIZE)
+		return;
+
+	if (lockprof_unlock(&inode_ref(inumber)->rwlock, inumber) != SUCCESS){
+		printf("lock failed to unlock.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (; i < LOCKSVECTOR_SIZE - 1 && locks_vector[i] != EMPTY; i++)
+		locks_vector[i] = locks_vector[i + 1];
+	locks_vector[i] = EMPTY;
+}
+
+/*
+ * Locks an i-node and registers it in the locks vector. If the operation
+ * already holds the lock nothing is done.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - rwlocktype: READONLY or READWRITE
+ *  - locks_vector: vector of locks held by the operation
+ *  - try: if set, the lock is only taken if it is immediately available
+ *  - site: call site, for the lock profiler (LOCK_SITE, see lock_inode)
+ * Returns:
+ *  SUCCESS: if the lock is held by the operation
+ *     BUSY: if try was set and the lock is held by another thread
+ *     FAIL: if the lock failed
+ */
+int lock_inode_at(int inumber, int rwlocktype, int locks_vector[], int try, LockSite *site){
+
+	pthread_rwlock_t *lock = &inode_ref(inumber)->rwlock;
+	int res;
+
+	if (in_locksvector(inumber, locks_vector))
+		return SUCCESS;
+
+	if (rwlocktype == READONLY)
+		res = try ? lockprof_tryrdlock(lock, inumber, site)
+		          : lockprof_rdlock(lock, inumber, site);
+	else
+		res = try ? lockprof_trywrlock(lock, inumber, site)
+		          : lockprof_wrlock(lock, inumber, site);
+
+	if (res == SUCCESS){
+		add_locksvector(inumber, locks_vector);
+		return SUCCESS;
+	}
+
+	if (try && res == EBUSY)
+		return BUSY;
+
+	printf("Error: rwlock in inode number %d failed to lock (%s)\n", inumber,
+	       rwlocktype == READONLY ? "rdlock" : "wrlock");
+	return FAIL;
+}
+
 /*
  * Checks if content of directory is not empty.
  * Input:
- *  - entries: entries of directory
+ *  - dir: the directory
  * Returns: SUCCESS or FAIL
  */
 
-int is_dir_empty(DirEntry *dirEntries) {
-	if (dirEntries == NULL) {
+int is_dir_empty(Directory *dir) {
+	if (dir == NULL || dir->count != 0) {
 		return FAIL;
 	}
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-		if (dirEntries[i].inumber != FREE_INODE) {
-			return FAIL;
-		}
-	}
 	return SUCCESS;
 }
 
@@ -142,22 +259,17 @@ int is_dir_empty(DirEntry *dirEntries) {
 /*
  * Looks for node in directory entry from name.
  * Input:
- *  - name: path of node
- *  - entries: entries of directory
+ *  - component: name of node, a component of a parsed path
+ *  - dir: the directory
  * Returns:
  *  - inumber: found node's inumber
  *  - FAIL: if not found
  */
-int lookup_sub_node(char *name, DirEntry *entries) {
-	if (entries == NULL) {
+int lookup_sub_node(PathComponent *component, Directory *dir) {
+	if (dir == NULL) {
 		return FAIL;
 	}
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (entries[i].inumber != FREE_INODE && strcmp(entries[i].name, name) == 0) {
-            return entries[i].inumber;
-        }
-    }
-	return FAIL;
+	return dir_lookup(dir, component->name, component->length, component->hash);
 }
 
 /*
@@ -165,56 +277,78 @@ int lookup_sub_node(char *name, DirEntry *entries) {
  * Input:
  *  - name: path of node
  *  - nodeType: type of node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS or a TECNICOFS_ERROR_* code
  */
 int create(char *name, type nodeType){
 
-	int parent_inumber, child_inumber;
-	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+	int parent_inumber, child_inumber, parent_length;
+	PathComponent *child;
+	Path path;
 	/* use for copy */
 	type pType;
 	union Data pdata;
+	int locks_vector[LOCKSVECTOR_SIZE];
+	init_locks_vector(locks_vector);
 
-	strcpy(name_copy, name);
-	split_parent_child_from_path(name_copy, &parent_name, &child_name);
+	if (path_parse(name, &path) == FAIL || path.depth == 0) {
+		printf("failed to create %s, invalid path\n", name);
+		return TECNICOFS_ERROR_INVALID_PATH;
+	}
+
+	parent_length = path_prefix_length(&path, path.depth - 1);
+	child = &path.components[path.depth - 1];
 
-	parent_inumber = lookup(parent_name);
+	parent_inumber = lookup_path(&path, path.depth - 1, locks_vector, MODIFY);
 
 	if (parent_inumber == FAIL) {
-		printf("failed to create %s, invalid parent dir %s\n",
-		        name, parent_name);
-		return FAIL;
+		printf("failed to create %s, invalid parent dir %.*s\n",
+		        name, parent_length, name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
 	}
 
 	inode_get(parent_inumber, &pType, &pdata);
 
 	if(pType != T_DIRECTORY) {
-		printf("failed to create %s, parent %s is not a dir\n",
-		        name, parent_name);
-		return FAIL;
+		printf("failed to create %s, parent %.*s is not a dir\n",
+		        name, parent_length, name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_NOT_A_DIRECTORY;
 	}
 
-	if (lookup_sub_node(child_name, pdata.dirEntries) != FAIL) {
-		printf("failed to create %s, already exists in dir %s\n",
-		       child_name, parent_name);
-		return FAIL;
+	if (lookup_sub_node(child, pdata.dir) != FAIL) {
+		printf("failed to create %s, already exists in dir %.*s\n",
+		       name, parent_length, name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_FILE_ALREADY_EXISTS;
 	}
 
 	/* create node and add entry to folder that contains new node */
 	child_inumber = inode_create(nodeType);
 
 	if (child_inumber == FAIL) {
-		printf("failed to create %s in  %s, couldn't allocate inode\n",
-		        child_name, parent_name);
-		return FAIL;
+		printf("failed to create %s, couldn't allocate inode\n", name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_NO_SPACE;
 	}
 
-	if (dir_add_entry(parent_inumber, child_inumber, child_name) == FAIL) {
-		printf("could not add entry %s in dir %s\n",
-		       child_name, parent_name);
-		return FAIL;
+	/* the new node is not reachable yet, but its inumber may have just been
+	released by a delete that still holds the lock */
+	if (lock_inode(child_inumber, READWRITE, locks_vector, 0) == FAIL) {
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_OTHER;
 	}
 
+	if (dir_add_entry(parent_inumber, child_inumber, child->name, child->length, child->hash) == FAIL) {
+		printf("could not add entry %s in dir %.*s\n",
+		       name, parent_length, name);
+		inode_delete(child_inumber);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_NO_SPACE;
+	}
+
+	/* unlock all the locks */
+	unlock_locksvector(locks_vector);
 
 	return SUCCESS;
 }
@@ -224,270 +358,592 @@ int create(char *name, type nodeType){
  * Deletes a node given a path.
  * Input:
  *  - name: path of node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS or a TECNICOFS_ERROR_* code
  */
 int delete(char *name){
 
-	int parent_inumber, child_inumber;
-	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+	int parent_inumber, child_inumber, parent_length;
+	PathComponent *child;
+	Path path;
 	/* use for copy */
 	type pType, cType;
 	union Data pdata, cdata;
+	int locks_vector[LOCKSVECTOR_SIZE];
+	init_locks_vector(locks_vector);
 
-	strcpy(name_copy, name);
-	split_parent_child_from_path(name_copy, &parent_name, &child_name);
+	if (path_parse(name, &path) == FAIL) {
+		printf("failed to delete %s, invalid path\n", name);
+		return TECNICOFS_ERROR_INVALID_PATH;
+	}
 
-	parent_inumber = lookup(parent_name);
+	/* the root itself */
+	if (path.depth == 0) {
+		printf("could not delete %s, does not exist\n", name);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
+	}
+
+	parent_length = path_prefix_length(&path, path.depth - 1);
+	child = &path.components[path.depth - 1];
+
+	parent_inumber = lookup_path(&path, path.depth - 1, locks_vector, MODIFY);
 
 	if (parent_inumber == FAIL) {
-		printf("failed to delete %s, invalid parent dir %s\n",
-		        child_name, parent_name);
-		return FAIL;
+		printf("failed to delete %s, invalid parent dir %.*s\n",
+		        name, parent_length, name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
 	}
 
 	inode_get(parent_inumber, &pType, &pdata);
 
 	if(pType != T_DIRECTORY) {
-		printf("failed to delete %s, parent %s is not a dir\n",
-		        child_name, parent_name);
-		return FAIL;
+		printf("failed to delete %s, parent %.*s is not a dir\n",
+		        name, parent_length, name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_NOT_A_DIRECTORY;
 	}
 
-	child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
+	child_inumber = lookup_sub_node(child, pdata.dir);
 
 	if (child_inumber == FAIL) {
-		printf("could not delete %s, does not exist in dir %s\n",
-		       name, parent_name);
-		return FAIL;
+		printf("could not delete %s, does not exist in dir %.*s\n",
+		       name, parent_length, name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
+	}
+
+	/* lock child inode */
+	if (lock_inode(child_inumber, READWRITE, locks_vector, 0) == FAIL) {
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_OTHER;
 	}
 
 	inode_get(child_inumber, &cType, &cdata);
 
-	if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
+	if (cType == T_DIRECTORY && is_dir_empty(cdata.dir) == FAIL) {
 		printf("could not delete %s: is a directory and not empty\n",
 		       name);
-		return FAIL;
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_DIRECTORY_NOT_EMPTY;
+	}
+
+	if (cType == T_FILE && inode_is_open(child_inumber)) {
+		printf("could not delete %s: file is open\n", name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_FILE_IS_OPEN;
 	}
 
 	/* remove entry from folder that contained deleted node */
-	if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
-		printf("failed to delete %s from dir %s\n",
-		       child_name, parent_name);
-		return FAIL;
+	if (dir_reset_entry(parent_inumber, child_inumber, child->name, child->length, child->hash) == FAIL) {
+		printf("failed to delete %s from dir %.*s\n",
+		       name, parent_length, name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_OTHER;
 	}
 
 	if (inode_delete(child_inumber) == FAIL) {
-		printf("could not delete inode number %d from dir %s\n",
-		       child_inumber, parent_name);
-		return FAIL;
+		printf("could not delete inode number %d from dir %.*s\n",
+		       child_inumber, parent_length, name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_OTHER;
 	}
 
+	/* unlock all the locks */
+	unlock_locksvector(locks_vector);
+
 	return SUCCESS;
 }
 
 
 /*
- * Lookup for a given path.
+ * Lookup for the first components of a path without taking any lock (FIND
+ * mode of lookup). Directories changed meanwhile are still safe to read,
+ * they are only released once the lookup leaves its read section. When the
+ * parent directory is cached only the last component is looked for.
  * Input:
- *  - name: path of node
+ *  - path: the parsed path
+ *  - depth: number of components to follow
  * Returns:
  *  inumber: identifier of the i-node, if found
  *     FAIL: otherwise
  */
-int lookup(char *name){
-	char full_path[MAX_FILE_NAME];
-	char delim[] = "/";
-	char *saveptr;
+int lookup_unlocked(Path *path, int depth) {
+	int current_inumber = FS_ROOT;
+	DcacheChain chain;
+	Directory *dir;
+
+	epoch_enter();
+
+	if (depth > 1 &&
+	    dcache_lookup(path->name, path_prefix_length(path, depth - 1), &chain) == SUCCESS &&
+	    (dir = inode_dir(chain.inumber[chain.depth - 1])) != NULL &&
+	    dcache_valid(&chain)) {
+		current_inumber = lookup_sub_node(&path->components[depth - 1], dir);
+		epoch_leave();
+		return current_inumber;
+	}
 
-	strcpy(full_path, name);
+	current_inumber = FS_ROOT;
 
+	for (int i = 0; i < depth && current_inumber != FAIL; i++)
+		current_inumber = lookup_sub_node(&path->components[i], inode_dir(current_inumber));
+
+	epoch_leave();
+
+	return current_inumber;
+}
+
+/*
+ * Locks a directory found in the cache (MODIFY mode of lookup). Only the
+ * root is read locked besides the directory itself (print waits for the
+ * operations that hold it). The directories above it are not locked, so
+ * they may be moved meanwhile: the path is checked once the directory is
+ * locked, and the operation takes place as if it came before the move.
+ * Input:
+ *  - path: the parsed path
+ *  - depth: number of components of the path of the directory (at least 1)
+ *  - locks_vector: vector of locks held by the operation
+ * Returns:
+ *  inumber: identifier of the directory, if cached
+ *     FAIL: otherwise, with nothing locked but the root
+ */
+int lookup_cached(Path *path, int depth, int locks_vector[]) {
+	int inumber, held;
+	DcacheChain chain;
+
+	if (lock_inode(FS_ROOT, READONLY, locks_vector, 0) != SUCCESS)
+		return FAIL;
+
+	if (dcache_lookup(path->name, path_prefix_length(path, depth), &chain) == FAIL)
+		return FAIL;
+
+	inumber = chain.inumber[chain.depth - 1];
+	held = in_locksvector(inumber, locks_vector);
+	if (lock_inode(inumber, READWRITE, locks_vector, 0) != SUCCESS)
+		return FAIL;
+
+	/* deleted or moved meanwhile: the ancestors skipped must be locked after all */
+	if (!dcache_valid(&chain)) {
+		if (!held)
+			unlock_inode(inumber, locks_vector);
+		return FAIL;
+	}
+
+	return inumber;
+}
+
+/*
+ * Lookup for the first components of a parsed path, so the parent of a
+ * node is found without copying its path.
+ * Locks are always taken from the root down, so two lookups can never wait
+ * for each other in a cycle. The mode selects how they are held:
+ *  - FIND: no locks at all, the directories are read inside a read section
+ *          (see epoch.h) and the result may already be out of date when
+ *          it is returned.
+ *  - MODIFY: every ancestor stays read locked and the last node is write
+ *          locked, so no other operation can change the path until the
+ *          caller releases the locks vector. A directory in the cache (see
+ *          dcache.h) only needs the root locked, and the directories found
+ *          are added to it.
+ *  - MOVE: as MODIFY, but always from the root, so the directories moved
+ *          by other moves are locked along the path (see move).
+ *  - MOVE_TRY: as MOVE, but the locks are only tried, and BUSY is returned
+ *          if one of them is held.
+ * Locks already held by the operation (in the locks vector) are reused.
+ * Input:
+ *  - path: the parsed path
+ *  - depth: number of components to follow (0 is the root)
+ *  - locks_vector: vector of locks held by the operation
+ *  - mode: FIND, MODIFY, MOVE or MOVE_TRY
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ */
+int lookup_path(Path *path, int depth, int locks_vector[], int mode){
 	/* start at root node */
 	int current_inumber = FS_ROOT;
+	int try = (mode == MOVE_TRY);
+	int res;
+	DcacheChain chain;
 
 	/* use for copy */
 	type nType;
 	union Data data;
 
+	if (mode == FIND)
+		return lookup_unlocked(path, depth);
+
+	if (mode == MODIFY && depth > 0 && (res = lookup_cached(path, depth, locks_vector)) != FAIL)
+		return res;
+
+	/* the root is the last node of the path when the path is empty (only
+	happens when creating/deleting files/directories in the root) */
+	res = lock_inode(current_inumber, depth == 0 ? READWRITE : READONLY,
+	                 locks_vector, try);
+	if (res != SUCCESS)
+		return res;
+
 	/* get root inode data */
 	inode_get(current_inumber, &nType, &data);
 
-	char *path = strtok_r(full_path, delim, &saveptr);
+	chain.depth = 0;
 
 	/* search for all sub nodes */
-	while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
-		
+	for (int i = 0; i < depth; i++) {
+
+		/* a file has no entries, its data is not a directory */
+		if (nType != T_DIRECTORY) {
+			current_inumber = FAIL;
+			break;
+		}
+
+		if ((current_inumber = lookup_sub_node(&path->components[i], data.dir)) == FAIL)
+			break;
+
+		res = lock_inode(current_inumber, i == depth - 1 ? READWRITE : READONLY,
+		                 locks_vector, try);
+		if (res != SUCCESS)
+			return res;
+
 		inode_get(current_inumber, &nType, &data);
-		path = strtok_r(NULL, delim, &saveptr);
 
+		if (i < DCACHE_MAX_DEPTH) {
+			chain.inumber[i] = current_inumber;
+			chain.generation[i] = inode_generation(current_inumber);
+		}
+		chain.depth++;
 	}
 
+	/* the path is locked, it can't be moved while it is cached */
+	if (current_inumber != FS_ROOT && current_inumber != FAIL && nType == T_DIRECTORY)
+		dcache_insert(path->name, path_prefix_length(path, depth), &chain);
+
 	return current_inumber;
-	
 }
 
 /*
- * Lookup for a parent and child inumber
+ * Lookup for a given path.
  * Input:
- *  - name: path of node 
+ *  - name: path of node
+ *  - locks_vector: vector of locks held by the operation
+ *  - mode: FIND or MODIFY (see lookup_path)
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ */
+int lookup(char *name, int locks_vector[], int mode){
+	Path path;
+
+	/* too deep or a name too long, it can't exist */
+	if (path_parse(name, &path) == FAIL)
+		return FAIL;
+
+	return lookup_path(&path, path.depth, locks_vector, mode);
+}
+
+/*
+ * Lookup for a parent and child inumber, used by move. The parent is write
+ * locked and so is the child, if it exists.
+ * Input:
+ *  - name: path of node being moved
  *  - locks_vector: vector of locks in use
- * 	- parent_name: path of parent node
- * 	- child_name: path of child node
+ * 	- path: the parsed path to look for
  * 	- parent_inumber: parent inumber
  * 	- child_inumber: child inumber
- * Returns: 
- *     SUCESS: 
+ *  - mode: MOVE to wait for the locks, MOVE_TRY to only try them
+ * Returns:
+ *     SUCESS:
  *     FAIL: if parent dir does not exist or any of the locks fail
+ *     TECNICOFS_ERROR_NOT_A_DIRECTORY: if the parent is not a dir
+ *     BUSY: if in MOVE_TRY mode a lock could not be taken
  */
-int parent_and_child_inumber(char* name, char* parent_name, char* child_name, int* parent_inumber, int* child_inumber){
+int parent_and_child_inumber(char* name, int locks_vector[], Path *path,
+                int* parent_inumber, int* child_inumber, int mode){
 
 	type pType;
 	union Data pdata;
+	int parent_length = path_prefix_length(path, path->depth - 1);
 
-	*parent_inumber = lookup(parent_name);
+	*parent_inumber = lookup_path(path, path->depth - 1, locks_vector, mode);
+
+	if (*parent_inumber == BUSY)
+		return BUSY;
 
 	if (*parent_inumber == FAIL) {
-		printf("failed to move %s, invalid parent dir %s\n",
-		        name, parent_name);
+		printf("failed to move %s, invalid parent dir %.*s\n",
+		        name, parent_length, path->name);
 		return FAIL;
 	}
 
 	inode_get(*parent_inumber, &pType, &pdata);
 
 	if(pType != T_DIRECTORY ) {
-		printf("failed to move %s, parent %s is not a dir\n",
-		        name, parent_name);
-		return FAIL;
+		printf("failed to move %s, parent %.*s is not a dir\n",
+		        name, parent_length, path->name);
+		return TECNICOFS_ERROR_NOT_A_DIRECTORY;
 	}
 
-	*child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
+	*child_inumber = lookup_sub_node(&path->components[path->depth - 1], pdata.dir);
+
+	/* the child is below the parent, so it keeps the locks in tree order */
+	if (*child_inumber != FAIL)
+		return lock_inode(*child_inumber, READWRITE, locks_vector, mode == MOVE_TRY);
 
 	return SUCCESS;
 
 }
 
 /*
- * Size of path
+ * Moves a file or directory
+ * The path with the shallowest parent is locked first, waiting for the locks
+ * in tree order, so its parent can never be an ancestor of the other parent
+ * (which would need a lock upgrade). The second path is not in tree order
+ * with the first one, so its locks are only tried: if any of them is busy
+ * every lock is released and the move starts over after a short random
+ * backoff. A move never waits while holding locks out of order, which
+ * keeps it free of deadlocks with any other operation.
+ * Both paths are looked for from the root, never in the cache (see
+ * dcache.h): every directory along them stays locked, so another move can't
+ * put the destination below the node moved meanwhile. Moving a directory
+ * changes its generation, which invalidates the cached paths through it.
  * Input:
  *  - name: path of node
- * Returns: 
- *     length: length of the path
+ *  - newname: new path of the node
+ * Returns: SUCCESS or a TECNICOFS_ERROR_* code
  */
-int path_length(char* name){
-	char namecopy[MAX_FILE_NAME];
-	char delim[] = "/";
-	char *saveptr;
+int move(char* name, char* newname){
+
+	int parent_inumber_name, child_inumber_name;
+	int parent_inumber_newname, child_inumber_newname;
+	PathComponent *child, *new_child;
+	Path path, new_path;
+	int res, attempts = 0;
+	unsigned int seed = (unsigned int) pthread_self();
+	type cType;
+
+	int locks_vector[LOCKSVECTOR_SIZE];
+	init_locks_vector(locks_vector);
+
+	if (path_parse(name, &path) == FAIL || path_parse(newname, &new_path) == FAIL) {
+		printf("failed to move %s to %s, invalid path\n", name, newname);
+		return TECNICOFS_ERROR_INVALID_PATH;
+	}
 
-	int length = 0;
+	/* a directory can not be moved to inside itself (nor the root) */
+	if (path_is_prefix(&path, &new_path)){
+		printf("failed to move %s to %s, destination is inside the source\n",
+			name, newname);
+		return TECNICOFS_ERROR_INVALID_PATH;
+	}
+
+	if (new_path.depth == 0) {
+		printf("failed to move %s to %s, invalid name\n", name, newname);
+		return TECNICOFS_ERROR_INVALID_PATH;
+	}
+
+	child = &path.components[path.depth - 1];
+	new_child = &new_path.components[new_path.depth - 1];
 
-	strcpy(namecopy, name);
+	while (1) {
 
-	char *word = strtok_r(name, delim, &saveptr);
+		if (attempts++ > 0) {
+			/* back off before trying again, so the moves that collided do not keep colliding */
+			unlock_locksvector(locks_vector);
+			if (attempts > MOVE_MAX_SPINS)
+				usleep(rand_r(&seed) % MOVE_MAX_BACKOFF);
+			else
+				sched_yield();
+		}
+
+		if (path.depth <= new_path.depth) {
+
+			if ((res = parent_and_child_inumber(name, locks_vector, &path,
+			                &parent_inumber_name, &child_inumber_name, MOVE)) != SUCCESS)
+				break;
+
+			if (child_inumber_name == FAIL) {
+				printf("failed to move %s, does not exist\n", name);
+				res = TECNICOFS_ERROR_FILE_NOT_FOUND;
+				break;
+			}
+
+			if ((res = parent_and_child_inumber(name, locks_vector, &new_path,
+			                &parent_inumber_newname, &child_inumber_newname, MOVE_TRY)) == BUSY)
+				continue;
+			if (res != SUCCESS)
+				break;
+
+			if (child_inumber_newname != FAIL) {
+				printf("failed to move %s to %s, already exists\n", name, newname);
+				res = TECNICOFS_ERROR_FILE_ALREADY_EXISTS;
+				break;
+			}
+		}
+		else {
+
+			if ((res = parent_and_child_inumber(name, locks_vector, &new_path,
+			                &parent_inumber_newname, &child_inumber_newname, MOVE)) != SUCCESS)
+				break;
+
+			if (child_inumber_newname != FAIL) {
+				printf("failed to move %s to %s, already exists\n", name, newname);
+				res = TECNICOFS_ERROR_FILE_ALREADY_EXISTS;
+				break;
+			}
+
+			if ((res = parent_and_child_inumber(name, locks_vector, &path,
+			                &parent_inumber_name, &child_inumber_name, MOVE_TRY)) == BUSY)
+				continue;
+			if (res != SUCCESS)
+				break;
+
+			if (child_inumber_name == FAIL) {
+				printf("failed to move %s, does not exist\n", name);
+				res = TECNICOFS_ERROR_FILE_NOT_FOUND;
+				break;
+			}
+		}
 
-	while (word != NULL){
-		length++;
-		word = strtok_r(NULL, delim, &saveptr);
+		/* the paths of the whole subtree change: the cached ones must be
+		invalid before it is unlinked (see dcache_valid) */
+		inode_get(child_inumber_name, &cType, NULL);
+		if (cType == T_DIRECTORY)
+			inode_moved(child_inumber_name);
+
+		/* remove entry from parent (old directory) */
+		if (dir_reset_entry(parent_inumber_name, child_inumber_name,
+		                    child->name, child->length, child->hash) == FAIL) {
+			printf("failed to delete %s from its dir\n", name);
+			res = TECNICOFS_ERROR_OTHER;
+			break;
+		}
+
+		/* add to the new parent (new directory) */
+		if (dir_add_entry(parent_inumber_newname, child_inumber_name,
+		                  new_child->name, new_child->length, new_child->hash) == FAIL) {
+			printf("could not add entry %s\n", newname);
+			/* add entry  to the old directory again */
+			if (dir_add_entry(parent_inumber_name, child_inumber_name,
+			                  child->name, child->length, child->hash) == FAIL)
+				printf("entry %s was lost during the proccess\n", name);
+			res = TECNICOFS_ERROR_NO_SPACE;
+			break;
+		}
+
+		res = SUCCESS;
+		break;
 	}
 
-    return length; 
+	/* a missing parent dir (or a lock that failed) */
+	if (res == FAIL)
+		res = TECNICOFS_ERROR_FILE_NOT_FOUND;
+
+	/* unlock all the locks */
+	unlock_locksvector(locks_vector);
+
+	return res;
+
 }
 
 /*
- * Moves a file or directory
+ * Opens a file given a path. Its data is then read and written through
+ * the i-number, without looking for the path again, and it can't be deleted
+ * until it is closed (it can still be moved).
  * Input:
- *  - name: path of node 
- *  - newname: new path of the node
- * Returns: SUCESS OR FAIL
+ *  - name: path of the file
+ * Returns: inumber of the file or a TECNICOFS_ERROR_* code
  */
-int move(char* name, char* newname){
+int open_file(char *name){
 
-	int parent_inumber_name, child_inumber_name;
-	int parent_inumber_newname, child_inumber_newname;
-	char *parent_name, *child_name, *parent_newname, *child_newname;
-	char name_copy[MAX_FILE_NAME], newname_copy[MAX_FILE_NAME];
-	int name_length, new_name_length;
+	int inumber;
+	type nType;
+	int locks_vector[LOCKSVECTOR_SIZE];
+	init_locks_vector(locks_vector);
 
-	strcpy(name_copy, name);
-	split_parent_child_from_path(name_copy, &parent_name, &child_name);
-	name_length = path_length(name);
+	/* the file is write locked, so a delete can't be checking it */
+	inumber = lookup(name, locks_vector, MODIFY);
 
-	strcpy(newname_copy, newname);
-	split_parent_child_from_path(newname_copy, &parent_newname, &child_newname);
-	new_name_length = path_length(newname);
+	if (inumber == FAIL) {
+		printf("failed to open %s, does not exist\n", name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
+	}
 
+	inode_get(inumber, &nType, NULL);
 
-	if ((strcmp(name, newname) < 0 && name_length <= new_name_length) || name_length < new_name_length){
+	if (nType != T_FILE) {
+		printf("failed to open %s, is a directory\n", name);
+		unlock_locksvector(locks_vector);
+		return TECNICOFS_ERROR_IS_A_DIRECTORY;
+	}
 
-		if (parent_and_child_inumber(name, parent_name, child_name, &parent_inumber_name, &child_inumber_name) == FAIL)
-			return FAIL;
+	inode_open(inumber);
 
-		if (child_inumber_name == FAIL) {
-			printf("failed to move %s in  %s, does not exist\n",
-		        child_name, parent_name);
-			return FAIL;
-		}
+	unlock_locksvector(locks_vector);
 
-		if (parent_and_child_inumber(name, parent_newname, child_newname, &parent_inumber_newname, &child_inumber_newname) == FAIL)
-			return FAIL;
+	return inumber;
+}
 
-		if (child_inumber_newname != FAIL) {
-			printf("failed to move %s in  %s, already exists\n",
-		        child_newname, parent_newname);
-			return FAIL;
-		}
+/*
+ * Closes a file opened with open_file.
+ * Input:
+ *  - inumber: inumber of the file
+ */
+void close_file(int inumber){
+	inode_close(inumber);
+}
 
-	}
-	else {
+/*
+ * Reads from an open file.
+ * Input:
+ *  - inumber: inumber of the file
+ *  - offset: where the read starts
+ *  - buffer: where the data is stored
+ *  - len: number of bytes to read
+ * Returns: number of bytes read or a TECNICOFS_ERROR_* code
+ */
+int read_file(int inumber, int offset, char *buffer, int len){
 
-		if (parent_and_child_inumber(name, parent_newname, child_newname, &parent_inumber_newname, &child_inumber_newname) == FAIL)
-			return FAIL;
+	int res;
+	int locks_vector[LOCKSVECTOR_SIZE];
+	init_locks_vector(locks_vector);
 
-		if (child_inumber_newname != FAIL) {
-			printf("failed to create %s in  %s, couldn't allocate inode\n",
-		        child_newname, parent_newname);
-			return FAIL;
-		}
-		
-		if (parent_and_child_inumber(name, parent_name, child_name, &parent_inumber_name, &child_inumber_name) == FAIL)
-			return FAIL;
-
-		if (child_inumber_name == FAIL) {
-			printf("failed to create %s in  %s, couldn't allocate inode\n",
-		        child_name, parent_name);
-			return FAIL;
-		}
-	}
+	if (lock_inode(inumber, READONLY, locks_vector, 0) != SUCCESS)
+		return TECNICOFS_ERROR_OTHER;
 
-	char child_namecopy[MAX_FILE_NAME] = "/";
-	strcat(child_namecopy, child_name);
-	
-	/* Verifify the directory which is being moved is not its new parent 
-	(child name com come with an extra '/' depending on the input given) */
-	if (strcmp(child_namecopy, parent_newname) == 0 || strcmp(child_name, parent_newname) == 0){
-		printf("failed to move %s from dir %s\n",
-			child_name, parent_name);
-		return FAIL;
-	}
+	res = inode_read(inumber, offset, buffer, len);
 
-	/* remove entry from parent (old directory) */
-	if (dir_reset_entry(parent_inumber_name, child_inumber_name) == FAIL) {
-		printf("failed to delete %s from dir %s\n",
-			child_name, parent_name);
-		return FAIL;
-	}
+	unlock_locksvector(locks_vector);
 
-	/* add to the new parent (new directory) */
-	if (dir_add_entry(parent_inumber_newname, child_inumber_name, child_newname) == FAIL) {
-		printf("could not add entry %s in dir %s\n",
-			child_name, parent_name);
-		/* add entry  to the old directory again */
-		if (dir_add_entry(parent_inumber_name, child_inumber_name, child_name) == FAIL)
-			printf("entry %s was lost during the proccess\n",child_name);
-		
-		return FAIL;
-	}
+	return res == FAIL ? TECNICOFS_ERROR_OTHER : res;
+}
 
-	return SUCCESS;
+/*
+ * Writes to an open file.
+ * Input:
+ *  - inumber: inumber of the file
+ *  - offset: where the write starts
+ *  - buffer: the data
+ *  - len: number of bytes to write
+ * Returns: number of bytes written or a TECNICOFS_ERROR_* code
+ */
+int write_file(int inumber, int offset, char *buffer, int len){
+
+	int res;
+	int locks_vector[LOCKSVECTOR_SIZE];
+	init_locks_vector(locks_vector);
+
+	if (len > FILE_MAX_SIZE - offset)
+		return TECNICOFS_ERROR_FILE_TOO_LARGE;
+
+	if (lock_inode(inumber, READWRITE, locks_vector, 0) != SUCCESS)
+		return TECNICOFS_ERROR_OTHER;
 
+	res = inode_write(inumber, offset, buffer, len);
+
+	unlock_locksvector(locks_vector);
+
+	return res == FAIL ? TECNICOFS_ERROR_NO_SPACE : res;
 }
 
 /*
@@ -503,21 +959,31 @@ void print_tecnicofs_tree(FILE *fp){
  * Prints de tecnicofs tree to a file.
  * Input:
  * 	- filename: name of the outputfile
+ * Returns: SUCCESS or a TECNICOFS_ERROR_* code
  */ 
 int print(char *filename){
 
 	FILE *outputfile;
+	int locks_vector[LOCKSVECTOR_SIZE];
+	init_locks_vector(locks_vector);
+
 	outputfile = fopen(filename, "w");
 
 	if(outputfile == NULL)
-		return FAIL;
-
-	/* we would rwlock the root to garantee that no other thread is modifing the tecnicofs
-	but since we changed the locks to a global mutex lock because of someone bugs in the
-	last version of the code, the property is already garanteed just by the global mutex */
+		return TECNICOFS_ERROR_OTHER;
+
+	/* every create, delete and move holds the root lock (at least for reading)
+	while it runs, so write locking the root waits for them to finish and keeps
+	new ones out while the tree is printed */
+	if (lock_inode(FS_ROOT, READWRITE, locks_vector, 0) == FAIL) {
+		fclose(outputfile);
+		return TECNICOFS_ERROR_OTHER;
+	}
 	
 	print_tecnicofs_tree(outputfile);
 
+	unlock_locksvector(locks_vector);
+
 	fclose(outputfile);
 
 	return SUCCESS;
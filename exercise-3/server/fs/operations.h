@@ -1,28 +1,56 @@
 #ifndef FS_H
 #define FS_H
 #include "state.h"
+#include "dcache.h"
+#include "path.h"
+#include "lockprof.h"
 
 #define EMPTY -1
+#define BUSY -2
 
 #define ROOTPATH ""
 
+#define READONLY 3
+#define READWRITE 4
+
 #define MODIFY 5
 #define FIND 6
 #define MOVE 7
+#define MOVE_TRY 8
+
+/* attempts a move retries with sched_yield before sleeping between retries */
+#define MOVE_MAX_SPINS 4
+/* upper bound (in microseconds) of the random sleep between retries of a move */
+#define MOVE_MAX_BACKOFF 100
 
 int setSockAddrUn(char *path, struct sockaddr_un *addr);
 int tfsMount(char *sockPath);
 void init_fs();
 void destroy_fs();
-int is_dir_empty(DirEntry *dirEntries);
+void init_locks_vector(int locks_vector[]);
+int in_locksvector(int inumber, int locks_vector[]);
+void add_locksvector(int inumber, int locks_vector[]);
+void unlock_locksvector(int locks_vector[]);
+void unlock_inode(int inumber, int locks_vector[]);
+int lock_inode_at(int inumber, int rwlocktype, int locks_vector[], int try, LockSite *site);
+/* the call site is recorded by the lock profiler (see lockprof.h) */
+#define lock_inode(inumber, rwlocktype, locks_vector, try) \
+	lock_inode_at(inumber, rwlocktype, locks_vector, try, LOCK_SITE)
+int is_dir_empty(Directory *dir);
 int create(char *name, type nodeType);
 int delete(char *name);
-int lookup(char *name);
-int count_path(char**  words, char* name);
-char* sort_names(char* name1, char* name2);
-int parent_and_child_inumber(char* name, char* parent_name, 
-                char* child_name, int* parent_inumber, int* child_inumber);
+int lookup_sub_node(PathComponent *component, Directory *dir);
+int lookup_unlocked(Path *path, int depth);
+int lookup_cached(Path *path, int depth, int locks_vector[]);
+int lookup_path(Path *path, int depth, int locks_vector[], int mode);
+int lookup(char *name, int locks_vector[], int mode);
+int parent_and_child_inumber(char* name, int locks_vector[], Path *path,
+                int* parent_inumber, int* child_inumber, int mode);
 int move(char* name, char* newname);
+int open_file(char *name);
+void close_file(int inumber);
+int read_file(int inumber, int offset, char *buffer, int len);
+int write_file(int inumber, int offset, char *buffer, int len);
 void print_tecnicofs_tree(FILE *fp);
 int print(char* outputfile);
 
@@ -0,0 +1,80 @@
+#include <string.h>
+#include "path.h"
+
+/*
+ * Splits a path into its components, hashing them in the same pass. Empty
+ * components (repeated, leading or trailing slashes) are skipped.
+ * Input:
+ *  - name: the path, which must outlive the parsed path
+ *  - path: where the parsed path is stored
+ * Returns: SUCCESS or FAIL if the path is deeper than MAX_PATH_DEPTH or
+ * a component doesn't fit in MAX_FILE_NAME
+ */
+int path_parse(char *name, Path *path) {
+	char *c = name;
+
+	path->name = name;
+	path->depth = 0;
+
+	while (1) {
+		unsigned int hash = NAME_HASH_INIT;
+		char *start;
+
+		while (*c == '/')
+			c++;
+		if (*c == '\0')
+			return SUCCESS;
+
+		if (path->depth == MAX_PATH_DEPTH)
+			return FAIL;
+
+		for (start = c; *c != '/' && *c != '\0'; c++)
+			hash = NAME_HASH_STEP(hash, *c);
+
+		if (c - start >= MAX_FILE_NAME)
+			return FAIL;
+
+		path->components[path->depth].name = start;
+		path->components[path->depth].length = c - start;
+		path->components[path->depth].hash = hash;
+		path->depth++;
+	}
+}
+
+/*
+ * Length of the prefix of a path with its first components, which is the
+ * path of the directory at that depth.
+ * Input:
+ *  - path: the parsed path
+ *  - depth: number of components of the prefix
+ * Returns: the length of the prefix (0 for the root)
+ */
+int path_prefix_length(Path *path, int depth) {
+	PathComponent *last;
+
+	if (depth == 0)
+		return 0;
+
+	last = &path->components[depth - 1];
+	return last->name + last->length - path->name;
+}
+
+/*
+ * Checks if a path is inside the directory given by another path.
+ * Input:
+ *  - dir: path of the directory
+ *  - path: path to check
+ * Returns: 1 if path is dir or is below dir, 0 otherwise
+ */
+int path_is_prefix(Path *dir, Path *path) {
+	if (dir->depth > path->depth)
+		return 0;
+
+	for (int i = 0; i < dir->depth; i++) {
+		PathComponent *a = &dir->components[i], *b = &path->components[i];
+
+		if (a->hash != b->hash || a->length != b->length || memcmp(a->name, b->name, a->length) != 0)
+			return 0;
+	}
+	return 1;
+}
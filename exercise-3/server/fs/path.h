@@ -0,0 +1,30 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include "state.h"
+
+/*
+ * Component of a path. The name points into the path itself, so it is not
+ * terminated.
+ */
+typedef struct pathComponent {
+	char *name;
+	int length;
+	unsigned int hash; /* name_hash of the name */
+} PathComponent;
+
+/*
+ * Path split into its components, once, and used by every step of an
+ * operation.
+ */
+typedef struct path {
+	char *name; /* the path */
+	int depth; /* number of components */
+	PathComponent components[MAX_PATH_DEPTH];
+} Path;
+
+int path_parse(char *name, Path *path);
+int path_prefix_length(Path *path, int depth);
+int path_is_prefix(Path *dir, Path *path);
+
+#endif /* PATH_H */
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "slab.h"
+
+/*
+ * Header at the start of a slab, its objects follow.
+ */
+typedef struct slab {
+    struct slab *next; /* list of the slabs of the class with free objects */
+    struct slab *prev;
+    int used;          /* objects out of the slab, in use or in a thread cache */
+    int capacity;
+    char *bump;        /* first object never handed out */
+    void *free;        /* objects returned, linked through their first word */
+} Slab;
+
+#define SLAB_HEADER ((sizeof(Slab) + 63) & ~(size_t) 63)
+#define SLAB_OF(ptr) ((Slab *) ((uintptr_t) (ptr) & ~(uintptr_t) (SLAB_SIZE - 1)))
+
+/*
+ * Slabs of a size class. The fuller slabs are at the front of the list, so
+ * the emptier ones get a chance to empty.
+ */
+typedef struct slabClass {
+    pthread_mutex_t mutex;
+    Slab *first;       /* slabs with free objects */
+    Slab *last;
+    int empty;         /* slabs of the list with no object in use */
+} __attribute__((aligned(64))) SlabClass;
+
+/*
+ * Free objects cached by a thread, a stack for each class.
+ */
+typedef struct slabCache {
+    int count[SLAB_CLASSES];
+    void *objects[SLAB_CLASSES][SLAB_CACHE];
+} SlabCache;
+
+static SlabClass classes[SLAB_CLASSES] = {
+    [0 ... SLAB_CLASSES - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER }
+};
+static size_t mapped = 0;
+
+static __thread SlabCache *self = NULL;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Returns the size class of an object: 16, 24, 32, 48, 64, 96...
+ */
+static int slab_class(size_t size) {
+    int p;
+
+    if (size <= SLAB_MIN_OBJECT)
+        return 0;
+
+    /* size is in (2^(p-1), 2^p] */
+    p = 64 - __builtin_clzl(size - 1);
+    return size <= (3UL << (p - 2)) ? 2 * p - 9 : 2 * p - 8;
+}
+
+static size_t slab_class_size(int cls) {
+    return (size_t) (cls & 1 ? 24 : 16) << (cls / 2);
+}
+
+/*
+ * Objects moved between a thread cache and the slabs at once.
+ */
+static int slab_batch(int cls) {
+    size_t batch = SLAB_BATCH_BYTES / slab_class_size(cls);
+
+    return batch < 1 ? 1 : batch > SLAB_CACHE / 2 ? SLAB_CACHE / 2 : batch;
+}
+
+static void slab_unlink(SlabClass *class, Slab *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        class->first = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    else
+        class->last = slab->prev;
+}
+
+static void slab_push_front(SlabClass *class, Slab *slab) {
+    slab->prev = NULL;
+    slab->next = class->first;
+    if (class->first)
+        class->first->prev = slab;
+    else
+        class->last = slab;
+    class->first = slab;
+}
+
+static void slab_push_back(SlabClass *class, Slab *slab) {
+    slab->next = NULL;
+    slab->prev = class->last;
+    if (class->last)
+        class->last->next = slab;
+    else
+        class->first = slab;
+    class->last = slab;
+}
+
+/*
+ * Maps a slab aligned to SLAB_SIZE.
+ * Returns: the slab or NULL if there is no memory
+ */
+static Slab *slab_map(int cls) {
+    char *area = mmap(NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *start;
+
+    if (area == MAP_FAILED)
+        return NULL;
+
+    /* only the aligned part of the area is kept */
+    start = (char *) (((uintptr_t) area + SLAB_SIZE - 1) & ~(uintptr_t) (SLAB_SIZE - 1));
+    if (start > area)
+        munmap(area, start - area);
+    munmap(start + SLAB_SIZE, area + SLAB_SIZE - start);
+
+    Slab *slab = (Slab *) start;
+
+    slab->used = 0;
+    slab->capacity = (SLAB_SIZE - SLAB_HEADER) / slab_class_size(cls);
+    slab->bump = start + SLAB_HEADER;
+    slab->free = NULL;
+    __atomic_add_fetch(&mapped, SLAB_SIZE, __ATOMIC_RELAXED);
+    return slab;
+}
+
+static void slab_unmap(Slab *slab) {
+    munmap(slab, SLAB_SIZE);
+    __atomic_sub_fetch(&mapped, SLAB_SIZE, __ATOMIC_RELAXED);
+}
+
+/*
+ * Fills the cache of a class with a batch of objects from the slabs.
+ * Returns: number of objects cached (0 if there is no memory)
+ */
+static int slab_refill(SlabCache *cache, int cls) {
+    SlabClass *class = &classes[cls];
+    size_t size = slab_class_size(cls);
+    int batch = slab_batch(cls);
+
+    pthread_mutex_lock(&class->mutex);
+
+    while (cache->count[cls] < batch) {
+        Slab *slab = class->first;
+        void *object;
+
+        if (slab == NULL) {
+            if ((slab = slab_map(cls)) == NULL)
+                break;
+            slab_push_front(class, slab);
+            class->empty++;
+        }
+
+        if (slab->free != NULL) {
+            object = slab->free;
+            slab->free = *(void **) object;
+        }
+        else {
+            object = slab->bump;
+            slab->bump += size;
+        }
+
+        if (slab->used++ == 0)
+            class->empty--;
+        if (slab->used == slab->capacity)
+            slab_unlink(class, slab);
+
+        cache->objects[cls][cache->count[cls]++] = object;
+    }
+
+    pthread_mutex_unlock(&class->mutex);
+    return cache->count[cls];
+}
+
+/*
+ * Returns the oldest objects of the cache of a class to their slabs.
+ * Input:
+ *  - n: number of objects returned
+ */
+static void slab_flush(SlabCache *cache, int cls, int n) {
+    SlabClass *class = &classes[cls];
+
+    pthread_mutex_lock(&class->mutex);
+
+    for (int i = 0; i < n; i++) {
+        void *object = cache->objects[cls][i];
+        Slab *slab = SLAB_OF(object);
+
+        *(void **) object = slab->free;
+        slab->free = object;
+
+        /* a full slab is not in the list */
+        if (slab->used-- == slab->capacity)
+            slab_push_front(class, slab);
+
+        if (slab->used == 0) {
+            slab_unlink(class, slab);
+            if (class->empty >= SLAB_KEEP_EMPTY) {
+                slab_unmap(slab);
+            }
+            else {
+                slab_push_back(class, slab);
+                class->empty++;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&class->mutex);
+
+    cache->count[cls] -= n;
+    memmove(cache->objects[cls], cache->objects[cls] + n, cache->count[cls] * sizeof(void *));
+}
+
+/*
+ * Returns the cache of a thread that exits to the slabs.
+ */
+static void slab_cache_destroy(void *ptr) {
+    SlabCache *cache = ptr;
+
+    for (int cls = 0; cls < SLAB_CLASSES; cls++)
+        slab_flush(cache, cls, cache->count[cls]);
+    free(cache);
+}
+
+static void slab_key_create() {
+    if (pthread_key_create(&cache_key, slab_cache_destroy) != 0) {
+        printf("slab: failed to create the thread key\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Returns the cache of the calling thread, creating it on first use.
+ */
+static SlabCache *slab_self() {
+    if (self == NULL) {
+        pthread_once(&cache_once, slab_key_create);
+
+        if ((self = calloc(1, sizeof(SlabCache))) == NULL) {
+            printf("slab: failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_setspecific(cache_key, self);
+    }
+    return self;
+}
+
+/*
+ * Allocates an object.
+ * Input:
+ *  - size: size of the object
+ * Returns: the object (not initialized) or NULL if there is no memory
+ */
+void *slab_alloc(size_t size) {
+    if (size > SLAB_MAX_OBJECT)
+        return malloc(size);
+
+    SlabCache *cache = slab_self();
+    int cls = slab_class(size);
+
+    if (cache->count[cls] == 0 && slab_refill(cache, cls) == 0)
+        return NULL;
+
+    return cache->objects[cls][--cache->count[cls]];
+}
+
+/*
+ * Releases an object allocated with slab_alloc.
+ * Input:
+ *  - ptr: the object (may be NULL)
+ *  - size: size it was allocated with
+ */
+void slab_free(void *ptr, size_t size) {
+    if (ptr == NULL)
+        return;
+
+    if (size > SLAB_MAX_OBJECT) {
+        free(ptr);
+        return;
+    }
+
+    SlabCache *cache = slab_self();
+    int cls = slab_class(size);
+
+    if (cache->count[cls] == SLAB_CACHE)
+        slab_flush(cache, cls, slab_batch(cls));
+
+    cache->objects[cls][cache->count[cls]++] = ptr;
+}
+
+/*
+ * Returns the bytes of the slabs mapped.
+ */
+size_t slab_mapped() {
+    return __atomic_load_n(&mapped, __ATOMIC_RELAXED);
+}
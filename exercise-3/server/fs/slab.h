@@ -0,0 +1,34 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/*
+ * Slab allocator for the directories and the file data. Objects are
+ * rounded up to a size class (powers of two and the halves between them)
+ * and carved from slabs of SLAB_SIZE bytes. Each thread keeps a cache of
+ * free objects of each class, so most allocations and releases only pop or
+ * push a pointer; the cache is refilled from, and returns its excess to,
+ * the slabs of the class in batches. A slab with no objects in use is
+ * unmapped, except SLAB_KEEP_EMPTY of each class, so memory goes back to
+ * the system when the trees shrink. Larger objects go to malloc.
+ */
+
+/* slabs are aligned to their size, so an object finds its slab */
+#define SLAB_SIZE (256 * 1024)
+/* smallest and largest size classes */
+#define SLAB_MIN_OBJECT 16
+#define SLAB_MAX_OBJECT (32 * 1024)
+#define SLAB_CLASSES 23
+/* free objects of a class cached by a thread, at most */
+#define SLAB_CACHE 64
+/* bytes moved between a thread cache and the slabs at once, at most */
+#define SLAB_BATCH_BYTES (64 * 1024)
+/* empty slabs kept mapped in each class */
+#define SLAB_KEEP_EMPTY 1
+
+void *slab_alloc(size_t size);
+void slab_free(void *ptr, size_t size);
+size_t slab_mapped();
+
+#endif /* SLAB_H */
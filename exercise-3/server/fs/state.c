@@ -2,27 +2,305 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
 #include "state.h"
+#include "slab.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "../../tecnicofs-api-constants.h"
 
-inode_t inode_table[INODE_TABLE_SIZE];
+inode_t *inode_chunks[INODE_MAX_CHUNKS];
+
+/* number of i-nodes in the allocated chunks */
+static int inode_count = 0;
+
+/* free i-nodes are kept in a lock-free stack linked through next_free. The
+head packs a tag (high 32 bits), changed by every update so a stale head can
+never be swapped in (ABA), with the inumber at the top (low 32 bits) */
+static unsigned long long free_list;
+#define FREE_LIST_TOP(head) ((int) (unsigned int) (head))
+#define FREE_LIST_HEAD(tag, inumber) (((unsigned long long) (tag) << 32) | (unsigned int) (inumber))
+
+/* serializes the allocation of new chunks */
+static pthread_mutex_t grow_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* cycles of the delay injected in each operation (see delay_op) */
+int delay_cycles[DELAY_OPS] = { DELAY, DELAY, DELAY, DELAY, DELAY };
+
+static char *delay_names[DELAY_OPS] = { "create", "delete", "get", "add", "reset" };
 
 /*
  * Sleeps for synchronization testing.
  */
 void insert_delay(int cycles) {
-    for (int i = 0; i < cycles; i++) {}
+    for (volatile int i = 0; i < cycles; i++) {}
+}
+
+/*
+ * Sets the delays injected in the operations.
+ * Input:
+ *  - config: number of cycles for every operation, or a comma separated
+ *            list of operation=cycles (NULL keeps the defaults)
+ */
+void delay_config(char *config) {
+    char copy[MAX_INPUT_SIZE];
+    char *saveptr;
+
+    if (config == NULL)
+        return;
+
+    if (strchr(config, '=') == NULL) {
+        for (int op = 0; op < DELAY_OPS; op++)
+            delay_cycles[op] = atoi(config);
+        return;
+    }
+
+    strncpy(copy, config, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    for (char *item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        char *value = strchr(item, '=');
+        int op;
+
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+
+        for (op = 0; op < DELAY_OPS && strcmp(item, delay_names[op]) != 0; op++);
+
+        if (op == DELAY_OPS)
+            fprintf(stderr, "delay_config: unknown operation %s\n", item);
+        else
+            delay_cycles[op] = atoi(value);
+    }
+}
+
+/*
+ * Checks if an inumber identifies an i-node in use.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: 1 if valid, 0 otherwise
+ */
+static int inode_is_valid(int inumber) {
+    return inumber >= 0 && inumber < __atomic_load_n(&inode_count, __ATOMIC_ACQUIRE) &&
+           inode_ref(inumber)->nodeType != T_NONE;
+}
+
+/*
+ * Pushes a list of free i-nodes (already linked from first to last) to the
+ * free list.
+ * Input:
+ *  - first: inumber of the first i-node of the list
+ *  - last: inumber of the last i-node of the list
+ */
+static void free_list_push(int first, int last) {
+    unsigned long long head = __atomic_load_n(&free_list, __ATOMIC_ACQUIRE);
+    unsigned long long new;
+
+    do {
+        __atomic_store_n(&inode_ref(last)->next_free, FREE_LIST_TOP(head), __ATOMIC_RELAXED);
+        new = FREE_LIST_HEAD((head >> 32) + 1, first);
+    } while (!__atomic_compare_exchange_n(&free_list, &head, new, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Pops an i-node from the free list.
+ * Returns: the inumber or FREE_INODE if the list is empty
+ */
+static int free_list_pop() {
+    unsigned long long head = __atomic_load_n(&free_list, __ATOMIC_ACQUIRE);
+    unsigned long long new;
+
+    do {
+        int inumber = FREE_LIST_TOP(head);
+
+        if (inumber == FREE_INODE)
+            return FREE_INODE;
+
+        /* chunks are never released, so the read is safe even if another
+        thread pops the i-node meanwhile (the tag makes the swap fail) */
+        new = FREE_LIST_HEAD((head >> 32) + 1,
+                             __atomic_load_n(&inode_ref(inumber)->next_free, __ATOMIC_RELAXED));
+    } while (!__atomic_compare_exchange_n(&free_list, &head, new, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return FREE_LIST_TOP(head);
+}
+
+/*
+ * Adds a chunk of free i-nodes to the table, unless another thread already
+ * refilled the free list.
+ * Returns: SUCCESS or FAIL (table full or no memory)
+ */
+static int inode_table_grow() {
+    int res = SUCCESS;
+
+    pthread_mutex_lock(&grow_mutex);
+
+    if (FREE_LIST_TOP(__atomic_load_n(&free_list, __ATOMIC_ACQUIRE)) != FREE_INODE) {
+        pthread_mutex_unlock(&grow_mutex);
+        return SUCCESS;
+    }
+
+    int chunk = inode_count >> INODE_CHUNK_SHIFT;
+    inode_t *inodes = chunk < INODE_MAX_CHUNKS ? malloc(sizeof(inode_t) * INODE_CHUNK_SIZE) : NULL;
+
+    if (inodes == NULL) {
+        printf("inode_table_grow: can't allocate more i-nodes\n");
+        res = FAIL;
+    }
+    else {
+        int first = chunk << INODE_CHUNK_SHIFT;
+
+        for (int i = 0; i < INODE_CHUNK_SIZE; i++) {
+            inodes[i].nodeType = T_NONE;
+            inodes[i].data.dir = NULL;
+            inodes[i].data.file = NULL;
+            inodes[i].next_free = first + i + 1;
+            inodes[i].generation = 0;
+            inodes[i].opened = 0;
+            if (pthread_rwlock_init(&inodes[i].rwlock, NULL) != SUCCESS) {
+                printf("inode_table_grow: rwlock init failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        inode_chunks[chunk] = inodes;
+        __atomic_store_n(&inode_count, first + INODE_CHUNK_SIZE, __ATOMIC_RELEASE);
+        free_list_push(first, first + INODE_CHUNK_SIZE - 1);
+    }
+
+    pthread_mutex_unlock(&grow_mutex);
+    return res;
+}
+
+/*
+ * Compares a group of tags with the tag of a name.
+ * Input:
+ *  - tags: the group
+ *  - tag: the tag of the name
+ *  - free: where the mask of the DIR_TAG_FREE tags is stored
+ * Returns: the mask of the tags equal to tag (bit i for tags[i])
+ */
+typedef unsigned int (*dir_match_fn)(const unsigned char *tags, unsigned char tag, unsigned int *free);
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static unsigned int dir_match_sse2(const unsigned char *tags, unsigned char tag, unsigned int *free) {
+    __m128i group = _mm_loadu_si128((const __m128i *) tags);
+
+    *free = _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) DIR_TAG_FREE)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) tag)));
+}
+
+__attribute__((target("avx2")))
+static unsigned int dir_match_avx2(const unsigned char *tags, unsigned char tag, unsigned int *free) {
+    __m256i group = _mm256_loadu_si256((const __m256i *) tags);
+
+    *free = _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8((char) DIR_TAG_FREE)));
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8((char) tag)));
+}
+#endif
+
+static char *dir_probe_names[DIR_PROBES] = { "slots", "sse2", "avx2" };
+
+/* probing of dir_lookup, and for groups their width and compare */
+static int dir_probe = DIR_PROBE_SLOTS;
+static int dir_group = 0;
+static dir_match_fn dir_match = NULL;
+
+/*
+ * Selects how dir_lookup probes the tables.
+ * Input:
+ *  - probe: a dir_probe
+ * Returns: SUCCESS or FAIL if the processor can't run it
+ */
+int dir_probe_set(int probe) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (probe == DIR_PROBE_SSE2 && __builtin_cpu_supports("sse2")) {
+        dir_group = 16;
+        dir_match = dir_match_sse2;
+    }
+    else if (probe == DIR_PROBE_AVX2 && __builtin_cpu_supports("avx2")) {
+        dir_group = 32;
+        dir_match = dir_match_avx2;
+    }
+    else if (probe != DIR_PROBE_SLOTS)
+        return FAIL;
+#else
+    if (probe != DIR_PROBE_SLOTS)
+        return FAIL;
+#endif
+
+    dir_probe = probe;
+    return SUCCESS;
+}
+
+/*
+ * Returns the name of a dir_probe.
+ */
+char *dir_probe_name(int probe) {
+    return probe >= 0 && probe < DIR_PROBES ? dir_probe_names[probe] : NULL;
+}
+
+/*
+ * Selects the widest probing the processor can run, or the named one. The
+ * tag groups are only faster than the slot loop once the compiler inlines
+ * their intrinsics, so a build without optimization probes the slots
+ * unless told otherwise.
+ * Input:
+ *  - name: name of a dir_probe (NULL for the default)
+ */
+static void dir_probe_init(char *name) {
+    int probe;
+
+#ifndef __OPTIMIZE__
+    if (name == NULL)
+        name = dir_probe_names[DIR_PROBE_SLOTS];
+#endif
+
+    for (probe = DIR_PROBES - 1; probe > DIR_PROBE_SLOTS; probe--)
+        if ((name == NULL || strcmp(name, dir_probe_names[probe]) == 0) && dir_probe_set(probe) == SUCCESS)
+            return;
+
+    if (name != NULL && strcmp(name, dir_probe_names[DIR_PROBE_SLOTS]) != 0)
+        fprintf(stderr, "dir_probe_init: can't probe with %s\n", name);
+    dir_probe_set(DIR_PROBE_SLOTS);
 }
 
 /*
  * Initializes the i-nodes table.
  */
 void inode_table_init() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        inode_table[i].nodeType = T_NONE;
-        inode_table[i].data.dirEntries = NULL;
-        inode_table[i].data.fileContents = NULL;
-    }
+#ifdef TEST_DELAY
+    delay_config(getenv("TECNICOFS_DELAY"));
+#endif
+
+    dir_probe_init(getenv("TECNICOFS_PROBE"));
+
+    inode_count = 0;
+    free_list = FREE_LIST_HEAD(0, FREE_INODE);
+
+    /* the first chunk is pushed in order, so the root gets inumber 0 */
+    if (inode_table_grow() == FAIL)
+        exit(EXIT_FAILURE);
+}
+
+/*
+ * Releases the contents of a file.
+ * Input:
+ *  - file: the contents, or NULL for an empty file
+ */
+static void file_destroy(File *file) {
+    if (file == NULL)
+        return;
+
+    for (int i = 0; i < file->capacity; i++)
+        slab_free(file->blocks[i], FILE_BLOCK_SIZE);
+    slab_free(file->blocks, file->capacity * sizeof(char *));
+    slab_free(file, sizeof(File));
 }
 
 /*
@@ -30,14 +308,21 @@ void inode_table_init() {
  */
 
 void inode_table_destroy() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (inode_table[i].nodeType != T_NONE) {
-            /* as data is an union, the same pointer is used for both dirEntries and fileContents */
-            /* just release one of them */
-	  if (inode_table[i].data.dirEntries)
-            free(inode_table[i].data.dirEntries);
+    for (int i = 0; i < inode_count; i++) {
+        if (inode_ref(i)->nodeType == T_DIRECTORY) {
+            dir_destroy(inode_ref(i)->data.dir);
+        }
+        else if (inode_ref(i)->nodeType == T_FILE) {
+            file_destroy(inode_ref(i)->data.file);
         }
+        pthread_rwlock_destroy(&inode_ref(i)->rwlock);
     }
+
+    for (int chunk = 0; chunk < inode_count >> INODE_CHUNK_SHIFT; chunk++) {
+        free(inode_chunks[chunk]);
+        inode_chunks[chunk] = NULL;
+    }
+    inode_count = 0;
 }
 
 /*
@@ -49,32 +334,56 @@ void inode_table_destroy() {
  *     FAIL: if an error occurs
  */
 int inode_create(type nType) {
-    /* Used for testing synchronization speedup */
-    insert_delay(DELAY);
+    int inumber;
 
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
+    /* Used for testing synchronization speedup */
+    INSERT_DELAY(DELAY_CREATE);
 
-        if (inode_table[inumber].nodeType == T_NONE) {
-            inode_table[inumber].nodeType = nType;
+    /* the i-node is owned by this thread once it leaves the free list */
+    while ((inumber = free_list_pop()) == FREE_INODE) {
+        if (inode_table_grow() == FAIL)
+            return FAIL;
+    }
 
-            if (nType == T_DIRECTORY) {
-                /* Initializes entry table */
-                inode_table[inumber].data.dirEntries = malloc(sizeof(DirEntry) * MAX_DIR_ENTRIES);
-                
-                for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-                    inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-                }
-            }
-            else {
-                inode_table[inumber].data.fileContents = NULL;
-            }
+    inode_t *inode = inode_ref(inumber);
 
+    if (nType == T_DIRECTORY) {
+        /* Initializes entry table */
+        inode->data.dir = dir_create(DIR_INITIAL_SIZE, DIR_INITIAL_NAMES);
 
-            return inumber;
+        if (inode->data.dir == NULL) {
+            printf("inode_create: failed to allocate directory\n");
+            free_list_push(inumber, inumber);
+            return FAIL;
         }
-
     }
-    return FAIL;
+    else {
+        inode->data.file = NULL;
+    }
+
+    /* readers without locks may find the i-node as soon as it is added to a
+    directory, its data must be visible by then */
+    __atomic_store_n(&inode->nodeType, nType, __ATOMIC_RELEASE);
+
+    return inumber;
+}
+
+/*
+ * Returns a deleted i-node to the free list (called by epoch_retire once no
+ * reader can still find it).
+ * Input:
+ *  - inumber: identifier of the i-node, cast to a pointer
+ */
+static void inode_reclaim(void *inumber) {
+    free_list_push((int) (intptr_t) inumber, (int) (intptr_t) inumber);
+}
+
+/*
+ * Releases a directory (called by epoch_retire once no reader can still
+ * be reading it).
+ */
+static void dir_reclaim(void *dir) {
+    dir_destroy(dir);
 }
 
 /*
@@ -85,17 +394,29 @@ int inode_create(type nType) {
  */
 int inode_delete(int inumber) {
     /* Used for testing synchronization speedup */
-    insert_delay(DELAY);
+    INSERT_DELAY(DELAY_DELETE);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(inumber)) {
         printf("inode_delete: invalid inumber\n");
         return FAIL;
     } 
 
-    inode_table[inumber].nodeType = T_NONE;
-    /* see inode_table_destroy function */
-    if (inode_table[inumber].data.dirEntries)
-        free(inode_table[inumber].data.dirEntries);
+    type nType = inode_ref(inumber)->nodeType;
+    union Data data = inode_ref(inumber)->data;
+
+    /* paths cached with the i-node are no longer valid (see dcache.h) */
+    __atomic_add_fetch(&inode_ref(inumber)->generation, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&inode_ref(inumber)->nodeType, T_NONE, __ATOMIC_RELEASE);
+    __atomic_store_n(&inode_ref(inumber)->data.dir, NULL, __ATOMIC_RELEASE);
+
+    /* readers without locks may still be in the directory, and must not see
+    the i-node reused while they are (see inode_table_destroy function) */
+    if (nType == T_DIRECTORY)
+        epoch_retire(dir_reclaim, data.dir);
+    else
+        file_destroy(data.file);
+
+    epoch_retire(inode_reclaim, (void *) (intptr_t) inumber);
     return SUCCESS;
 }
 
@@ -110,58 +431,556 @@ int inode_delete(int inumber) {
  */
 int inode_get(int inumber, type *nType, union Data *data) {
     /* Used for testing synchronization speedup */
-    insert_delay(DELAY);
+    INSERT_DELAY(DELAY_GET);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(inumber)) {
         printf("inode_get: invalid inumber %d\n", inumber);
         return FAIL;
     }
 
     if (nType)
-        *nType = inode_table[inumber].nodeType;
+        *nType = inode_ref(inumber)->nodeType;
 
     if (data)
-        *data = inode_table[inumber].data;
+        *data = inode_ref(inumber)->data;
 
     return SUCCESS;
 }
 
+/*
+ * Returns the directory of an i-node. Can be used without locks inside a
+ * read section (epoch_enter), the directory is valid until its end.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: the directory or NULL if the i-node is not a directory
+ */
+Directory *inode_dir(int inumber) {
+    /* Used for testing synchronization speedup */
+    INSERT_DELAY(DELAY_GET);
+
+    if (inumber < 0 || inumber >= __atomic_load_n(&inode_count, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    inode_t *inode = inode_ref(inumber);
+
+    if (__atomic_load_n(&inode->nodeType, __ATOMIC_ACQUIRE) != T_DIRECTORY)
+        return NULL;
+
+    return __atomic_load_n(&inode->data.dir, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Returns the generation of an i-node, which changes every time the i-node
+ * is deleted or, for a directory, moved.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+unsigned int inode_generation(int inumber) {
+    return __atomic_load_n(&inode_ref(inumber)->generation, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Changes the generation of a directory about to be moved, as the paths
+ * cached through it are no longer valid (see dcache.h).
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+void inode_moved(int inumber) {
+    __atomic_add_fetch(&inode_ref(inumber)->generation, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Reads from the contents of a file. The caller must hold the lock of the
+ * i-node.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - offset: where the read starts
+ *  - buffer: where the data is stored
+ *  - len: number of bytes to read
+ * Returns: number of bytes read (0 past the end of the file) or FAIL
+ */
+int inode_read(int inumber, int offset, char *buffer, int len) {
+    if (!inode_is_valid(inumber) || inode_ref(inumber)->nodeType != T_FILE || offset < 0 || len < 0) {
+        printf("inode_read: invalid arguments\n");
+        return FAIL;
+    }
+
+    File *file = inode_ref(inumber)->data.file;
+    int size = file ? file->size : 0;
+    int done = 0;
+
+    if (offset >= size)
+        return 0;
+    if (len > size - offset)
+        len = size - offset;
+
+    while (done < len) {
+        int block = (offset + done) / FILE_BLOCK_SIZE;
+        int start = (offset + done) % FILE_BLOCK_SIZE;
+        int n = FILE_BLOCK_SIZE - start < len - done ? FILE_BLOCK_SIZE - start : len - done;
+
+        if (file->blocks[block])
+            memcpy(buffer + done, file->blocks[block] + start, n);
+        else
+            memset(buffer + done, 0, n);
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * Writes to the contents of a file, which grow as needed. Only the table of
+ * blocks is reallocated, the blocks already written stay in place. The
+ * caller must hold the lock of the i-node for writing.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - offset: where the write starts
+ *  - buffer: the data
+ *  - len: number of bytes to write
+ * Returns: number of bytes written (less than len if memory ran out) or
+ * FAIL if nothing could be written
+ */
+int inode_write(int inumber, int offset, char *buffer, int len) {
+    if (!inode_is_valid(inumber) || inode_ref(inumber)->nodeType != T_FILE ||
+        offset < 0 || len < 0 || len > FILE_MAX_SIZE - offset) {
+        printf("inode_write: invalid arguments\n");
+        return FAIL;
+    }
+
+    inode_t *inode = inode_ref(inumber);
+    File *file = inode->data.file;
+    int blocks = (offset + len + FILE_BLOCK_SIZE - 1) / FILE_BLOCK_SIZE;
+    int done = 0;
+
+    if (file == NULL) {
+        if ((file = slab_alloc(sizeof(File))) == NULL)
+            return FAIL;
+        memset(file, 0, sizeof(File));
+        inode->data.file = file;
+    }
+
+    if (blocks > file->capacity) {
+        int capacity = file->capacity ? file->capacity : 1;
+        char **table;
+
+        while (capacity < blocks)
+            capacity *= 2;
+        if ((table = slab_alloc(capacity * sizeof(char *))) == NULL)
+            return FAIL;
+        if (file->capacity > 0)
+            memcpy(table, file->blocks, file->capacity * sizeof(char *));
+        memset(table + file->capacity, 0, (capacity - file->capacity) * sizeof(char *));
+        slab_free(file->blocks, file->capacity * sizeof(char *));
+        file->blocks = table;
+        file->capacity = capacity;
+    }
+
+    while (done < len) {
+        int block = (offset + done) / FILE_BLOCK_SIZE;
+        int start = (offset + done) % FILE_BLOCK_SIZE;
+        int n = FILE_BLOCK_SIZE - start < len - done ? FILE_BLOCK_SIZE - start : len - done;
+
+        if (file->blocks[block] == NULL) {
+            if ((file->blocks[block] = slab_alloc(FILE_BLOCK_SIZE)) == NULL)
+                break;
+            /* the rest of a new block reads as zeros */
+            if (n < FILE_BLOCK_SIZE)
+                memset(file->blocks[block], 0, FILE_BLOCK_SIZE);
+        }
+        memcpy(file->blocks[block] + start, buffer + done, n);
+        done += n;
+    }
+
+    if (done > 0 && offset + done > file->size)
+        file->size = offset + done;
+
+    return done == 0 && len > 0 ? FAIL : done;
+}
+
+/*
+ * Marks a file as open, it can't be deleted until it is closed. The caller
+ * must hold a lock of the i-node or have it open already.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+void inode_open(int inumber) {
+    __atomic_add_fetch(&inode_ref(inumber)->opened, 1, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * Closes a file opened with inode_open.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+void inode_close(int inumber) {
+    __atomic_sub_fetch(&inode_ref(inumber)->opened, 1, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * Checks if a file is open. The caller must hold the lock of the i-node
+ * for writing, so it can't be opened meanwhile.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+int inode_is_open(int inumber) {
+    return __atomic_load_n(&inode_ref(inumber)->opened, __ATOMIC_ACQUIRE) > 0;
+}
+
+
+/*
+ * Hash of an entry name (FNV-1a).
+ * Input:
+ *  - name: name of the entry (not necessarily terminated)
+ *  - length: length of the name
+ * Returns: the hash of the name
+ */
+unsigned int name_hash(char *name, int length) {
+    unsigned int hash = NAME_HASH_INIT;
+
+    for (int i = 0; i < length; i++)
+        hash = NAME_HASH_STEP(hash, name[i]);
+    return hash;
+}
+
+/*
+ * Checks if an entry has the given name. The offset of the name may come
+ * from a torn read of a reader without locks (discarded afterwards), so
+ * the name is compared without reading past the names of the table.
+ */
+static int dir_entry_is(DirTable *table, DirEntry *entry, char *name, int length, unsigned int hash) {
+    char *entry_name = DIR_TABLE_NAMES(table) + entry->name;
+
+    if (entry->hash != hash || entry->name + length >= (unsigned int) table->names_size)
+        return 0;
+
+    for (int i = 0; i < length; i++)
+        if (entry_name[i] != name[i])
+            return 0;
+    return entry_name[length] == '\0';
+}
+
+/*
+ * Allocates a table of free slots.
+ * Input:
+ *  - size: number of slots (a power of two)
+ *  - names_size: bytes for the names
+ * Returns: the table or NULL if there is no memory
+ */
+static DirTable *dir_table_create(int size, int names_size) {
+    DirTable *table = slab_alloc(sizeof(DirTable) + sizeof(DirEntry) * size + size + DIR_TAGS_CLONED + names_size);
+
+    if (table == NULL)
+        return NULL;
+
+    table->size = size;
+    table->names_size = names_size;
+    table->names_used = 0;
+    for (int i = 0; i < size; i++) {
+        table->entries[i].seq = 0;
+        table->entries[i].inumber = FREE_INODE;
+        table->entries[i].name = 0;
+    }
+    memset(DIR_TABLE_TAGS(table), DIR_TAG_FREE, size + DIR_TAGS_CLONED);
+    return table;
+}
+
+/*
+ * Releases a table (also called by epoch_retire once no reader can still
+ * be probing it).
+ */
+static void dir_table_destroy(void *ptr) {
+    DirTable *table = ptr;
+
+    slab_free(table, sizeof(DirTable) + sizeof(DirEntry) * table->size + table->size + DIR_TAGS_CLONED +
+              table->names_size);
+}
+
+/*
+ * Allocates an empty directory.
+ * Input:
+ *  - size: number of slots (a power of two)
+ *  - names_size: bytes for the names
+ * Returns: the directory or NULL if there is no memory
+ */
+Directory *dir_create(int size, int names_size) {
+    Directory *dir = slab_alloc(sizeof(Directory));
+
+    if (dir == NULL)
+        return NULL;
+
+    dir->table = dir_table_create(size, names_size);
+    if (dir->table == NULL) {
+        slab_free(dir, sizeof(Directory));
+        return NULL;
+    }
+
+    dir->count = 0;
+    dir->deleted = 0;
+    dir->names = 0;
+    return dir;
+}
+
+/*
+ * Releases a directory.
+ * Input:
+ *  - dir: the directory (may be NULL)
+ */
+void dir_destroy(Directory *dir) {
+    if (dir == NULL)
+        return;
+    dir_table_destroy(dir->table);
+    slab_free(dir, sizeof(Directory));
+}
+
+/*
+ * Finds the slot of an entry. The table always keeps free slots, so the
+ * probing ends at the first free one.
+ * Input:
+ *  - dir: the directory
+ *  - name: name of the entry
+ *  - length: length of the name
+ *  - hash: hash of the name
+ * Returns: the slot of the entry or FAIL if it does not exist
+ */
+static int dir_find_slot(Directory *dir, char *name, int length, unsigned int hash) {
+    unsigned int mask = dir->table->size - 1;
+
+    for (unsigned int i = hash & mask; ; i = (i + 1) & mask) {
+        DirEntry *entry = &dir->table->entries[i];
+
+        if (entry->inumber == FREE_INODE)
+            return FAIL;
+        if (entry->inumber != DELETED_ENTRY && dir_entry_is(dir->table, entry, name, length, hash))
+            return i;
+    }
+}
+
+/*
+ * Probes a table a slot at a time (DIR_PROBE_SLOTS), see dir_lookup.
+ */
+static int dir_lookup_slots(DirTable *table, char *name, int length, unsigned int hash) {
+    unsigned int mask = table->size - 1;
+    unsigned int i = hash & mask;
+
+    /* bounded, the free slots can move while the table is being probed */
+    for (int probes = 0; probes < table->size; ) {
+        DirEntry *entry = &table->entries[i];
+        unsigned int seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        int inumber, match;
+
+        if (seq & 1)
+            continue;
+
+        inumber = __atomic_load_n(&entry->inumber, __ATOMIC_RELAXED);
+        match = inumber >= 0 && dir_entry_is(table, entry, name, length, hash);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        if (inumber == FREE_INODE)
+            return FAIL;
+        if (match)
+            return inumber;
+
+        i = (i + 1) & mask;
+        probes++;
+    }
+    return FAIL;
+}
+
+/*
+ * Reads the entry of a slot whose tag matched.
+ * Returns: the inumber of the entry or FAIL if it has another name
+ */
+static int dir_entry_read(DirTable *table, int slot, char *name, int length, unsigned int hash) {
+    DirEntry *entry = &table->entries[slot];
+
+    for (;;) {
+        unsigned int seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        int inumber, match;
+
+        if (seq & 1)
+            continue;
+
+        inumber = __atomic_load_n(&entry->inumber, __ATOMIC_RELAXED);
+        match = inumber >= 0 && dir_entry_is(table, entry, name, length, hash);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq)
+            return match ? inumber : FAIL;
+    }
+}
+
+/*
+ * Looks for an entry of a directory. Can be used without locks inside a
+ * read section (epoch_enter): an entry read while a writer changes it is
+ * read again, so the result is an entry the directory had during the call.
+ * The tags of the slots are compared a group at a time, and only the
+ * entries with the tag of the name, up to the first free slot, are read.
+ * A tag is updated after its entry, so a stale tag is at worst an entry
+ * read for nothing or one being added that isn't found yet.
+ * Input:
+ *  - dir: the directory
+ *  - name: name of the entry
+ *  - length: length of the name
+ *  - hash: hash of the name
+ * Returns: the inumber of the entry or FAIL if it does not exist
+ */
+int dir_lookup(Directory *dir, char *name, int length, unsigned int hash) {
+    DirTable *table = __atomic_load_n(&dir->table, __ATOMIC_ACQUIRE);
+    unsigned char *tags = DIR_TABLE_TAGS(table);
+    unsigned int mask = table->size - 1;
+    unsigned int i = hash & mask;
+
+    if (dir_probe == DIR_PROBE_SLOTS)
+        return dir_lookup_slots(table, name, length, hash);
+
+    for (int probes = 0; probes < table->size; probes += dir_group, i = (i + dir_group) & mask) {
+        unsigned int free, match = dir_match(tags + i, DIR_TAG(hash), &free);
+
+        /* the probing ends at the first free slot */
+        if (free)
+            match &= (free & -free) - 1;
+
+        for (; match; match &= match - 1) {
+            int inumber = dir_entry_read(table, (i + __builtin_ctz(match)) & mask, name, length, hash);
+
+            if (inumber != FAIL)
+                return inumber;
+        }
+
+        if (free)
+            return FAIL;
+    }
+    return FAIL;
+}
+
+/*
+ * Sets the tag of a slot, and its copy after the last slot.
+ */
+static void dir_set_tag(DirTable *table, int slot, unsigned char tag) {
+    unsigned char *tags = DIR_TABLE_TAGS(table);
+
+    for (int i = slot; i < table->size + DIR_TAGS_CLONED; i += table->size)
+        __atomic_store_n(&tags[i], tag, __ATOMIC_RELEASE);
+}
+
+/*
+ * Starts a change of an entry, readers without locks retry it until
+ * dir_entry_end.
+ */
+static void dir_entry_begin(DirEntry *entry) {
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * Ends a change of an entry.
+ */
+static void dir_entry_end(DirEntry *entry) {
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Rebuilds the table of a directory without the removed entries and their
+ * names, doubling its size when more than half of it is in use, with room
+ * for twice the names in use.
+ * Input:
+ *  - dir: the directory
+ *  - extra: bytes of names about to be added
+ * Returns: SUCCESS or FAIL
+ */
+static int dir_grow(Directory *dir, int extra) {
+    DirTable *old = dir->table;
+    int size = (dir->count + 1) * 2 > old->size ? old->size * 2 : old->size;
+    int names_size = (dir->names + extra) * 2 > DIR_INITIAL_NAMES ? (dir->names + extra) * 2 : DIR_INITIAL_NAMES;
+    unsigned int mask = size - 1;
+    DirTable *table = dir_table_create(size, names_size);
+    char *old_names = DIR_TABLE_NAMES(old), *names;
+
+    if (table == NULL)
+        return FAIL;
+    names = DIR_TABLE_NAMES(table);
+
+    for (int i = 0; i < old->size; i++) {
+        if (old->entries[i].inumber < 0)
+            continue;
+
+        unsigned int j = old->entries[i].hash & mask;
+        while (table->entries[j].inumber != FREE_INODE)
+            j = (j + 1) & mask;
+
+        int length = strlen(old_names + old->entries[i].name) + 1;
+
+        table->entries[j] = old->entries[i];
+        table->entries[j].name = table->names_used;
+        dir_set_tag(table, j, DIR_TAG(old->entries[i].hash));
+        memcpy(names + table->names_used, old_names + old->entries[i].name, length);
+        table->names_used += length;
+    }
+
+    /* readers without locks may still be probing the old table */
+    __atomic_store_n(&dir->table, table, __ATOMIC_RELEASE);
+    epoch_retire(dir_table_destroy, old);
+    dir->deleted = 0;
+    return SUCCESS;
+}
 
 /*
  * Resets an entry for a directory.
  * Input:
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
+ *  - length: length of the name
+ *  - hash: hash of the name
  * Returns: SUCCESS or FAIL
  */
-int dir_reset_entry(int inumber, int sub_inumber) {
+int dir_reset_entry(int inumber, int sub_inumber, char *sub_name, int length, unsigned int hash) {
     /* Used for testing synchronization speedup */
-    insert_delay(DELAY);
+    INSERT_DELAY(DELAY_RESET_ENTRY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(inumber)) {
         printf("inode_reset_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    if (inode_ref(inumber)->nodeType != T_DIRECTORY) {
         printf("inode_reset_entry: can only reset entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < FREE_INODE) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(sub_inumber)) {
         printf("inode_reset_entry: invalid entry inumber\n");
         return FAIL;
     }
 
-    
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == sub_inumber) {
-            inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-            inode_table[inumber].data.dirEntries[i].name[0] = '\0';
-            return SUCCESS;
-        }
+    Directory *dir = inode_ref(inumber)->data.dir;
+    DirTable *table = dir->table;
+    int slot = dir_find_slot(dir, sub_name, length, hash);
+
+    if (slot == FAIL || table->entries[slot].inumber != sub_inumber)
+        return FAIL;
+
+    DirEntry *entry = &table->entries[slot];
+
+    dir_entry_begin(entry);
+    /* no probing goes through the slot if the next one is free */
+    if (table->entries[(slot + 1) & (table->size - 1)].inumber == FREE_INODE) {
+        entry->inumber = FREE_INODE;
     }
-    return FAIL;
+    else {
+        entry->inumber = DELETED_ENTRY;
+        dir->deleted++;
+    }
+    dir_entry_end(entry);
+    dir_set_tag(table, slot, entry->inumber == FREE_INODE ? DIR_TAG_FREE : DIR_TAG_DELETED);
+    dir->count--;
+    /* the name stays in the table until it is rebuilt */
+    dir->names -= length + 1;
+    return SUCCESS;
 }
 
 
@@ -170,42 +989,74 @@ int dir_reset_entry(int inumber, int sub_inumber) {
  * Input:
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
- *  - sub_name: name of the sub i-node entry 
+ *  - sub_name: name of the sub i-node entry (not necessarily terminated)
+ *  - length: length of the name
+ *  - hash: hash of the name
  * Returns: SUCCESS or FAIL
  */
-int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
+int dir_add_entry(int inumber, int sub_inumber, char *sub_name, int length, unsigned int hash) {
     /* Used for testing synchronization speedup */
-    insert_delay(DELAY);
+    INSERT_DELAY(DELAY_ADD_ENTRY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(inumber)) {
         printf("inode_add_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    if (inode_ref(inumber)->nodeType != T_DIRECTORY) {
         printf("inode_add_entry: can only add entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < 0) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(sub_inumber)) {
         printf("inode_add_entry: invalid entry inumber\n");
         return FAIL;
     }
 
-    if (strlen(sub_name) == 0 ) {
+    if (length == 0 || length >= MAX_FILE_NAME) {
         printf("inode_add_entry: \
-               entry name must be non-empty\n");
+               entry name must be non-empty and fit in MAX_FILE_NAME\n");
         return FAIL;
     }
-    
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == FREE_INODE) {
-            inode_table[inumber].data.dirEntries[i].inumber = sub_inumber;
-            strcpy(inode_table[inumber].data.dirEntries[i].name, sub_name);
-            return SUCCESS;
-        }
+
+    Directory *dir = inode_ref(inumber)->data.dir;
+
+    /* keep at least 1/4 of the slots free so probing stays short */
+    if (((dir->count + dir->deleted + 1) * 4 > dir->table->size * 3 ||
+         dir->table->names_used + length + 1 > dir->table->names_size) && dir_grow(dir, length + 1) == FAIL) {
+        printf("inode_add_entry: failed to grow directory\n");
+        return FAIL;
     }
-    return FAIL;
+
+    DirTable *table = dir->table;
+    unsigned int mask = table->size - 1;
+    unsigned int i = hash & mask;
+
+    /* the caller checked the name is not in the directory, so the first
+    removed or free slot of the probing can be used */
+    while (table->entries[i].inumber >= 0)
+        i = (i + 1) & mask;
+
+    DirEntry *entry = &table->entries[i];
+    char *name = DIR_TABLE_NAMES(table) + table->names_used;
+
+    if (entry->inumber == DELETED_ENTRY)
+        dir->deleted--;
+
+    /* the name is appended before the entry is published */
+    memcpy(name, sub_name, length);
+    name[length] = '\0';
+
+    dir_entry_begin(entry);
+    entry->inumber = sub_inumber;
+    entry->hash = hash;
+    entry->name = table->names_used;
+    dir_entry_end(entry);
+    dir_set_tag(table, i, DIR_TAG(hash));
+    table->names_used += length + 1;
+    dir->count++;
+    dir->names += length + 1;
+    return SUCCESS;
 }
 
 
@@ -216,21 +1067,54 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
  *  - name: pointer to the name of current file/dir
  */
 void inode_print_tree(FILE *fp, int inumber, char *name) {
-    if (inode_table[inumber].nodeType == T_FILE) {
+    if (inode_ref(inumber)->nodeType == T_FILE) {
         fprintf(fp, "%s\n", name);
         return;
     }
 
-    if (inode_table[inumber].nodeType == T_DIRECTORY) {
+    if (inode_ref(inumber)->nodeType == T_DIRECTORY) {
         fprintf(fp, "%s\n", name);
-        for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-            if (inode_table[inumber].data.dirEntries[i].inumber != FREE_INODE) {
-                char path[MAX_FILE_NAME];
-                if (snprintf(path, sizeof(path), "%s/%s", name, inode_table[inumber].data.dirEntries[i].name) > sizeof(path)) {
-                    fprintf(stderr, "truncation when building full path\n");
-                }
-                inode_print_tree(fp, inode_table[inumber].data.dirEntries[i].inumber, path);
+        DirTable *table = inode_ref(inumber)->data.dir->table;
+        for (int i = 0; i < table->size; i++) {
+            if (table->entries[i].inumber >= 0) {
+                char *entry_name = DIR_TABLE_NAMES(table) + table->entries[i].name;
+                char path[strlen(name) + strlen(entry_name) + 2];
+                sprintf(path, "%s/%s", name, entry_name);
+                inode_print_tree(fp, table->entries[i].inumber, path);
             }
         }
     }
 }
+
+/*
+ * Counts the i-nodes in use and the entries of the directories. No locks
+ * are taken, so the counts are only a snapshot while the table changes.
+ * Input:
+ *  - stats: where the counts are stored
+ */
+void inode_table_stats(InodeStats *stats) {
+    int count = __atomic_load_n(&inode_count, __ATOMIC_ACQUIRE);
+
+    memset(stats, 0, sizeof(InodeStats));
+    stats->allocated = count;
+
+    /* keeps the directories seen from being reclaimed */
+    epoch_enter();
+
+    for (int i = 0; i < count; i++) {
+        type nType = __atomic_load_n(&inode_ref(i)->nodeType, __ATOMIC_ACQUIRE);
+        Directory *dir;
+
+        if (nType == T_FILE)
+            stats->files++;
+        else if (nType == T_DIRECTORY && (dir = inode_dir(i)) != NULL) {
+            int entries = __atomic_load_n(&dir->count, __ATOMIC_RELAXED);
+            int bucket = entries <= 0 ? 0 : 32 - __builtin_clz(entries);
+
+            stats->directories++;
+            stats->dir_sizes[bucket < DIR_SIZE_BUCKETS ? bucket : DIR_SIZE_BUCKETS - 1]++;
+        }
+    }
+
+    epoch_leave();
+}
@@ -5,36 +5,135 @@
 #include <stdlib.h>
 #include "../../tecnicofs-api-constants.h"
 #include "pthread.h"
+#include "epoch.h"
 
 /* FS root inode number */
 #define FS_ROOT 0
 
 #define FREE_INODE -1
-#define INODE_TABLE_SIZE 50
-#define MAX_DIR_ENTRIES 20
+/* directory slot of a removed entry, skipped by lookups but reusable */
+#define DELETED_ENTRY -2
+/* i-nodes are allocated in chunks that never move once allocated */
+#define INODE_CHUNK_SHIFT 10
+#define INODE_CHUNK_SIZE (1 << INODE_CHUNK_SHIFT)
+#define INODE_MAX_CHUNKS 65536
+/* initial number of slots of a directory (must be a power of two) */
+#define DIR_INITIAL_SIZE 16
+/* initial bytes for the names of a directory */
+#define DIR_INITIAL_NAMES 256
 
-#define LOCKSVECTOR_SIZE 50
+#define LOCKSVECTOR_SIZE 128
+/* deepest path an operation can lock (a move locks two of them) */
+#define MAX_PATH_DEPTH (LOCKSVECTOR_SIZE / 2 - 1)
+
+/* size of the blocks of file data */
+#define FILE_BLOCK_SIZE 4096
+/* largest file */
+#define FILE_MAX_SIZE (65536 * FILE_BLOCK_SIZE)
 
 #define SUCCESS 0
 #define FAIL -1
 
 #define DELAY 50000
 
+/*
+ * Operations where a delay is injected for synchronization testing. The
+ * delays only exist in builds with TEST_DELAY (tecnicofs-test) and can be
+ * changed at runtime with the TECNICOFS_DELAY environment variable, either
+ * a number of cycles for every operation or a list such as
+ * "get=0,create=100000" (operations: create, delete, get, add, reset).
+ */
+enum delay_op { DELAY_CREATE, DELAY_DELETE, DELAY_GET, DELAY_ADD_ENTRY, DELAY_RESET_ENTRY, DELAY_OPS };
+
+#ifdef TEST_DELAY
+extern int delay_cycles[DELAY_OPS];
+#define INSERT_DELAY(op) insert_delay(delay_cycles[op])
+#else
+#define INSERT_DELAY(op)
+#endif
+
+
+/* hash of the names (FNV-1a), also computed incrementally by path_parse */
+#define NAME_HASH_INIT 2166136261u
+#define NAME_HASH_STEP(hash, c) (((hash) ^ (unsigned char) (c)) * 16777619u)
 
 /*
- * Contains the name of the entry and respective i-number
+ * Contains the hash of the name of the entry, the respective i-number and
+ * where the name is kept, so a slot is 16 bytes whatever the length of the
+ * name. The sequence number is odd while a writer changes the entry, so
+ * readers without locks can tell a changed entry apart (see dir_lookup).
  */
 typedef struct dirEntry {
-	char name[MAX_FILE_NAME];
+	unsigned int seq;
+	unsigned int hash;
 	int inumber;
+	unsigned int name; /* offset of the name in the names of the table */
 } DirEntry;
 
+/* tag of a slot: 7 bits of the hash of the name, or one of these */
+#define DIR_TAG_FREE 0x80
+#define DIR_TAG_DELETED 0xFE
+#define DIR_TAG(hash) ((unsigned char) ((hash) >> 25))
+/* tags repeated after the last slot, so a group of tags can be loaded
+from any slot (the widest group of dir_lookup) */
+#define DIR_TAGS_CLONED 32
+
+/*
+ * Ways dir_lookup probes a table: a slot at a time, or groups of 16 or 32
+ * tags compared at once (see dir_probe_set).
+ */
+enum dir_probe { DIR_PROBE_SLOTS, DIR_PROBE_SSE2, DIR_PROBE_AVX2, DIR_PROBES };
+
+/*
+ * Slots of a directory, followed by a tag for each slot (so a probe first
+ * compares the tags, many at once) and by the names of the entries
+ * (terminated) packed one after the other. Names are only appended, so the
+ * name of an entry stays in place while the table is in use. A table is
+ * replaced as a whole when it grows or its names run out, without the names
+ * of the removed entries, so the size always matches the entries.
+ */
+typedef struct dirTable {
+	int size; /* number of slots, a power of two */
+	int names_size; /* bytes for the names */
+	int names_used;
+	DirEntry entries[];
+} DirTable;
+
+/* the tags and the names of a table */
+#define DIR_TABLE_TAGS(table) ((unsigned char *) ((table)->entries + (table)->size))
+#define DIR_TABLE_NAMES(table) ((char *) DIR_TABLE_TAGS(table) + (table)->size + DIR_TAGS_CLONED)
+
 /*
- * Data is either text (file) or entries (DirEntry)
+ * Directory entries, kept in an open addressing hash table (linear probing)
+ * indexed by the hash of the names. The table doubles when it is 3/4 full.
+ * Writers hold the write lock of the directory, readers may take no lock
+ * at all and only rely on the epochs (see epoch.h) to keep the directory
+ * and its old tables around.
+ */
+typedef struct directory {
+	int count; /* entries in use */
+	int deleted; /* slots marked DELETED_ENTRY */
+	int names; /* bytes of the names of the entries in use */
+	DirTable *table;
+} Directory;
+
+/*
+ * Contents of a file, in blocks of FILE_BLOCK_SIZE, so a write only
+ * allocates the blocks it reaches and never copies the data already
+ * written. Blocks never written (holes) are NULL and read as zeros.
+ */
+typedef struct file {
+	int size;
+	int capacity; /* slots of the blocks table */
+	char **blocks;
+} File;
+
+/*
+ * Data is either text (file) or entries (Directory)
  */
 union Data {
-	char *fileContents; /* for files */
-	DirEntry *dirEntries; /* for directories */
+	File *file; /* for files, NULL while empty */
+	Directory *dir; /* for directories */
 };
 
 /*
@@ -44,20 +143,60 @@ typedef struct inode_t {
 	type nodeType;
 	union Data data;
 	pthread_rwlock_t rwlock;
+	int next_free; /* next i-node of the free list (while T_NONE) */
+	unsigned int generation; /* changed when it is deleted (or moved, if a directory) */
+	int opened; /* times the file is open, it can't be deleted meanwhile */
     /* more i-node attributes will be added in future exercises */
 } inode_t;
 
+extern inode_t *inode_chunks[INODE_MAX_CHUNKS];
+
+/* buckets of the sizes of the directories: 0 entries, then [2^(i-1), 2^i) */
+#define DIR_SIZE_BUCKETS 24
+
+/*
+ * Occupancy of the i-node table (see inode_table_stats).
+ */
+typedef struct inodeStats {
+	int allocated; /* i-nodes in the allocated chunks */
+	int files;
+	int directories;
+	int dir_sizes[DIR_SIZE_BUCKETS]; /* directories by number of entries */
+} InodeStats;
+
+/*
+ * Returns the i-node with the given inumber, which must be in the table.
+ */
+static inline inode_t *inode_ref(int inumber) {
+	return &inode_chunks[inumber >> INODE_CHUNK_SHIFT][inumber & (INODE_CHUNK_SIZE - 1)];
+}
+
 
 void insert_delay(int cycles);
+void delay_config(char *config);
 void inode_table_init();
 void inode_table_destroy();
 int inode_create(type nType);
 int inode_delete(int inumber);
 int inode_get(int inumber, type *nType, union Data *data);
-int inode_set_file(int inumber, char *fileContents, int len);
-int dir_reset_entry(int inumber, int sub_inumber);
-int dir_add_entry(int inumber, int sub_inumber, char *sub_name);
+Directory *inode_dir(int inumber);
+unsigned int inode_generation(int inumber);
+void inode_moved(int inumber);
+int inode_read(int inumber, int offset, char *buffer, int len);
+int inode_write(int inumber, int offset, char *buffer, int len);
+void inode_open(int inumber);
+void inode_close(int inumber);
+int inode_is_open(int inumber);
+unsigned int name_hash(char *name, int length);
+int dir_probe_set(int probe);
+char *dir_probe_name(int probe);
+Directory *dir_create(int size, int names_size);
+void dir_destroy(Directory *dir);
+int dir_lookup(Directory *dir, char *name, int length, unsigned int hash);
+int dir_reset_entry(int inumber, int sub_inumber, char *sub_name, int length, unsigned int hash);
+int dir_add_entry(int inumber, int sub_inumber, char *sub_name, int length, unsigned int hash);
 void inode_print_tree(FILE *fp, int inumber, char *name);
+void inode_table_stats(InodeStats *stats);
 
 
 #endif /* INODES_H */
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+#include "fs/state.h"
+#include "fs/lockprof.h"
+#include "fs/slab.h"
+#include "../tecnicofs-api-constants.h"
+
+/* only the owner thread writes a counter, the others may read it anytime */
+#define STATS_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+#define STATS_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+typedef struct operation_stats {
+    unsigned long count;
+    unsigned long failed;     /* with an error as result */
+    unsigned long nanoseconds;
+    unsigned long latency[STATS_BUCKETS];
+} operation_stats;
+
+/*
+ * Counters of a thread.
+ */
+typedef struct stats_thread {
+    operation_stats operations[STATS_OPCODES];
+    unsigned long dequeues;
+    unsigned long requests;   /* taken from the queue */
+    unsigned long depth[STATS_BUCKETS]; /* requests queued at each dequeue */
+} __attribute__((aligned(64))) stats_thread;
+
+static stats_thread *stats_threads[STATS_MAX_THREADS];
+static int stats_nthreads = 0;
+static __thread stats_thread *self = NULL;
+
+static char *opcode_names[STATS_OPCODES] = {
+    "other", "create", "delete", "lookup", "move", "print", "batch", "open", "close",
+    "read", "write", "read_bulk", "write_bulk", "ring", "stats"
+};
+
+/*
+ * Returns the counters of the calling thread, registering it on first use.
+ */
+static stats_thread *stats_self() {
+    if (self == NULL) {
+        int index = __atomic_fetch_add(&stats_nthreads, 1, __ATOMIC_ACQ_REL);
+        void *thread;
+
+        if (index >= STATS_MAX_THREADS || posix_memalign(&thread, 64, sizeof(stats_thread)) != 0) {
+            printf("stats: too many threads\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(thread, 0, sizeof(stats_thread));
+        __atomic_store_n(&stats_threads[index], thread, __ATOMIC_RELEASE);
+        self = thread;
+    }
+    return self;
+}
+
+static int stats_bucket(unsigned long value) {
+    int bucket = value == 0 ? 0 : 63 - __builtin_clzl(value);
+
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+/*
+ * Returns a monotonic time in nanoseconds.
+ */
+long stats_clock() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/*
+ * Counts an operation executed by the calling thread.
+ * Input:
+ *  - opcode: tfs_opcode of the operation
+ *  - failed: nonzero if its result is an error
+ *  - nanoseconds: time it took
+ */
+void stats_operation(int opcode, int failed, long nanoseconds) {
+    operation_stats *op;
+
+    /* invalid requests count as "other" */
+    if (opcode < 0 || opcode >= STATS_OPCODES || opcode_names[opcode] == NULL)
+        opcode = 0;
+    op = &stats_self()->operations[opcode];
+
+    if (nanoseconds < 0)
+        nanoseconds = 0;
+
+    STATS_ADD(op->count, 1);
+    STATS_ADD(op->failed, failed != 0);
+    STATS_ADD(op->nanoseconds, nanoseconds);
+    STATS_ADD(op->latency[stats_bucket(nanoseconds)], 1);
+}
+
+/*
+ * Counts the requests the calling thread took from the queue.
+ * Input:
+ *  - queued: requests in the queue, before they were taken
+ *  - taken: requests taken
+ */
+void stats_dequeue(int queued, int taken) {
+    stats_thread *thread = stats_self();
+
+    STATS_ADD(thread->dequeues, 1);
+    STATS_ADD(thread->requests, taken);
+    STATS_ADD(thread->depth[stats_bucket(queued)], 1);
+}
+
+/*
+ * Adds up the counters of all threads.
+ */
+static void stats_sum(stats_thread *sum) {
+    int nthreads = __atomic_load_n(&stats_nthreads, __ATOMIC_ACQUIRE);
+
+    memset(sum, 0, sizeof(stats_thread));
+
+    for (int i = 0; i < nthreads && i < STATS_MAX_THREADS; i++) {
+        stats_thread *thread = __atomic_load_n(&stats_threads[i], __ATOMIC_ACQUIRE);
+
+        /* still being registered */
+        if (thread == NULL)
+            continue;
+
+        for (int op = 0; op < STATS_OPCODES; op++) {
+            sum->operations[op].count += STATS_READ(thread->operations[op].count);
+            sum->operations[op].failed += STATS_READ(thread->operations[op].failed);
+            sum->operations[op].nanoseconds += STATS_READ(thread->operations[op].nanoseconds);
+            for (int b = 0; b < STATS_BUCKETS; b++)
+                sum->operations[op].latency[b] += STATS_READ(thread->operations[op].latency[b]);
+        }
+        sum->dequeues += STATS_READ(thread->dequeues);
+        sum->requests += STATS_READ(thread->requests);
+        for (int b = 0; b < STATS_BUCKETS; b++)
+            sum->depth[b] += STATS_READ(thread->depth[b]);
+    }
+}
+
+/*
+ * Returns the upper bound, in ns, of the bucket of a percentile.
+ */
+static double stats_percentile(operation_stats *op, double p) {
+    unsigned long rank = op->count * p, seen = 0;
+    int b;
+
+    for (b = 0; b < STATS_BUCKETS - 1; b++)
+        if ((seen += op->latency[b]) > rank)
+            break;
+    return (double) (1UL << (b + 1));
+}
+
+/* appends to the buffer, as much as fits */
+#define STATS_PRINT(...) \
+    (length += snprintf(buffer + length, length < size ? size - length : 0, __VA_ARGS__))
+
+static void stats_print_buckets(char *buffer, int size, int *lengthp, unsigned long *buckets, int n) {
+    int length = *lengthp;
+
+    STATS_PRINT("[");
+    for (int b = 0; b < n; b++)
+        STATS_PRINT(b == 0 ? "%lu" : ",%lu", buckets[b]);
+    STATS_PRINT("]");
+    *lengthp = length;
+}
+
+/*
+ * Writes the statistics of the server.
+ * Input:
+ *  - buffer: where they are written
+ *  - size: room in the buffer
+ *  - format: TFS_STATS_TEXT or TFS_STATS_JSON
+ *  - workers: number of worker threads
+ *  - queued: requests in the queue
+ *  - sessions: sessions open
+ * Returns: length written (truncated to size - 1 if it didn't fit)
+ */
+int stats_format(char *buffer, int size, int format, int workers, int queued, int sessions) {
+    static stats_thread sum;
+    static pthread_mutex_t sum_mutex = PTHREAD_MUTEX_INITIALIZER;
+    InodeStats inodes;
+    unsigned long dir_sizes[DIR_SIZE_BUCKETS];
+    int length = 0;
+
+    inode_table_stats(&inodes);
+    for (int b = 0; b < DIR_SIZE_BUCKETS; b++)
+        dir_sizes[b] = inodes.dir_sizes[b];
+
+    /* the sum is too large for the stack of a worker */
+    pthread_mutex_lock(&sum_mutex);
+    stats_sum(&sum);
+
+    if (format == TFS_STATS_JSON) {
+        STATS_PRINT("{\"workers\":%d,\"sessions\":%d,\"queued\":%d,\"dequeues\":%lu,\"requests\":%lu,"
+                    "\"queue_depth\":", workers, sessions, queued, sum.dequeues, sum.requests);
+        stats_print_buckets(buffer, size, &length, sum.depth, STATS_BUCKETS);
+        STATS_PRINT(",\"operations\":{");
+        for (int op = 0, first = 1; op < STATS_OPCODES; op++) {
+            operation_stats *o = &sum.operations[op];
+
+            if (o->count == 0)
+                continue;
+            STATS_PRINT("%s\"%s\":{\"count\":%lu,\"failed\":%lu,\"nanoseconds\":%lu,\"latency\":",
+                        first ? "" : ",", opcode_names[op], o->count, o->failed, o->nanoseconds);
+            stats_print_buckets(buffer, size, &length, o->latency, STATS_BUCKETS);
+            STATS_PRINT("}");
+            first = 0;
+        }
+        STATS_PRINT("},\"inodes\":{\"allocated\":%d,\"files\":%d,\"directories\":%d,\"directory_sizes\":",
+                    inodes.allocated, inodes.files, inodes.directories);
+        stats_print_buckets(buffer, size, &length, dir_sizes, DIR_SIZE_BUCKETS);
+        STATS_PRINT("},\"slab_bytes\":%zu", slab_mapped());
+#ifdef LOCK_PROFILE
+        STATS_PRINT(",\"locks\":");
+        length += lockprof_report(buffer + length, length < size ? size - length : 0, format);
+#endif
+        STATS_PRINT("}\n");
+    }
+    else {
+        STATS_PRINT("%d workers, %d sessions, %d requests queued\n", workers, sessions, queued);
+        STATS_PRINT("%lu requests taken from the queue in %lu dequeues (%.1f each)\n", sum.requests,
+                    sum.dequeues, sum.dequeues ? (double) sum.requests / sum.dequeues : 0.0);
+        STATS_PRINT("%-10s %10s %10s %10s %10s %10s %10s\n", "operation", "count", "failed",
+                    "mean us", "p50 us", "p99 us", "p99.9 us");
+        for (int op = 0; op < STATS_OPCODES; op++) {
+            operation_stats *o = &sum.operations[op];
+
+            if (o->count == 0)
+                continue;
+            STATS_PRINT("%-10s %10lu %10lu %10.1f %10.1f %10.1f %10.1f\n", opcode_names[op], o->count,
+                        o->failed, o->nanoseconds / 1000.0 / o->count, stats_percentile(o, 0.5) / 1000,
+                        stats_percentile(o, 0.99) / 1000, stats_percentile(o, 0.999) / 1000);
+        }
+        STATS_PRINT("i-nodes: %d allocated, %d files, %d directories\n", inodes.allocated,
+                    inodes.files, inodes.directories);
+        STATS_PRINT("entries of the directories:");
+        for (int b = 0; b < DIR_SIZE_BUCKETS; b++) {
+            if (dir_sizes[b] == 0)
+                continue;
+            if (b <= 1)
+                STATS_PRINT(" %d: %lu", b, dir_sizes[b]);
+            else
+                STATS_PRINT(" %d-%d: %lu", 1 << (b - 1), (1 << b) - 1, dir_sizes[b]);
+        }
+        STATS_PRINT("\n");
+        STATS_PRINT("slabs of directories and file data: %zu KB\n", slab_mapped() / 1024);
+#ifdef LOCK_PROFILE
+        length += lockprof_report(buffer + length, length < size ? size - length : 0, format);
+#endif
+    }
+
+    pthread_mutex_unlock(&sum_mutex);
+
+    return length < size ? length : size - 1;
+}
@@ -0,0 +1,23 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Statistics of the server. Each thread counts in its own counters (no
+ * shared cache lines, no atomic read-modify-writes), which are only added
+ * up when the statistics are requested (TFS_OP_STATS). Latencies go to
+ * histograms with a bucket for each power of two of nanoseconds.
+ */
+
+/* threads that can count */
+#define STATS_MAX_THREADS 1024
+/* opcodes counted, the others count as 0 */
+#define STATS_OPCODES 32
+/* bucket i holds [2^i, 2^(i+1)) (ns or requests), the last one the rest */
+#define STATS_BUCKETS 40
+
+long stats_clock();
+void stats_operation(int opcode, int failed, long nanoseconds);
+void stats_dequeue(int queued, int taken);
+int stats_format(char *buffer, int size, int format, int workers, int queued, int sessions);
+
+#endif /* STATS_H */
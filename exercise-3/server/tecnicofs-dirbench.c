@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "fs/state.h"
+#include "fs/epoch.h"
+#include "../tecnicofs-api-constants.h"
+
+/*
+ * Microbenchmark of the lookups in a directory: builds directories with
+ * a growing number of entries, optionally replaces part of them with
+ * entries of other names (leaving removed slots in the tables), and times
+ * dir_lookup of names in the directory (hits) and not in it (misses) with
+ * each way of probing the processor can run (see dir_probe_set).
+ */
+
+#define MAX_SIZES 16
+
+int sizes[MAX_SIZES] = { 16, 256, 4096, 65536 };
+int nsizes = 4;
+int lookups = 2000000;
+int churn = 0;               /* percentage of the entries replaced */
+
+static void displayUsage (const char* appName) {
+    printf("Usage: %s [options]\n"
+           "  -e n[,n...]       entries of the directories (16,256,4096,65536)\n"
+           "  -l lookups        of each run (2000000)\n"
+           "  -c percentage     of the entries replaced before the runs (0)\n",
+           appName);
+    exit(EXIT_FAILURE);
+}
+
+static void parseArgs (long argc, char* const argv[]) {
+
+    int opt;
+
+    while ((opt = getopt(argc, argv, "e:l:c:")) != -1) {
+        switch (opt) {
+            case 'e':
+                nsizes = 0;
+                for (char *size = strtok(optarg, ","); size != NULL && nsizes < MAX_SIZES;
+                     size = strtok(NULL, ","))
+                    sizes[nsizes++] = atoi(size);
+                break;
+            case 'l': lookups = atoi(optarg); break;
+            case 'c': churn = atoi(optarg); break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    if (optind != argc || nsizes == 0 || lookups <= 0 || churn < 0 || churn > 100) {
+        fprintf(stderr, "Error: invalid option\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nsizes; i++) {
+        if (sizes[i] <= 0) {
+            fprintf(stderr, "Error: invalid option\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static long nanoseconds() {
+
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/* xorshift64* */
+static unsigned long nextRandom(unsigned long *state) {
+
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717UL;
+}
+
+/*
+ * Adds an entry for a new file to a directory.
+ */
+static void addEntry(int parent, char *name) {
+
+    int child = inode_create(T_FILE);
+    int length = strlen(name);
+
+    if (child == FAIL || dir_add_entry(parent, child, name, length, name_hash(name, length)) == FAIL) {
+        fprintf(stderr, "Error: can't add %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Times the lookups of a set of names.
+ * Returns: ns for each lookup
+ */
+static double timeLookups(Directory *dir, char (*names)[MAX_FILE_NAME], unsigned int *hashes,
+                          int count, int expected) {
+
+    unsigned long state = 88172645463325252UL;
+    int *order = malloc(sizeof(int) * lookups);
+    int found = 0;
+    long start;
+
+    if (order == NULL) {
+        fprintf(stderr, "Error: no memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < lookups; i++)
+        order[i] = nextRandom(&state) % count;
+
+    epoch_enter();
+    start = nanoseconds();
+    for (int i = 0; i < lookups; i++) {
+        int k = order[i];
+
+        found += dir_lookup(dir, names[k], strlen(names[k]), hashes[k]) != FAIL;
+    }
+    start = nanoseconds() - start;
+    epoch_leave();
+
+    free(order);
+
+    if (found != (expected ? lookups : 0)) {
+        fprintf(stderr, "Error: %d of %d lookups found\n", found, lookups);
+        exit(EXIT_FAILURE);
+    }
+    return (double) start / lookups;
+}
+
+int main(int argc, char* argv[]) {
+
+    parseArgs(argc, argv);
+    inode_table_init();
+
+    printf("%-10s %-8s %10s %10s\n", "entries", "probe", "hit ns", "miss ns");
+
+    for (int s = 0; s < nsizes; s++) {
+        int n = sizes[s];
+        int parent = inode_create(T_DIRECTORY);
+        char (*hits)[MAX_FILE_NAME] = malloc(MAX_FILE_NAME * n);
+        char (*misses)[MAX_FILE_NAME] = malloc(MAX_FILE_NAME * n);
+        unsigned int *hitHashes = malloc(sizeof(unsigned int) * n);
+        unsigned int *missHashes = malloc(sizeof(unsigned int) * n);
+        int removed = (long) n * churn / 100;
+
+        if (parent == FAIL || !hits || !misses || !hitHashes || !missHashes) {
+            fprintf(stderr, "Error: no memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < n; i++) {
+            snprintf(hits[i], MAX_FILE_NAME, "file%d", i);
+            snprintf(misses[i], MAX_FILE_NAME, "none%d", i);
+            hitHashes[i] = name_hash(hits[i], strlen(hits[i]));
+            missHashes[i] = name_hash(misses[i], strlen(misses[i]));
+            addEntry(parent, hits[i]);
+        }
+
+        /* the removed entries leave removed slots behind, until the table
+        is rebuilt */
+        for (int i = 0; i < removed; i++) {
+            int k = i * (n / removed);
+            int length = strlen(hits[k]);
+            int child = dir_lookup(inode_dir(parent), hits[k], length, hitHashes[k]);
+
+            if (dir_reset_entry(parent, child, hits[k], length, hitHashes[k]) == FAIL) {
+                fprintf(stderr, "Error: can't remove %s\n", hits[k]);
+                exit(EXIT_FAILURE);
+            }
+            inode_delete(child);
+
+            snprintf(hits[k], MAX_FILE_NAME, "more%d", i);
+            hitHashes[k] = name_hash(hits[k], strlen(hits[k]));
+            addEntry(parent, hits[k]);
+        }
+
+        for (int probe = 0; probe < DIR_PROBES; probe++) {
+            if (dir_probe_set(probe) == FAIL)
+                continue;
+            double hit = timeLookups(inode_dir(parent), hits, hitHashes, n, 1);
+            double miss = timeLookups(inode_dir(parent), misses, missHashes, n, 0);
+
+            printf("%-10d %-8s %10.1f %10.1f\n", n, dir_probe_name(probe), hit, miss);
+        }
+
+        free(hits);
+        free(misses);
+        free(hitHashes);
+        free(missHashes);
+    }
+
+    inode_table_destroy();
+    exit(EXIT_SUCCESS);
+}
@@ -1,3 +1,6 @@
+/* recvmmsg, sendmmsg and memfd_create */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
@@ -10,19 +13,129 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <ctype.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
 #include <strings.h>
 
 #include "fs/operations.h"
+#include "stats.h"
 
-pthread_mutex_t mutexglobal = PTHREAD_MUTEX_INITIALIZER;
 int numberThreads = 0;
 
+/* capacity of the request queue */
+#define MAX_REQUESTS 256
+/* datagrams read by each recvmmsg */
+#define RECV_BATCH 32
+/* requests taken from the queue by a worker at once */
+#define WORK_BATCH 16
+/* events handled by each epoll_wait */
+#define MAX_EVENTS 8
+/* requests of a session queued or executing, before its reading stops */
+#define MAX_SESSION_REQUESTS 64
+/* sessions with shared memory rings */
+#define MAX_RINGS 64
+/* polls of the rings, after their last request, before the dispatcher sleeps */
+#define RING_SPINS 2000
+
+#define SESSION_DATAGRAM 0
+#define SESSION_LISTENER 1
+#define SESSION_CONNECTION 2
+#define SESSION_RING 3
+
+/*
+ * File open in a session, the file descriptor is its position in the table
+ * of the session.
+ */
+typedef struct openFile {
+    int inumber;            /* EMPTY if the descriptor is free, BUSY while opening */
+    permission mode;
+    int offset;             /* where the next read or write starts */
+    int used;               /* a read or write is moving the offset */
+} openFile;
+
+/*
+ * Socket the dispatcher reads from: the datagram socket, the listening
+ * socket of the sessions or the connection of a session. The shared memory
+ * rings of a session (see tfs_shm) are read like another connection, whose
+ * fd is the eventfd that wakes the server.
+ */
+typedef struct session {
+    int type;
+    int fd;
+    int refs;               /* connections and rings: the dispatcher and each request */
+    int pending;            /* requests queued or executing */
+    int throttled;          /* reading stopped, too many pending requests */
+    int closed;             /* no longer read, its events left are skipped */
+    struct session *nextClosed; /* closed, released after the events of the dispatcher */
+    pthread_mutex_t mutex;
+    openFile files[TFS_MAX_OPEN_FILES]; /* connections */
+    pthread_cond_t unused;  /* connections: a descriptor is no longer used */
+    struct session *ring;   /* connections: their rings, if any */
+    struct session *connection; /* rings: the session they belong to */
+    tfs_shm *shm;           /* rings */
+    int clientEvent;        /* rings: eventfd that wakes the client */
+    uint32_t requestHead;   /* rings: the indexes owned by the server, the */
+    uint32_t responseTail;  /* copies in shared memory can't be trusted */
+} session;
+
+session datagramSession = { SESSION_DATAGRAM };
+session listenerSession = { SESSION_LISTENER };
+int epollfd;
+
+/* connections open, for the statistics */
+int numberSessions = 0;
+
+/* sessions closed by the dispatcher, which keeps them until it is done
+with the events already returned by epoll_wait (they may be among them) */
+session *closedSessions = NULL;
+
+/* sessions with rings, only used by the dispatcher */
+session *rings[MAX_RINGS];
+int numberRings = 0;
+/* RING_SPINS on multiprocessors, 0 otherwise (the client needs the processor) */
+int ringSpins;
+
+/* request received from a client, waiting for a worker */
+typedef struct request {
+    session *session;
+    struct sockaddr_un client_addr;     /* datagrams */
+    socklen_t client_addrlen;
+    int fd;                 /* descriptor passed with the request (bulk write), or -1 */
+    uint32_t message[];     /* tfs_header followed by the payload */
+} request;
+
+/*
+ * What a request brings besides its message, and its response besides the
+ * results.
+ */
+typedef struct transfer {
+    int received;           /* descriptor passed with the request, or -1 */
+    int sent;               /* descriptor passed with the response (bulk read), or -1 */
+    char data[TFS_MAX_READ]; /* data read */
+} transfer;
+
+/* control message with a single descriptor */
+typedef union fdControl {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+} fdControl;
+
+/* requests are queued by the dispatcher and taken by the workers */
+request *requestQueue[MAX_REQUESTS];
+int numberRequests = 0, enqueueptr = 0, dequeueptr = 0;
+pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t canEnqueue = PTHREAD_COND_INITIALIZER;
+pthread_cond_t canDequeue = PTHREAD_COND_INITIALIZER;
+
 extern int sockfd;
+extern int sessionfd;
 extern struct sockaddr_un server_addr;
-socklen_t addrlen;
 
 static void displayUsage (const char* appName) {
     printf("Usage: %s number_of_threads server_socket_name\n", appName);
@@ -55,120 +168,1270 @@ static void parseArgs(long argc, char* const argv[]){
     }
 }
 
-char *receiveCommand(struct sockaddr_un *client_addr) {
+/*
+ * Reads the next argument of a request. The argument is used in place, it
+ * is already terminated by the client.
+ * Input:
+ *  - request: the request
+ *  - offset: offset of the argument in the payload, moved to the next one
+ *  - argLength: where the length of the argument is stored, if not NULL
+ *    (for data that may contain '\0')
+ * Returns: the argument or NULL if the request is malformed
+ */
+char *requestArg(tfs_header *request, uint32_t *offset, int *argLength) {
 
-    struct sockaddr_un thisclient_addr;
-    char *command;
-    char in_buffer[MAX_INPUT_SIZE];
-    int c;
+    char *payload = (char *) (request + 1);
+    tfs_arglen length;
+    char *arg;
 
-    addrlen = sizeof(struct sockaddr_un);
-    c = recvfrom(sockfd, in_buffer, sizeof(in_buffer)-1, 0,
-        (struct sockaddr *)&thisclient_addr, &addrlen);
+    if (*offset + sizeof(tfs_arglen) > request->length)
+        return NULL;
 
-    if (c <= 0) return NULL;
-    //Preventivo, caso o cliente nao tenha terminado a mensagem em '\0', 
-    in_buffer[c]='\0';
+    memcpy(&length, payload + *offset, sizeof(tfs_arglen));
+    arg = payload + *offset + sizeof(tfs_arglen);
 
-    *client_addr = thisclient_addr;
-    command = in_buffer;
+    if (*offset + sizeof(tfs_arglen) + length + 1 > request->length || arg[length] != '\0')
+        return NULL;
 
-    return command;
+    *offset += sizeof(tfs_arglen) + length + 1;
+    if (argLength != NULL)
+        *argLength = length;
+    return arg;
 }
 
-void errorParse(){
-    fprintf(stderr, "Error: command invalid\n");
-    exit(EXIT_FAILURE);
+/*
+ * Reads the next numeric argument of a request.
+ * Input:
+ *  - request: the request
+ *  - offset: offset of the argument in the payload, moved to the next one
+ *  - value: where the argument is stored
+ * Returns: SUCCESS or FAIL if the request is malformed
+ */
+int requestInt(tfs_header *request, uint32_t *offset, tfs_argint *value) {
+
+    char *payload = (char *) (request + 1);
+
+    if (*offset + sizeof(tfs_argint) > request->length)
+        return FAIL;
+
+    memcpy(value, payload + *offset, sizeof(tfs_argint));
+    *offset += sizeof(tfs_argint);
+    return SUCCESS;
 }
 
-void *applyCommands(){
-    while (1){
-        
-        struct sockaddr_un client_addr;
-        char command_[MAX_INPUT_SIZE];
+/*
+ * Opens a file in a session.
+ * Input:
+ *  - s: the session
+ *  - name: path of the file
+ *  - mode: permission the file is opened with
+ * Returns: the file descriptor or a TECNICOFS_ERROR_* code
+ */
+int sessionOpen(session *s, char *name, int mode) {
 
-        const char *command = receiveCommand(&client_addr);
+    int fd, inumber;
 
-        if (command == NULL)
-            continue;
-        
-        strcpy(command_, command);
+    if (s->type != SESSION_CONNECTION)
+        return TECNICOFS_ERROR_NO_OPEN_SESSION;
 
-        char token;
-        char name[MAX_INPUT_SIZE], type[MAX_INPUT_SIZE];
+    if (mode != READ && mode != WRITE && mode != RW)
+        return TECNICOFS_ERROR_INVALID_MODE;
 
-        int numTokens = sscanf(command_, "%c %s %s", &token, name, type);
+    /* the descriptor is taken first, the file can't be left open without one
+    (nor can one closed while a read or write still uses it be reused) */
+    pthread_mutex_lock(&s->mutex);
+    for (fd = 0; fd < TFS_MAX_OPEN_FILES && (s->files[fd].inumber != EMPTY || s->files[fd].used); fd++)
+        ;
+    if (fd < TFS_MAX_OPEN_FILES)
+        s->files[fd].inumber = BUSY;
+    pthread_mutex_unlock(&s->mutex);
 
-        if (numTokens < 2) {
-            fprintf(stderr, "Error: invalid command in Queue\n");
-            exit(EXIT_FAILURE);
-        }
+    if (fd == TFS_MAX_OPEN_FILES)
+        return TECNICOFS_ERROR_MAXED_OPEN_FILES;
+
+    inumber = open_file(name);
+
+    pthread_mutex_lock(&s->mutex);
+    s->files[fd] = (openFile) { inumber < 0 ? EMPTY : inumber, mode, 0, 0 };
+    pthread_mutex_unlock(&s->mutex);
+
+    return inumber < 0 ? inumber : fd;
+}
+
+/*
+ * Closes a file descriptor of a session.
+ * Input:
+ *  - s: the session
+ *  - fd: the file descriptor
+ * Returns: SUCCESS or a TECNICOFS_ERROR_* code
+ */
+int sessionClose(session *s, int fd) {
+
+    int inumber;
+
+    if (s->type != SESSION_CONNECTION)
+        return TECNICOFS_ERROR_NO_OPEN_SESSION;
+
+    if (fd >= TFS_MAX_OPEN_FILES)
+        return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+    pthread_mutex_lock(&s->mutex);
+    inumber = s->files[fd].inumber;
+    if (inumber >= 0)
+        s->files[fd].inumber = EMPTY;
+    pthread_mutex_unlock(&s->mutex);
+
+    if (inumber < 0)
+        return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+    close_file(inumber);
+    return SUCCESS;
+}
+
+/*
+ * Takes an open file of a session for a read or write. The file is kept
+ * open until sessionRelease, even if the descriptor is closed meanwhile.
+ * The reads and writes of a descriptor take turns, each one starting where
+ * the one before left the offset.
+ * Input:
+ *  - s: the session
+ *  - fd: the file descriptor
+ *  - mode: permission the operation needs (READ or WRITE)
+ *  - file: where the open file is copied
+ * Returns: SUCCESS or a TECNICOFS_ERROR_* code
+ */
+int sessionFile(session *s, int fd, int mode, openFile *file) {
+
+    int res = SUCCESS;
+
+    if (s->type != SESSION_CONNECTION)
+        return TECNICOFS_ERROR_NO_OPEN_SESSION;
+
+    if (fd >= TFS_MAX_OPEN_FILES)
+        return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+    pthread_mutex_lock(&s->mutex);
+    while (s->files[fd].inumber >= 0 && s->files[fd].used)
+        pthread_cond_wait(&s->unused, &s->mutex);
+    *file = s->files[fd];
+    if (file->inumber < 0)
+        res = TECNICOFS_ERROR_FILE_NOT_OPEN;
+    else if ((file->mode & mode) == 0)
+        res = TECNICOFS_ERROR_INVALID_MODE;
+    else {
+        inode_open(file->inumber);
+        s->files[fd].used = 1;
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    return res;
+}
+
+/*
+ * Releases a file taken with sessionFile, moving the offset of its
+ * descriptor past the bytes transferred, and lets the next read or write
+ * of the descriptor go.
+ * Input:
+ *  - s: the session
+ *  - fd: the file descriptor
+ *  - file: the open file
+ *  - transferred: bytes read or written, or a TECNICOFS_ERROR_* code
+ */
+void sessionRelease(session *s, int fd, openFile *file, int transferred) {
+
+    pthread_mutex_lock(&s->mutex);
+    if (transferred > 0 && s->files[fd].inumber == file->inumber)
+        s->files[fd].offset = file->offset + transferred;
+    s->files[fd].used = 0;
+    pthread_cond_broadcast(&s->unused);
+    pthread_mutex_unlock(&s->mutex);
+
+    close_file(file->inumber);
+}
+
+/*
+ * Reads from an open file into a new memfd, sealed so the client can map
+ * it without the data going through the socket.
+ * Input:
+ *  - inumber: inumber of the file
+ *  - offset: where the read starts
+ *  - len: number of bytes to read
+ *  - memfd: where the memfd is stored
+ * Returns: number of bytes read or a TECNICOFS_ERROR_* code
+ */
+int readBulk(int inumber, int offset, int len, int *memfd) {
+
+    int fd = memfd_create("tecnicofs-read", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    char *map = NULL;
+    int res;
+
+    if (fd < 0) {
+        perror("server: memfd_create error");
+        return TECNICOFS_ERROR_OTHER;
+    }
+
+    if (len > FILE_MAX_SIZE)
+        len = FILE_MAX_SIZE;
+
+    /* the memfd only takes memory for the pages written */
+    if (ftruncate(fd, len) < 0 ||
+        (len > 0 && (map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)) {
+        close(fd);
+        return TECNICOFS_ERROR_NO_SPACE;
+    }
+
+    res = len > 0 ? read_file(inumber, offset, map, len) : 0;
+    if (len > 0)
+        munmap(map, len);
+
+    /* the writable mapping must be gone before F_SEAL_WRITE */
+    if (res < 0 || ftruncate(fd, res) < 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        close(fd);
+        return res < 0 ? res : TECNICOFS_ERROR_OTHER;
+    }
+
+    *memfd = fd;
+    return res;
+}
+
+/*
+ * Writes to an open file the data of a memfd passed by the client.
+ * Input:
+ *  - inumber: inumber of the file
+ *  - offset: where the write starts
+ *  - len: number of bytes to write
+ *  - memfd: the memfd
+ * Returns: number of bytes written or a TECNICOFS_ERROR_* code
+ */
+int writeBulk(int inumber, int offset, int len, int memfd) {
 
-        int searchResult;
-        int operationResult;
-        
-        switch (token) {
-            case 'c':
-                switch (type[0]) {
-                    case 'f':
-                        pthread_mutex_lock(&mutexglobal);
-                        printf("Create file: %s\n", name);
-                        operationResult = create(name, T_FILE);
-                        pthread_mutex_unlock(&mutexglobal);
-                        break;
-                    case 'd':
-                        pthread_mutex_lock(&mutexglobal);
-                        printf("Create directory: %s\n", name);
-                        operationResult = create(name, T_DIRECTORY);
-                        pthread_mutex_unlock(&mutexglobal);
-                        break;
-                    default: {
-                        fprintf(stderr, "Error: invalid node type\n");
-                        exit(EXIT_FAILURE);
-                    }
+    struct stat st;
+    char *map;
+    int seals, res;
+
+    /* the client could otherwise shrink it while it is mapped (SIGBUS) */
+    if (memfd < 0 || (seals = fcntl(memfd, F_GET_SEALS)) < 0 ||
+        (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE) ||
+        fstat(memfd, &st) < 0 || st.st_size < len)
+        return TECNICOFS_ERROR_INVALID_REQUEST;
+
+    if (len == 0)
+        return 0;
+
+    if ((map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, memfd, 0)) == MAP_FAILED)
+        return TECNICOFS_ERROR_NO_SPACE;
+
+    res = write_file(inumber, offset, map, len);
+    munmap(map, len);
+
+    return res;
+}
+
+/*
+ * Executes an operation of a request.
+ * Input:
+ *  - s: session of the request
+ *  - opcode: operation
+ *  - arg: small argument of the operation (node type, permission or file
+ *    descriptor)
+ *  - request: the request with the arguments
+ *  - offset: offset of the arguments in the payload, moved past them
+ *  - result: where the result of the operation is stored
+ *  - t: the descriptors passed and the data read, NULL if the operation
+ *    is part of a batch
+ * Returns: SUCCESS or FAIL if the arguments can't be read
+ */
+int executeOperation(session *s, uint8_t opcode, uint8_t arg, tfs_header *request, uint32_t *offset,
+                     tfs_result *result, transfer *t) {
+
+    char *name = NULL, *newname;
+    int locks_vector[LOCKSVECTOR_SIZE];
+    int searchResult, res, length;
+    tfs_argint count;
+    openFile file;
+
+    result->status = SUCCESS;
+    result->value = 0;
+
+    /* the operations on open files have no path */
+    if (opcode != TFS_OP_CLOSE && opcode != TFS_OP_READ && opcode != TFS_OP_WRITE &&
+        opcode != TFS_OP_READ_BULK && opcode != TFS_OP_WRITE_BULK && opcode != TFS_OP_STATS &&
+        (name = requestArg(request, offset, NULL)) == NULL) {
+        fprintf(stderr, "Error: invalid request\n");
+        result->status = TECNICOFS_ERROR_INVALID_REQUEST;
+        return FAIL;
+    }
+
+    switch (opcode) {
+        case TFS_OP_CREATE:
+            switch (arg) {
+                case T_FILE:
+                    printf("Create file: %s\n", name);
+                    result->status = create(name, T_FILE);
+                    break;
+                case T_DIRECTORY:
+                    printf("Create directory: %s\n", name);
+                    result->status = create(name, T_DIRECTORY);
+                    break;
+                default: {
+                    fprintf(stderr, "Error: invalid node type\n");
+                    result->status = TECNICOFS_ERROR_INVALID_REQUEST;
                 }
+            }
+            break;
+        case TFS_OP_LOOKUP:
+            init_locks_vector(locks_vector);
+            searchResult = lookup(name, locks_vector, FIND);
+            if (searchResult >= 0) {
+                printf("Search: %s found\n", name);
+                result->value = searchResult;
+            }
+            else {
+                printf("Search: %s not found\n", name);
+                result->status = TECNICOFS_ERROR_FILE_NOT_FOUND;
+            }
+            break;
+        case TFS_OP_DELETE:
+            printf("Delete: %s\n", name);
+            result->status = delete(name);
+            break;
+
+        case TFS_OP_MOVE:
+            if ((newname = requestArg(request, offset, NULL)) == NULL) {
+                fprintf(stderr, "Error: invalid request\n");
+                result->status = TECNICOFS_ERROR_INVALID_REQUEST;
+                return FAIL;
+            }
+            printf("Move: %s to %s\n", name, newname);
+            result->status = move(name, newname);
+            break;
+
+        case TFS_OP_PRINT:
+            printf("Print to file: %s\n", name);
+            result->status = print(name);
+            break;
+
+        case TFS_OP_OPEN:
+            printf("Open: %s\n", name);
+            res = sessionOpen(s, name, arg);
+            if (res >= 0)
+                result->value = res;
+            else
+                result->status = res;
+            break;
+
+        case TFS_OP_CLOSE:
+            printf("Close: %d\n", arg);
+            result->status = sessionClose(s, arg);
+            break;
+
+        case TFS_OP_READ:
+            if (requestInt(request, offset, &count) == FAIL) {
+                fprintf(stderr, "Error: invalid request\n");
+                result->status = TECNICOFS_ERROR_INVALID_REQUEST;
+                return FAIL;
+            }
+            /* the data has no room in the response of a batch */
+            if (t == NULL) {
+                fprintf(stderr, "Error: read in a batch\n");
+                result->status = TECNICOFS_ERROR_INVALID_REQUEST;
                 break;
-            case 'l':
-                pthread_mutex_lock(&mutexglobal);
-                searchResult = lookup(name);
-                operationResult = searchResult;
-                if (searchResult >= 0)
-                    printf("Search: %s found\n", name);
-                else
-                    printf("Search: %s not found\n", name);
-                pthread_mutex_unlock(&mutexglobal);
-                break;
-            case 'd':
-                pthread_mutex_lock(&mutexglobal);
-                printf("Delete: %s\n", name);
-                operationResult = delete(name);
-                pthread_mutex_unlock(&mutexglobal);
+            }
+            printf("Read: %d\n", arg);
+            if ((res = sessionFile(s, arg, READ, &file)) == SUCCESS) {
+                res = read_file(file.inumber, file.offset, t->data, count < TFS_MAX_READ ? count : TFS_MAX_READ);
+                sessionRelease(s, arg, &file, res);
+            }
+            if (res >= 0)
+                result->value = res;
+            else
+                result->status = res;
+            break;
+
+        case TFS_OP_WRITE:
+            if ((newname = requestArg(request, offset, &length)) == NULL) {
+                fprintf(stderr, "Error: invalid request\n");
+                result->status = TECNICOFS_ERROR_INVALID_REQUEST;
+                return FAIL;
+            }
+            printf("Write: %d\n", arg);
+            if ((res = sessionFile(s, arg, WRITE, &file)) == SUCCESS) {
+                res = write_file(file.inumber, file.offset, newname, length);
+                sessionRelease(s, arg, &file, res);
+            }
+            if (res >= 0)
+                result->value = res;
+            else
+                result->status = res;
+            break;
+
+        case TFS_OP_READ_BULK:
+        case TFS_OP_WRITE_BULK:
+            if (requestInt(request, offset, &count) == FAIL) {
+                fprintf(stderr, "Error: invalid request\n");
+                result->status = TECNICOFS_ERROR_INVALID_REQUEST;
+                return FAIL;
+            }
+            /* a message passes a single descriptor */
+            if (t == NULL) {
+                fprintf(stderr, "Error: bulk transfer in a batch\n");
+                result->status = TECNICOFS_ERROR_INVALID_REQUEST;
                 break;
+            }
+            if (count > FILE_MAX_SIZE)
+                count = FILE_MAX_SIZE;
+            if (opcode == TFS_OP_READ_BULK) {
+                printf("Read bulk: %d\n", arg);
+                if ((res = sessionFile(s, arg, READ, &file)) == SUCCESS) {
+                    res = readBulk(file.inumber, file.offset, count, &t->sent);
+                    sessionRelease(s, arg, &file, res);
+                }
+            }
+            else {
+                printf("Write bulk: %d\n", arg);
+                if ((res = sessionFile(s, arg, WRITE, &file)) == SUCCESS) {
+                    res = writeBulk(file.inumber, file.offset, count, t->received);
+                    sessionRelease(s, arg, &file, res);
+                }
+            }
+            if (res >= 0)
+                result->value = res;
+            else
+                result->status = res;
+            break;
 
-            case 'm':
-                pthread_mutex_lock(&mutexglobal);
-                printf("Move: %s to %s\n", name, type);
-                operationResult = move(name, type);
-                pthread_mutex_unlock(&mutexglobal);
+        case TFS_OP_STATS:
+            /* the statistics go like the data of a read */
+            if (t == NULL) {
+                fprintf(stderr, "Error: statistics in a batch\n");
+                result->status = TECNICOFS_ERROR_INVALID_REQUEST;
                 break;
+            }
+            result->value = stats_format(t->data, TFS_MAX_READ, arg, numberThreads,
+                                         __atomic_load_n(&numberRequests, __ATOMIC_RELAXED),
+                                         __atomic_load_n(&numberSessions, __ATOMIC_RELAXED));
+            break;
+
+        default: { /* error, the arguments of the operation are unknown */
+            fprintf(stderr, "Error: invalid request\n");
+            result->status = TECNICOFS_ERROR_INVALID_REQUEST;
+            return FAIL;
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+ * Executes a request, a single operation or a batch of them.
+ * Input:
+ *  - s: session of the request
+ *  - request: the request
+ *  - results: where the results of the operations are stored (room for
+ *    TFS_MAX_BATCH)
+ *  - t: the descriptors passed and the data read
+ * Returns: number of results
+ */
+int executeRequest(session *s, tfs_header *request, tfs_result *results, transfer *t) {
+
+    char *payload = (char *) (request + 1);
+    uint32_t offset = 0;
+    tfs_batch_op op;
+    int i;
+
+    /* the files of the rings are those of their session */
+    if (s->type == SESSION_RING)
+        s = s->connection;
+
+    if (request->opcode != TFS_OP_BATCH) {
+        long start = stats_clock();
+
+        executeOperation(s, request->opcode, request->arg, request, &offset, &results[0], t);
+        stats_operation(request->opcode, results[0].status != SUCCESS, stats_clock() - start);
+        return 1;
+    }
+
+    if (request->count == 0 || request->count > TFS_MAX_BATCH) {
+        fprintf(stderr, "Error: invalid batch\n");
+        results[0].status = TECNICOFS_ERROR_INVALID_REQUEST;
+        results[0].value = 0;
+        return 1;
+    }
+
+    /* the operations are executed in order, as if sent one by one */
+    for (i = 0; i < request->count; i++) {
+        long start = stats_clock();
+
+        if (offset + sizeof(tfs_batch_op) > request->length)
+            break;
+
+        memcpy(&op, payload + offset, sizeof(tfs_batch_op));
+        offset += sizeof(tfs_batch_op);
+
+        if (op.opcode == TFS_OP_BATCH ||
+            executeOperation(s, op.opcode, op.arg, request, &offset, &results[i], NULL) == FAIL)
+            break;
+        stats_operation(op.opcode, results[i].status != SUCCESS, stats_clock() - start);
+    }
+
+    /* the operations after a malformed one can't be found */
+    for (; i < request->count; i++) {
+        results[i].status = TECNICOFS_ERROR_INVALID_REQUEST;
+        results[i].value = 0;
+    }
+
+    return request->count;
+}
+
+/*
+ * Adds requests to the queue, waiting while it is full.
+ * Input:
+ *  - requests: the requests
+ *  - count: number of requests
+ */
+void enqueueRequests(request **requests, int count) {
+
+    pthread_mutex_lock(&queueMutex);
+
+    for (int i = 0; i < count; i++) {
+        while (numberRequests == MAX_REQUESTS)
+            pthread_cond_wait(&canEnqueue, &queueMutex);
+
+        requestQueue[enqueueptr] = requests[i];
+        enqueueptr = (enqueueptr + 1) % MAX_REQUESTS;
+        numberRequests++;
+    }
+
+    if (count > 1)
+        pthread_cond_broadcast(&canDequeue);
+    else
+        pthread_cond_signal(&canDequeue);
+
+    pthread_mutex_unlock(&queueMutex);
+}
+
+/*
+ * Takes requests from the queue, waiting while it is empty. A worker takes
+ * its share of the queued requests, at most WORK_BATCH.
+ * Input:
+ *  - requests: where the requests are stored
+ * Returns: number of requests
+ */
+int dequeueRequests(request **requests) {
+
+    int count;
+
+    pthread_mutex_lock(&queueMutex);
+
+    while (numberRequests == 0)
+        pthread_cond_wait(&canDequeue, &queueMutex);
+
+    count = (numberRequests + numberThreads - 1) / numberThreads;
+    if (count > WORK_BATCH)
+        count = WORK_BATCH;
+    stats_dequeue(numberRequests, count);
+
+    for (int i = 0; i < count; i++) {
+        requests[i] = requestQueue[dequeueptr];
+        dequeueptr = (dequeueptr + 1) % MAX_REQUESTS;
+    }
+    numberRequests -= count;
+
+    pthread_cond_signal(&canEnqueue);
+    pthread_mutex_unlock(&queueMutex);
+
+    return count;
+}
+
+/*
+ * Releases a reference to a session, closing its connection with the last.
+ */
+void releaseSession(session *s) {
+
+    int refs;
+
+    pthread_mutex_lock(&s->mutex);
+    refs = --s->refs;
+    pthread_mutex_unlock(&s->mutex);
+
+    if (refs == 0) {
+        /* the files left open are closed with the session */
+        if (s->type == SESSION_CONNECTION) {
+            for (int fd = 0; fd < TFS_MAX_OPEN_FILES; fd++)
+                if (s->files[fd].inumber >= 0)
+                    close_file(s->files[fd].inumber);
+            pthread_cond_destroy(&s->unused);
+            __atomic_fetch_sub(&numberSessions, 1, __ATOMIC_RELAXED);
+        }
+        else {
+            munmap(s->shm, sizeof(tfs_shm));
+            close(s->clientEvent);
+            releaseSession(s->connection);
+        }
+        close(s->fd);
+        pthread_mutex_destroy(&s->mutex);
+        free(s);
+    }
+}
+
+/*
+ * Accepts a new session and starts reading its requests.
+ */
+void openSession() {
+
+    session *s;
+    int fd = accept(sessionfd, NULL, NULL);
+    struct epoll_event event = { EPOLLIN };
+
+    if (fd < 0) {
+        perror("server: accept error");
+        return;
+    }
+
+    if ((s = malloc(sizeof(session))) == NULL) {
+        fprintf(stderr, "Error: no memory for a session\n");
+        close(fd);
+        return;
+    }
+
+    *s = (session) { SESSION_CONNECTION, fd, 1, 0, 0 };
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->unused, NULL);
+    for (int i = 0; i < TFS_MAX_OPEN_FILES; i++)
+        s->files[i] = (openFile) { EMPTY, 0, 0, 0 };
+    s->ring = NULL;
+    __atomic_fetch_add(&numberSessions, 1, __ATOMIC_RELAXED);
+
+    event.data.ptr = s;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("server: epoll_ctl error");
+        releaseSession(s);
+    }
+}
+
+/*
+ * Sets up the shared memory rings of a session (TFS_OP_RING). It runs in
+ * the dispatcher, the only thread that reads the rings, and answers right
+ * away with the eventfds of the rings.
+ * Input:
+ *  - s: the session
+ *  - request: the request
+ *  - memfd: the memfd with the tfs_shm passed by the client, or -1
+ */
+void openRing(session *s, tfs_header *request, int memfd) {
+
+    tfs_result result = { SUCCESS, 0 };
+    tfs_header header = { TFS_OP_RING, 0, 1, request->request_id, sizeof(tfs_result) };
+    struct iovec iov[2] = { { &header, sizeof(header) }, { &result, sizeof(result) } };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct msghdr msg = { NULL, 0, iov, 2, NULL, 0, 0 };
+    struct epoll_event event = { EPOLLIN };
+    struct cmsghdr *cmsg;
+    struct stat st;
+    tfs_shm *shm = MAP_FAILED;
+    int fds[2] = { -1, -1 };
+    session *r = NULL;
+    int seals;
+
+    /* the client could otherwise shrink it while it is mapped (SIGBUS) */
+    if (s->ring != NULL || numberRings == MAX_RINGS || memfd < 0 ||
+        (seals = fcntl(memfd, F_GET_SEALS)) < 0 || (seals & F_SEAL_SHRINK) == 0 ||
+        fstat(memfd, &st) < 0 || st.st_size < (off_t) sizeof(tfs_shm))
+        result.status = TECNICOFS_ERROR_INVALID_REQUEST;
+    else if ((shm = mmap(NULL, sizeof(tfs_shm), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED ||
+             (fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ||
+             (fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ||
+             (r = malloc(sizeof(session))) == NULL)
+        result.status = TECNICOFS_ERROR_OTHER;
+    else {
+        *r = (session) { SESSION_RING, fds[0], 1, 0, 0 };
+        pthread_mutex_init(&r->mutex, NULL);
+        r->connection = s;
+        r->shm = shm;
+        r->clientEvent = fds[1];
+        r->requestHead = __atomic_load_n(&shm->requests.head, __ATOMIC_RELAXED);
+        r->responseTail = __atomic_load_n(&shm->responses.tail, __ATOMIC_RELAXED);
+        /* the client wakes the dispatcher until it spins on the rings */
+        __atomic_store_n(&shm->requests.sleeping, 1, __ATOMIC_SEQ_CST);
+
+        event.data.ptr = r;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, r->fd, &event) < 0) {
+            perror("server: epoll_ctl error");
+            result.status = TECNICOFS_ERROR_OTHER;
+            pthread_mutex_destroy(&r->mutex);
+            free(r);
+            r = NULL;
+        }
+    }
+
+    if (r != NULL) {
+        pthread_mutex_lock(&s->mutex);
+        s->refs++;
+        pthread_mutex_unlock(&s->mutex);
+        s->ring = r;
+        rings[numberRings++] = r;
+
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+    }
+    else {
+        if (shm != MAP_FAILED)
+            munmap(shm, sizeof(tfs_shm));
+        for (int i = 0; i < 2; i++)
+            if (fds[i] >= 0)
+                close(fds[i]);
+    }
+
+    /* a client that is gone is found by the dispatcher */
+    if (sendmsg(s->fd, &msg, MSG_NOSIGNAL) < 0 && errno != EPIPE && errno != ECONNRESET)
+        perror("server: sendmsg error");
+}
+
+/*
+ * Stops reading the rings of a session, they are released once the
+ * requests already read are answered.
+ */
+void closeRing(session *r) {
+
+    if (r->closed)
+        return;
+
+    for (int i = 0; i < numberRings; i++) {
+        if (rings[i] == r) {
+            rings[i] = rings[--numberRings];
+            break;
+        }
+    }
+
+    r->connection->ring = NULL;
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, r->fd, NULL);
+    r->closed = 1;
+    r->nextClosed = closedSessions;
+    closedSessions = r;
+}
+
+/*
+ * Stops reading the requests of a session, its connection is closed once
+ * the requests already read are answered.
+ */
+void closeSession(session *s) {
+
+    if (s->closed)
+        return;
+
+    if (s->ring != NULL)
+        closeRing(s->ring);
+
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, s->fd, NULL);
+    s->closed = 1;
+    s->nextClosed = closedSessions;
+    closedSessions = s;
+}
+
+/*
+ * Releases the references of the dispatcher to the sessions it closed.
+ */
+void releaseClosed() {
+
+    while (closedSessions != NULL) {
+        session *s = closedSessions;
+
+        closedSessions = s->nextClosed;
+        releaseSession(s);
+    }
+}
+
+/*
+ * Marks a request of a session as answered, reading its requests again if
+ * they were stopped.
+ */
+void finishRequest(session *s) {
+
+    struct epoll_event event = { EPOLLIN, { .ptr = s } };
+
+    if (s->type != SESSION_CONNECTION && s->type != SESSION_RING)
+        return;
+
+    pthread_mutex_lock(&s->mutex);
+    s->pending--;
+    if (s->throttled && s->pending <= MAX_SESSION_REQUESTS / 2) {
+        __atomic_store_n(&s->throttled, 0, __ATOMIC_RELAXED);
+        /* fails if the session was closed meanwhile */
+        if (s->type == SESSION_CONNECTION)
+            epoll_ctl(epollfd, EPOLL_CTL_MOD, s->fd, &event);
+        else
+            eventfd_write(s->fd, 1);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    releaseSession(s);
+}
+
+/*
+ * Reads the requests waiting in the socket of a session (or the datagram
+ * socket), in bursts of RECV_BATCH, and queues them. A connection is read
+ * until it has MAX_SESSION_REQUESTS pending requests.
+ * Input:
+ *  - s: the session
+ *  - hangup: the client closed the connection, the requests left are read
+ *    and the session is closed
+ */
+void receiveRequests(session *s, int hangup) {
+
+    static uint32_t buffers[RECV_BATCH][TFS_MAX_MESSAGE / sizeof(uint32_t)];
+    static struct sockaddr_un addrs[RECV_BATCH];
+    static fdControl controls[RECV_BATCH];
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iov[RECV_BATCH];
+    request *requests[RECV_BATCH];
+    int connection = s->type == SESSION_CONNECTION;
+    int max, received, count, eof = 0;
+
+    do {
+        max = RECV_BATCH;
+
+        if (connection && !hangup) {
+            struct epoll_event event = { 0, { .ptr = s } };
+
+            pthread_mutex_lock(&s->mutex);
+            if (max > MAX_SESSION_REQUESTS - s->pending)
+                max = MAX_SESSION_REQUESTS - s->pending;
+            if (max == 0) {
+                s->throttled = 1;
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, s->fd, &event);
+            }
+            pthread_mutex_unlock(&s->mutex);
+
+            if (max == 0)
+                return;
+        }
 
-            case 'p':
-                pthread_mutex_unlock(&mutexglobal);
-                printf("Print to file: %s\n", name);
-                operationResult = print(name);
-                pthread_mutex_unlock(&mutexglobal);
+        for (int i = 0; i < max; i++) {
+            iov[i].iov_base = buffers[i];
+            iov[i].iov_len = TFS_MAX_MESSAGE;
+            msgs[i].msg_hdr = (struct msghdr) { &addrs[i], sizeof(struct sockaddr_un), &iov[i], 1,
+                                                controls[i].buf, sizeof(controls[i].buf), 0 };
+        }
+
+        received = recvmmsg(s->fd, msgs, max, MSG_DONTWAIT | MSG_CMSG_CLOEXEC, NULL);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                if (errno != ECONNRESET)
+                    perror("server: recvmmsg error");
+                eof = connection;
+            }
+            break;
+        }
+
+        count = 0;
+        for (int i = 0; i < received; i++) {
+            tfs_header *header = (tfs_header *) buffers[i];
+            unsigned int length = msgs[i].msg_len;
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+            int fd = -1;
+            request *req;
+
+            /* a descriptor passed with the request (more don't fit, the
+            kernel closes them) */
+            if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+                memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+            /* an empty packet is the end of a connection */
+            if (connection && length == 0) {
+                if (fd >= 0)
+                    close(fd);
+                eof = 1;
                 break;
+            }
+
+            if (length < sizeof(tfs_header)) {
+                if (fd >= 0)
+                    close(fd);
+                continue;
+            }
+
+            /* truncated or inconsistent message, answered as an invalid request */
+            if (header->length != length - sizeof(tfs_header)) {
+                header->opcode = 0;
+                header->length = 0;
+                length = sizeof(tfs_header);
+            }
+
+            /* the rings are set up by the dispatcher, which reads them */
+            if (connection && header->opcode == TFS_OP_RING) {
+                openRing(s, header, fd);
+                if (fd >= 0)
+                    close(fd);
+                continue;
+            }
+
+            if ((req = malloc(sizeof(request) + length)) == NULL) {
+                fprintf(stderr, "Error: no memory for a request\n");
+                if (fd >= 0)
+                    close(fd);
+                continue;
+            }
+            req->session = s;
+            req->client_addr = addrs[i];
+            req->client_addrlen = msgs[i].msg_hdr.msg_namelen;
+            req->fd = fd;
+            memcpy(req->message, buffers[i], length);
+            requests[count++] = req;
+        }
+
+        if (connection && count > 0) {
+            pthread_mutex_lock(&s->mutex);
+            s->pending += count;
+            s->refs += count;
+            pthread_mutex_unlock(&s->mutex);
+        }
+
+        if (count > 0)
+            enqueueRequests(requests, count);
 
-            default: { /* error */
-                fprintf(stderr, "Error: command to apply\n");
-                exit(EXIT_FAILURE);
+    } while (received == max && !eof);
+
+    if (connection && (eof || hangup))
+        closeSession(s);
+}
+
+/*
+ * Reads the requests waiting in the rings of a session, in bursts of
+ * RECV_BATCH, and queues them. Like a connection, the rings are read until
+ * they have MAX_SESSION_REQUESTS pending requests.
+ * Input:
+ *  - r: the session of the rings
+ */
+void receiveRing(session *r) {
+
+    tfs_ring *ring = &r->shm->requests;
+    request *requests[RECV_BATCH];
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    int max, count;
+
+    /* a client that breaks the rings loses its session */
+    if (tail - r->requestHead > TFS_RING_SLOTS) {
+        fprintf(stderr, "Error: invalid ring\n");
+        closeSession(r->connection);
+        return;
+    }
+
+    while (r->requestHead != tail) {
+        pthread_mutex_lock(&r->mutex);
+        max = MAX_SESSION_REQUESTS - r->pending;
+        if (max > RECV_BATCH)
+            max = RECV_BATCH;
+        if (max == 0)
+            __atomic_store_n(&r->throttled, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&r->mutex);
+
+        if (max == 0)
+            return;
+
+        for (count = 0; count < max && r->requestHead != tail; r->requestHead++) {
+            char *slot = ring->slots[r->requestHead % TFS_RING_SLOTS];
+            tfs_header header;
+            unsigned int length;
+            request *req;
+
+            /* the client may still change the slot, only the copy is used */
+            memcpy(&header, slot, sizeof(tfs_header));
+            if (header.length > TFS_MAX_MESSAGE - sizeof(tfs_header)) {
+                header.opcode = 0;
+                header.length = 0;
             }
+            length = sizeof(tfs_header) + header.length;
+
+            if ((req = malloc(sizeof(request) + length)) == NULL) {
+                fprintf(stderr, "Error: no memory for a request\n");
+                continue;
+            }
+            req->session = r;
+            req->client_addrlen = 0;
+            req->fd = -1;
+            memcpy(req->message, &header, sizeof(tfs_header));
+            memcpy((char *) req->message + sizeof(tfs_header), slot + sizeof(tfs_header), header.length);
+            requests[count++] = req;
+        }
+
+        /* the slots can be reused by the client */
+        __atomic_store_n(&ring->head, r->requestHead, __ATOMIC_RELEASE);
+
+        if (count > 0) {
+            pthread_mutex_lock(&r->mutex);
+            r->pending += count;
+            r->refs += count;
+            pthread_mutex_unlock(&r->mutex);
+            enqueueRequests(requests, count);
         }
+    }
+}
+
+/*
+ * Reads the rings that have requests.
+ * Returns: 1 if any ring had requests, 0 otherwise
+ */
+int pollRings() {
+
+    int found = 0;
+
+    /* backwards, a ring closed meanwhile is replaced by one already seen */
+    for (int i = numberRings - 1; i >= 0; i--) {
+        session *r = rings[i];
 
-        if (sendto(sockfd, &operationResult, sizeof(int), 0, (struct sockaddr *)&client_addr, addrlen) < 0){
-            perror("server: bind error");
+        if (!__atomic_load_n(&r->throttled, __ATOMIC_RELAXED) &&
+            __atomic_load_n(&r->shm->requests.tail, __ATOMIC_ACQUIRE) != r->requestHead) {
+            receiveRing(r);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/*
+ * Tells the clients with rings if the dispatcher sleeps, so they wake it
+ * with the eventfd, or spins on the rings.
+ */
+void sleepRings(int sleeping) {
+
+    for (int i = 0; i < numberRings; i++)
+        __atomic_store_n(&rings[i]->shm->requests.sleeping, sleeping, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Waits for requests from the clients and queues them for the workers.
+ * After the rings have requests, they are polled for a while (adaptive
+ * spinning) without the clients having to wake the dispatcher, which
+ * then sleeps again.
+ */
+void *dispatchRequests() {
+
+    struct epoll_event event = { EPOLLIN };
+    struct epoll_event events[MAX_EVENTS];
+    int n, spins = 0;
+
+    datagramSession.fd = sockfd;
+    listenerSession.fd = sessionfd;
+    ringSpins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPINS : 0;
+
+    if ((epollfd = epoll_create1(0)) < 0) {
+        perror("server: epoll_create1 error");
+        exit(EXIT_FAILURE);
+    }
+
+    event.data.ptr = &datagramSession;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event) < 0) {
+        perror("server: epoll_ctl error");
+        exit(EXIT_FAILURE);
+    }
+
+    event.data.ptr = &listenerSession;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sessionfd, &event) < 0) {
+        perror("server: epoll_ctl error");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        int timeout = spins > 0 ? 0 : -1;
+
+        /* requests that got in before the clients saw the flags */
+        if (timeout < 0 && numberRings > 0) {
+            sleepRings(1);
+            if (pollRings())
+                timeout = 0;
+        }
+
+        if ((n = epoll_wait(epollfd, events, MAX_EVENTS, timeout)) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("server: epoll_wait error");
             exit(EXIT_FAILURE);
-        } 
+        }
+
+        for (int i = 0; i < n; i++) {
+            session *s = events[i].data.ptr;
+            eventfd_t value;
+
+            /* closed by an earlier event of the batch */
+            if (s->closed)
+                continue;
+
+            if (s->type == SESSION_LISTENER)
+                openSession();
+            else if (s->type == SESSION_RING) {
+                eventfd_read(s->fd, &value);
+                receiveRing(s);
+            }
+            else
+                receiveRequests(s, (events[i].events & (EPOLLHUP | EPOLLERR)) != 0);
+        }
+
+        if (ringSpins > 0) {
+            if (pollRings() || (n > 0 && timeout < 0)) {
+                if (spins == 0)
+                    sleepRings(0);
+                spins = ringSpins;
+            }
+            else if (spins > 0) {
+                spins--;
+                tfs_relax();
+            }
+        }
+
+        releaseClosed();
+    }
+}
+
+/*
+ * Copies a response to the ring of responses of a session, waking the
+ * client if it sleeps. Workers answer in parallel, so the ring has a lock
+ * for its producers.
+ * Input:
+ *  - r: the session of the rings
+ *  - iov: the parts of the response
+ *  - iovcnt: number of parts
+ */
+void ringRespond(session *r, struct iovec *iov, int iovcnt) {
+
+    tfs_ring *ring = &r->shm->responses;
+    char *slot;
+
+    pthread_mutex_lock(&r->mutex);
+
+    /* only if the client has more requests in the rings than it may */
+    if (r->responseTail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= TFS_RING_SLOTS) {
+        pthread_mutex_unlock(&r->mutex);
+        fprintf(stderr, "Error: ring of responses full\n");
+        return;
+    }
+
+    slot = ring->slots[r->responseTail % TFS_RING_SLOTS];
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(slot, iov[i].iov_base, iov[i].iov_len);
+        slot += iov[i].iov_len;
+    }
+    r->responseTail++;
+    __atomic_store_n(&ring->tail, r->responseTail, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&r->mutex);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED))
+        eventfd_write(r->clientEvent, 1);
+}
+
+/*
+ * Sends the responses of requests to their clients. The responses that go
+ * to the same socket in a row are sent together.
+ * Input:
+ *  - requests: the requests
+ *  - results: the results of the operations of each request
+ *  - counts: number of results of each request
+ *  - transfers: the data read and the descriptor passed by each request
+ *  - n: number of requests
+ */
+void sendResponses(request **requests, tfs_result results[][TFS_MAX_BATCH], int *counts,
+                   transfer *transfers, int n) {
+
+    tfs_header headers[n];
+    struct iovec iov[n][3];
+    fdControl controls[n];
+    struct mmsghdr msgs[n];
+    int sent, run;
+
+    for (int i = 0; i < n; i++) {
+        tfs_header *request = (tfs_header *) requests[i]->message;
+        int datagram = requests[i]->session->type == SESSION_DATAGRAM;
+        int dataLength = (request->opcode == TFS_OP_READ || request->opcode == TFS_OP_STATS) &&
+                         results[i][0].status == SUCCESS ? results[i][0].value : 0;
+
+        headers[i] = (tfs_header) { request->opcode, 0, counts[i], request->request_id,
+                                    counts[i] * sizeof(tfs_result) + dataLength };
+        iov[i][0] = (struct iovec) { &headers[i], sizeof(tfs_header) };
+        iov[i][1] = (struct iovec) { results[i], counts[i] * sizeof(tfs_result) };
+        iov[i][2] = (struct iovec) { transfers[i].data, dataLength };
+        msgs[i].msg_hdr = (struct msghdr) { datagram ? &requests[i]->client_addr : NULL,
+            datagram ? requests[i]->client_addrlen : 0, iov[i], 3, NULL, 0, 0 };
+
+        if (transfers[i].sent >= 0) {
+            struct cmsghdr *cmsg;
+
+            msgs[i].msg_hdr.msg_control = controls[i].buf;
+            msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].buf);
+            cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &transfers[i].sent, sizeof(int));
+        }
+    }
+
+    for (int i = 0; i < n; i += sent) {
+        int fd = requests[i]->session->fd;
+
+        if (requests[i]->session->type == SESSION_RING) {
+            ringRespond(requests[i]->session, iov[i], 3);
+            sent = 1;
+            continue;
+        }
+
+        for (run = 1; i + run < n && requests[i + run]->session == requests[i]->session; run++)
+            ;
+
+        if ((sent = sendmmsg(fd, msgs + i, run, MSG_NOSIGNAL)) < 0) {
+            /* the client of this response is gone, the others still get theirs */
+            if (errno != EPIPE && errno != ECONNRESET)
+                perror("server: sendmmsg error");
+            sent = 1;
+        }
+    }
+}
+
+void *applyCommands(){
+
+    request *requests[WORK_BATCH];
+    tfs_result results[WORK_BATCH][TFS_MAX_BATCH];
+    int counts[WORK_BATCH];
+    /* data read by each request, too large for the stack of the thread */
+    transfer *transfers = malloc(WORK_BATCH * sizeof(transfer));
+
+    if (transfers == NULL) {
+        fprintf(stderr, "Error: no memory for a worker\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1){
+
+        int n = dequeueRequests(requests);
+
+        for (int i = 0; i < n; i++) {
+            transfers[i].received = requests[i]->fd;
+            transfers[i].sent = -1;
+            counts[i] = executeRequest(requests[i]->session, (tfs_header *) requests[i]->message,
+                                       results[i], &transfers[i]);
+        }
+
+        sendResponses(requests, results, counts, transfers, n);
+
+        for (int i = 0; i < n; i++) {
+            /* the client has its own reference to the descriptors passed */
+            if (transfers[i].received >= 0)
+                close(transfers[i].received);
+            if (transfers[i].sent >= 0)
+                close(transfers[i].sent);
+            finishRequest(requests[i]->session);
+            free(requests[i]);
+        }
     }
 }
 
@@ -186,7 +1449,13 @@ int main(int argc, char* argv[]){
       exit(EXIT_FAILURE);
     }
 
-    pthread_t tid[numberThreads];
+    pthread_t tid[numberThreads], dispatcher;
+
+    /* create the dispatcher thread (producer) */
+    if (pthread_create(&dispatcher, NULL, dispatchRequests, NULL) != SUCCESS){
+        printf("Error: thread not created\n");
+        exit(EXIT_FAILURE);
+    }
 
     /* create the slave threads (consumers) */
     for (int i = 0; i < numberThreads; i++){
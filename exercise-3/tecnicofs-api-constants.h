@@ -2,10 +2,14 @@
 #ifndef TECNICOFS_API_CONSTANTS_H
 #define TECNICOFS_API_CONSTANTS_H
 
+#include <stdint.h>
+
 #define MAX_FILE_NAME 100
 #define MAX_INPUT_SIZE 100
 
 #define CLIENT_SOCKET "/tmp/client"
+/* Added to the server socket path for the socket of the sessions */
+#define TFS_SESSION_SUFFIX ".session"
 
 typedef enum permission { NONE, WRITE, READ, RW } permission;
 typedef enum type { T_FILE, T_DIRECTORY, T_NONE } type;
@@ -32,5 +36,165 @@ typedef enum type { T_FILE, T_DIRECTORY, T_NONE } type;
 #define TECNICOFS_ERROR_INVALID_MODE -10
 /* Generic error */
 #define TECNICOFS_ERROR_OTHER -11
+/* A component of the path is not a directory */
+#define TECNICOFS_ERROR_NOT_A_DIRECTORY -12
+/* Directory is not empty */
+#define TECNICOFS_ERROR_DIRECTORY_NOT_EMPTY -13
+/* Path is not valid for the operation (e.g. moving a directory to inside itself) */
+#define TECNICOFS_ERROR_INVALID_PATH -14
+/* Server can't allocate more files */
+#define TECNICOFS_ERROR_NO_SPACE -15
+/* Request message is malformed */
+#define TECNICOFS_ERROR_INVALID_REQUEST -16
+/* Batch has no room for more operations */
+#define TECNICOFS_ERROR_BATCH_FULL -17
+/* Number of requests in flight has been reached */
+#define TECNICOFS_ERROR_TOO_MANY_REQUESTS -18
+/* Path is a directory, the operation needs a file */
+#define TECNICOFS_ERROR_IS_A_DIRECTORY -19
+/* File would be larger than the server allows */
+#define TECNICOFS_ERROR_FILE_TOO_LARGE -20
+
+
+/*
+ * Wire protocol between clients and server.
+ *
+ * Messages go in datagrams (SOCK_DGRAM) or in the packets of a session
+ * (SOCK_SEQPACKET connection). Every message (request or response) starts
+ * with a tfs_header followed by `length` bytes of payload. Both ends run on
+ * the same host, so integers use the host byte order.
+ *
+ * Request payload: the arguments of the operation, each one encoded as a
+ * tfs_arglen with the length of the string, the string and a '\0' (not
+ * counted in the length), so the server can use the strings in place.
+ * Numbers are encoded as a tfs_argint.
+ *  - TFS_OP_CREATE: path (node type in the header arg)
+ *  - TFS_OP_DELETE, TFS_OP_LOOKUP: path
+ *  - TFS_OP_MOVE: path, new path
+ *  - TFS_OP_PRINT: output file
+ *  - TFS_OP_OPEN: path (permission in the header arg), only in a session
+ *  - TFS_OP_CLOSE: nothing (file descriptor in the header arg)
+ *  - TFS_OP_READ: number of bytes to read, at most TFS_MAX_READ (file
+ *    descriptor in the header arg)
+ *  - TFS_OP_WRITE: the data, as a string of at most TFS_MAX_WRITE bytes
+ *    that may contain '\0' (file descriptor in the header arg)
+ *  - TFS_OP_READ_BULK: number of bytes to read (file descriptor in the
+ *    header arg). The data goes in a sealed memfd passed with the response
+ *    (SCM_RIGHTS), not in the message.
+ *  - TFS_OP_WRITE_BULK: number of bytes to write (file descriptor in the
+ *    header arg). The data goes in a memfd passed with the request, which
+ *    must be sealed at least against shrinking and writes (F_SEAL_SHRINK,
+ *    F_SEAL_WRITE).
+ *  - TFS_OP_RING: nothing, only in a session (see tfs_shm)
+ *  - TFS_OP_STATS: nothing (TFS_STATS_TEXT or TFS_STATS_JSON in the header
+ *    arg)
+ *  - TFS_OP_BATCH: `count` operations (at most TFS_MAX_BATCH), each one a
+ *    tfs_batch_op followed by its arguments. They are executed in order.
+ *    Reads, bulk transfers and statistics can't be part of a batch.
+ *
+ * Response payload: `count` tfs_result (one per operation of a batch), with
+ * the request_id and opcode of the request in the header. The response of
+ * a read is followed by the data read (as many bytes as the result value),
+ * the same for the statistics of the server.
+ *
+ * Files are read and written through the file descriptors of a session,
+ * each one with its own offset, which are closed with the session.
+ */
+
+/* Largest message the server accepts */
+#define TFS_MAX_MESSAGE 65536
+/* Largest number of operations in a batch */
+#define TFS_MAX_BATCH 1024
+/* Largest number of files open in a session (descriptors fit in the header arg) */
+#define TFS_MAX_OPEN_FILES 64
+
+typedef enum tfs_opcode {
+    TFS_OP_CREATE = 1,
+    TFS_OP_DELETE,
+    TFS_OP_LOOKUP,
+    TFS_OP_MOVE,
+    TFS_OP_PRINT,
+    TFS_OP_BATCH,
+    TFS_OP_OPEN,
+    TFS_OP_CLOSE,
+    TFS_OP_READ,
+    TFS_OP_WRITE,
+    TFS_OP_READ_BULK,
+    TFS_OP_WRITE_BULK,
+    TFS_OP_RING,
+    TFS_OP_STATS
+} tfs_opcode;
+
+/* Formats of the statistics of the server */
+#define TFS_STATS_TEXT 0
+#define TFS_STATS_JSON 1
+
+typedef struct tfs_header {
+    uint8_t opcode;      /* tfs_opcode */
+    uint8_t arg;         /* small argument of the operation (node type, permission or file descriptor) */
+    uint16_t count;      /* number of results (responses) */
+    uint32_t request_id; /* chosen by the client, echoed in the response */
+    uint32_t length;     /* bytes of payload after the header */
+} tfs_header;
+
+typedef uint16_t tfs_arglen;
+typedef uint32_t tfs_argint;
+
+typedef struct tfs_batch_op {
+    uint8_t opcode;      /* tfs_opcode (other than TFS_OP_BATCH) */
+    uint8_t arg;         /* small argument of the operation */
+} tfs_batch_op;
+
+typedef struct tfs_result {
+    int32_t status;      /* 0 on success or a TECNICOFS_ERROR_* code */
+    int32_t value;       /* result of the operation (i-number found by a lookup,
+                            file descriptor opened or bytes read or written) */
+} tfs_result;
+
+/* Largest read and write, so their messages fit in TFS_MAX_MESSAGE */
+#define TFS_MAX_READ (TFS_MAX_MESSAGE - sizeof(tfs_header) - sizeof(tfs_result))
+#define TFS_MAX_WRITE (TFS_MAX_MESSAGE - sizeof(tfs_header) - sizeof(tfs_arglen) - 1)
+
+/*
+ * Shared memory transport of a session.
+ *
+ * The client creates a memfd with a tfs_shm and passes it (SCM_RIGHTS)
+ * with a TFS_OP_RING request on its session. The server answers with two
+ * eventfds: the first one wakes the server, the second one wakes the
+ * client. From then on the messages of the session may go through the
+ * rings instead of the socket, the same messages in a slot each. Messages
+ * that pass descriptors (bulk transfers) still go through the socket.
+ *
+ * Each ring has a single producer and a single consumer. The producer
+ * copies the message to the slot at `tail` and then moves `tail`, the
+ * consumer moves `head` once it is done with the slot at `head`. A consumer
+ * that runs out of messages sets `sleeping` before waiting on its eventfd,
+ * and a producer only writes to the eventfd when it finds `sleeping` set
+ * (after moving `tail`), so a busy peer costs no system calls.
+ * The client has at most TFS_RING_SLOTS requests in the rings, so the
+ * server always has room for the responses.
+ */
+
+/* slots of each ring (a power of two) */
+#define TFS_RING_SLOTS 64
+
+typedef struct tfs_ring {
+    uint32_t head __attribute__((aligned(64)));     /* written by the consumer */
+    uint32_t tail __attribute__((aligned(64)));     /* written by the producer */
+    uint32_t sleeping __attribute__((aligned(64))); /* the consumer waits on its eventfd */
+    char slots[TFS_RING_SLOTS][TFS_MAX_MESSAGE] __attribute__((aligned(64)));
+} tfs_ring;
+
+typedef struct tfs_shm {
+    tfs_ring requests;   /* client to server */
+    tfs_ring responses;  /* server to client */
+} tfs_shm;
+
+/* hint to the processor inside a loop waiting on a ring */
+static inline void tfs_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
 
 #endif /* TECNICOFS_API_CONSTANTS_H */